@@ -24,13 +24,23 @@
 
 FILE_ENCRYPT_BEGIN_NS
 
+inline constexpr char kBootUsecPath[] { "/boot/usec-crypt" };
+inline constexpr char kEncryptStateDir[] { "/var/lib/dde-file-manager/diskencrypt" };
+// headers of the devices encrypted in detached mode.
+inline constexpr char kDetachedHeaderDir[] { "/boot/usec-crypt/headers" };
+// the copy of header kept in kBootUsecPath during an online decryption.
+inline constexpr char kDecryptHeaderSuffix[] { "_decrypt_header" };
+
 struct EncryptParams
 {
     QString device;
     QString passphrase;
     QString cipher;
     QString recoveryPath;
-    QString tpmToken;
+    disk_encrypt::UsecToken tpmToken;
+    // keep the header in kDetachedHeaderDir and encrypt the data in place,
+    // the filesystem is not shrunk so any filesystem can be encrypted.
+    bool detachedHeader { false };
 
     bool isValid() const
     {
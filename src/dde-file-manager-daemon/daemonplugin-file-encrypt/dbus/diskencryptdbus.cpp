@@ -7,15 +7,27 @@
 #include "encrypt/encryptworker.h"
 #include "encrypt/diskencrypt.h"
 #include "notification/notifications.h"
+#include "scheduler/jobscheduler.h"
+#include "history/jobhistory.h"
+#include "encrypt/deferredunlock.h"
+#include "encrypt/recoverykey.h"
+#include "provision/autoencrypt.h"
+#include "device/blockdevicebackend.h"
+#include "encrypt/cryptaffinity.h"
+#include "encrypt/tpmlockout.h"
 
 #include <dfm-framework/dpf.h>
 #include <dfm-mount/dmount.h>
 
 #include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusArgument>
 #include <QtConcurrent>
 #include <QDateTime>
 #include <QDebug>
 #include <QSettings>
+#include <QJsonDocument>
+#include <QJsonObject>
 
 #include <libcryptsetup.h>
 
@@ -26,8 +38,17 @@ using namespace disk_encrypt;
 static constexpr char kActionEncrypt[] { "com.deepin.filemanager.daemon.DiskEncrypt.Encrypt" };
 static constexpr char kActionDecrypt[] { "com.deepin.filemanager.daemon.DiskEncrypt.Decrypt" };
 static constexpr char kActionChgPwd[] { "com.deepin.filemanager.daemon.DiskEncrypt.ChangePassphrase" };
+static constexpr char kActionUnlock[] { "com.deepin.filemanager.daemon.DiskEncrypt.Unlock" };
+static constexpr char kActionUnlockSystem[] { "com.deepin.filemanager.daemon.DiskEncrypt.UnlockSystem" };
+static constexpr char kActionPreflight[] { "com.deepin.filemanager.daemon.DiskEncrypt.Preflight" };
+static constexpr char kActionCryptoErase[] { "com.deepin.filemanager.daemon.DiskEncrypt.CryptoErase" };
+static constexpr char kActionQueryHistory[] { "com.deepin.filemanager.daemon.DiskEncrypt.QueryHistory" };
+static constexpr char kErrorWrongPassphraseName[] { "com.deepin.filemanager.daemon.DiskEncrypt.Error.WrongPassphrase" };
+static constexpr char kErrorUnlockFailedName[] { "com.deepin.filemanager.daemon.DiskEncrypt.Error.UnlockFailed" };
 static constexpr char kObjPath[] { "/com/deepin/filemanager/daemon/DiskEncrypt" };
 static constexpr char kEncConfigPath[] { "/boot/usec-crypt/encrypt.json" };
+// each preflight runs e2fsck and resize2fs in its own thread.
+static constexpr int kMaxPreflights { 2 };
 
 DiskEncryptDBus::DiskEncryptDBus(QObject *parent)
     : QObject(parent),
@@ -37,15 +58,16 @@ DiskEncryptDBus::DiskEncryptDBus(QObject *parent)
     new DiskEncryptDBusAdaptor(this);
 
     dfmmount::DDeviceManager::instance();
+    crypt_affinity::init(this);
 
     connect(SignalEmitter::instance(), &SignalEmitter::updateEncryptProgress,
             this, [this](const QString &dev, double progress) {
-                Q_EMIT this->EncryptProgress(dev, deviceName, progress);
+                Q_EMIT this->EncryptProgress(dev, deviceNames.value(dev), progress);
             },
             Qt::QueuedConnection);
     connect(SignalEmitter::instance(), &SignalEmitter::updateDecryptProgress,
             this, [this](const QString &dev, double progress) {
-                Q_EMIT this->DecryptProgress(dev, deviceName, progress);
+                Q_EMIT this->DecryptProgress(dev, deviceNames.value(dev), progress);
             },
             Qt::QueuedConnection);
 
@@ -56,8 +78,28 @@ DiskEncryptDBus::DiskEncryptDBus(QObject *parent)
             this, &DiskEncryptDBus::onEncryptDBusUnregistered);
 
     triggerReencrypt();
+    checkInterruptedDecrypt();
 
     QtConcurrent::run([this] { diskCheck(); });
+    // keys are ready before the first encrypt job asks.
+    RecoveryKeyGenerator::instance()->refill();
+
+    // drives are provisioned by the policy set by administrator, no user
+    // is asked for authorization.
+    provisioner = new AutoEncryptProvisioner(this);
+    connect(provisioner, &AutoEncryptProvisioner::encryptRequested,
+            this, &DiskEncryptDBus::prepareEncrypt);
+    connect(provisioner, &AutoEncryptProvisioner::batchFinished,
+            this, &DiskEncryptDBus::AutoEncryptReport);
+    connect(this, &DiskEncryptDBus::PrepareEncryptDiskResult,
+            this, [this](const QString &dev, const QString &, const QString &, int code) {
+                if (code != kSuccess)
+                    provisioner->jobFinished(dev, code);
+            });
+    connect(this, &DiskEncryptDBus::EncryptDiskResult,
+            this, [this](const QString &dev, const QString &, int code) {
+                provisioner->jobFinished(dev, code);
+            });
 }
 
 DiskEncryptDBus::~DiskEncryptDBus()
@@ -66,15 +108,26 @@ DiskEncryptDBus::~DiskEncryptDBus()
 
 QString DiskEncryptDBus::PrepareEncryptDisk(const QVariantMap &params)
 {
-    deviceName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
+    QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    QString devName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
+    deviceNames.insert(dev, devName);
     if (!checkAuth(kActionEncrypt)) {
-        Q_EMIT PrepareEncryptDiskResult(params.value(encrypt_param_keys::kKeyDevice).toString(),
-                                        deviceName,
+        Q_EMIT PrepareEncryptDiskResult(dev,
+                                        devName,
                                         "",
                                         -kUserCancelled);
         return "";
     }
 
+    return prepareEncrypt(params);
+}
+
+QString DiskEncryptDBus::prepareEncrypt(const QVariantMap &params)
+{
+    QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    QString devName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
+    deviceNames.insert(dev, devName);
+
     auto jobID = JOB_ID.arg(QDateTime::currentMSecsSinceEpoch());
     PrencryptWorker *worker = new PrencryptWorker(jobID,
                                                   params,
@@ -90,37 +143,62 @@ QString DiskEncryptDBus::PrepareEncryptDisk(const QVariantMap &params)
         if (params.value(encrypt_param_keys::kKeyInitParamsOnly).toBool()
             || ret != kSuccess) {
             Q_EMIT this->PrepareEncryptDiskResult(device,
-                                                  deviceName,
+                                                  devName,
                                                   jobID,
                                                   static_cast<int>(ret));
         } else {
             qInfo() << "start reencrypt device" << device;
             int ksCipher = worker->cipherPos();
             int ksRec = worker->recKeyPos();
-            startReencrypt(device,
+            startReencrypt(jobID,
+                           device,
                            params.value(encrypt_param_keys::kKeyPassphrase).toString(),
-                           params.value(encrypt_param_keys::kKeyTPMToken).toString(),
+                           UsecToken::fromVariant(params.value(encrypt_param_keys::kKeyTPMToken)),
+                           worker->activeName(),
+                           worker->volumeKey(),
                            ksCipher,
-                           ksRec);
+                           ksRec,
+                           worker->unlockRequired());
         }
 
         worker->deleteLater();
     });
 
-    worker->start();
+    // only the header is touched when init params only, no need to queue it.
+    if (params.value(encrypt_param_keys::kKeyInitParamsOnly).toBool()) {
+        worker->start();
+    } else if (preflights.contains(dev)) {
+        // the job would redo what the running preflight is doing, wait for it.
+        qInfo() << "wait for preflight before encrypting" << dev;
+        connect(preflights.value(dev), &QThread::finished, this, [=] {
+            JobScheduler::instance()->enqueue(worker, dev);
+        });
+    } else {
+        JobScheduler::instance()->enqueue(worker, dev);
+    }
 
     return jobID;
 }
 
 QString DiskEncryptDBus::DecryptDisk(const QVariantMap &params)
 {
-    deviceName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
     QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    QString devName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
+    deviceNames.insert(dev, devName);
     if (!checkAuth(kActionDecrypt)) {
-        Q_EMIT DecryptDiskResult(dev, deviceName, "", -kUserCancelled);
+        Q_EMIT DecryptDiskResult(dev, devName, "", -kUserCancelled);
         return "";
     }
 
+    return decrypt(params);
+}
+
+QString DiskEncryptDBus::decrypt(const QVariantMap &params)
+{
+    QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    QString devName = deviceNames.value(dev);
+    interruptedDecrypts.removeAll(dev);
+
     auto jobID = JOB_ID.arg(QDateTime::currentMSecsSinceEpoch());
 
     QString pass = params.value(encrypt_param_keys::kKeyPassphrase).toString();
@@ -136,20 +214,24 @@ QString DiskEncryptDBus::DecryptDisk(const QVariantMap &params)
         qDebug() << "decrypt device finished:"
                  << dev
                  << ret;
-        Q_EMIT DecryptDiskResult(dev, deviceName, jobID, ret);
+        Q_EMIT DecryptDiskResult(dev, devName, jobID, ret);
         worker->deleteLater();
     });
-    worker->start();
+
+    if (params.value(encrypt_param_keys::kKeyInitParamsOnly).toBool())
+        worker->start();
+    else
+        JobScheduler::instance()->enqueue(worker, dev);
     return jobID;
 }
 
 QString DiskEncryptDBus::ChangeEncryptPassphress(const QVariantMap &params)
 {
-    deviceName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
     QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    QString devName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
     if (!checkAuth(kActionChgPwd)) {
         Q_EMIT ChangePassphressResult(dev,
-                                      deviceName,
+                                      devName,
                                       "",
                                       -kUserCancelled);
         return "";
@@ -163,18 +245,290 @@ QString DiskEncryptDBus::ChangeEncryptPassphress(const QVariantMap &params)
         qDebug() << "change password finished:"
                  << dev
                  << ret;
-        Q_EMIT ChangePassphressResult(dev, deviceName, jobID, ret);
+        Q_EMIT ChangePassphressResult(dev, devName, jobID, ret);
         worker->deleteLater();
     });
     worker->start();
     return jobID;
 }
 
+QString DiskEncryptDBus::CompactKeyslots(const QVariantMap &params)
+{
+    QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    QString devName = params.value(encrypt_param_keys::kKeyDeviceName).toString();
+    if (!checkAuth(kActionChgPwd)) {
+        Q_EMIT CompactKeyslotsResult(dev, devName, "", {}, -kUserCancelled);
+        return "";
+    }
+
+    auto jobID = JOB_ID.arg(QDateTime::currentMSecsSinceEpoch());
+    CompactKeyslotsWorker *worker = new CompactKeyslotsWorker(jobID, params, this);
+    connect(worker, &QThread::finished, this, [=] {
+        int ret = worker->exitError();
+        qDebug() << "compact keyslots finished:"
+                 << dev
+                 << ret;
+        Q_EMIT CompactKeyslotsResult(dev, devName, jobID, worker->report(), ret);
+        worker->deleteLater();
+    });
+    worker->start();
+    return jobID;
+}
+
+QString DiskEncryptDBus::ResealTPMTokens(const QVariantMap &params)
+{
+    // authorized once for all devices.
+    if (!checkAuth(kActionChgPwd)) {
+        Q_EMIT ResealTPMTokensResult("", {}, -kUserCancelled);
+        return "";
+    }
+
+    // nested containers arrive as QDBusArgument.
+    QVariant devsVar = params.value(encrypt_param_keys::kKeyDevices);
+    if (devsVar.canConvert<QDBusArgument>())
+        devsVar = qdbus_cast<QVariantList>(devsVar.value<QDBusArgument>());
+    QVariantList devices;
+    const QVariantList &devList = devsVar.toList();
+    for (const auto &dev : devList) {
+        devices.append(dev.canConvert<QDBusArgument>() ? qdbus_cast<QVariantMap>(dev.value<QDBusArgument>())
+                                                       : dev.toMap());
+    }
+    if (devices.isEmpty()) {
+        Q_EMIT ResealTPMTokensResult("", {}, -kErrorParamsInvalid);
+        return "";
+    }
+
+    auto jobID = JOB_ID.arg(QDateTime::currentMSecsSinceEpoch());
+    ResealWorker *worker = new ResealWorker(jobID, devices, this);
+    connect(worker, &QThread::finished, this, [=] {
+        int ret = worker->exitError();
+        qDebug() << "reseal tpm tokens finished:"
+                 << ret;
+        Q_EMIT ResealTPMTokensResult(jobID, worker->results(), ret);
+        worker->deleteLater();
+    });
+    worker->start();
+    return jobID;
+}
+
+QString DiskEncryptDBus::UnlockDevice(const QString &device, const QString &secret, const QVariantMap &options)
+{
+    // devices of the system need an administrator, removable ones are left
+    // to the active user. a deferred device was set up by administrator to
+    // be unlocked at login, it is handed out by ClaimDeferredUnlock only.
+    qint64 claimedAt = deferred_unlock::claimedAt(device);
+    bool deferred = options.value(encrypt_param_keys::kKeyDeferredUnlock, false).toBool()
+            && claimedAt > 0;
+    auto blkDev = block_device_utils::bcCreateBlkDev(device);
+    bool system = !blkDev || blkDev->hintSystem();
+    if (!checkAuth((system && !deferred) ? kActionUnlockSystem : kActionUnlock)) {
+        sendErrorReply(QDBusError::AccessDenied, "not authorized");
+        return "";
+    }
+
+    // the kdf takes a while, reply when the device is activated and keep
+    // the main loop free for the running jobs.
+    setDelayedReply(true);
+    QDBusMessage msg = message();
+    QDBusConnection conn = connection();
+    uint32_t flags = disk_encrypt_utils::bcActivateFlags(device, options);
+    bool resumeDecrypt = interruptedDecrypts.contains(device);
+    QtConcurrent::run([=] {
+        // the time taken off the boot critical path by deferring the unlock.
+        // the tpm is unsealed by the session between the claim and this call.
+        if (deferred) {
+            job_history::begin("", "deferred-unlock", device);
+            job_history::addPhase("tpm", QDateTime::currentMSecsSinceEpoch() - claimedAt);
+            job_history::enterPhase("unlock");
+        }
+
+        QString clearDev;
+        int ret = disk_encrypt_funcs::bcUnlockDevice(device, secret, flags, &clearDev);
+        qInfo() << "unlock device finished:" << device << clearDev << ret;
+
+        // the fstab entry is noauto, mounting it by UDisks as user would ask
+        // for the filesystem-fstab authorization.
+        MountItem item;
+        if (ret == kSuccess && deferred && !block_device_utils::bcIsMounted(clearDev)
+            && deferred_unlock::mountItem(device, &item)) {
+            job_history::enterPhase("mount");
+            if (block_device_utils::bcMount(clearDev, item) != kSuccess)
+                qWarning() << "cannot mount deferred device" << clearDev << item.mountPoint;
+        }
+        if (deferred)
+            job_history::finish(ret);
+
+        // the key of an interrupted decryption is known now, go on with it.
+        if (ret == kSuccess && resumeDecrypt) {
+            QVariantMap params {
+                { encrypt_param_keys::kKeyDevice, device },
+                { encrypt_param_keys::kKeyPassphrase, secret },
+                { encrypt_param_keys::kKeyOnlineMode, true }
+            };
+            QMetaObject::invokeMethod(this, [this, params] { decrypt(params); }, Qt::QueuedConnection);
+        }
+        if (ret == kSuccess)
+            conn.send(msg.createReply(clearDev));
+        else
+            conn.send(msg.createErrorReply(ret == -kErrorWrongPassphrase ? kErrorWrongPassphraseName
+                                                                         : kErrorUnlockFailedName,
+                                           QString::number(ret)));
+    });
+    return "";
+}
+
+bool DiskEncryptDBus::CancelPreflight(const QString &device)
+{
+    if (!checkAuth(kActionPreflight))
+        return false;
+
+    auto worker = preflights.value(device);
+    if (!worker)
+        return false;
+    worker->cancel();
+    return true;
+}
+
+QVariantMap DiskEncryptDBus::PreflightEncrypt(const QVariantMap &params)
+{
+    if (!checkAuth(kActionPreflight))
+        return { { "error", -kUserCancelled } };
+
+    // the first call, while user is still filling the params, starts the
+    // slow checks in background. the committed job reuses their results.
+    startPreflight(params);
+
+    // cheap checks only, the caller gets all the problems at once before
+    // the job is queued.
+    return preflight::check(params);
+}
+
+void DiskEncryptDBus::startPreflight(const QVariantMap &params)
+{
+    QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    if (dev.isEmpty() || preflights.contains(dev) || preflight::has(dev))
+        return;
+    if (!preflight::isBlockDevice(dev)) {
+        qWarning() << "no preflight for a non block device" << dev;
+        return;
+    }
+    // the job checks the filesystem itself if there is no report.
+    if (preflights.count() >= kMaxPreflights) {
+        qInfo() << "too many preflights running, skip" << dev;
+        return;
+    }
+
+    auto jobID = JOB_ID.arg(QDateTime::currentMSecsSinceEpoch());
+    PreflightWorker *worker = new PreflightWorker(jobID, params, this);
+    preflights.insert(dev, worker);
+    connect(worker, &QThread::finished, this, [=] {
+        int ret = worker->exitError();
+        qDebug() << "preflight finished:"
+                 << dev
+                 << ret;
+        preflights.remove(dev);
+        Q_EMIT PreflightResult(dev, jobID, worker->report(), ret);
+        worker->deleteLater();
+    });
+
+    // read only, not queued, the committed job waits for it instead.
+    worker->start(QThread::LowPriority);
+}
+
+QVariantMap DiskEncryptDBus::QueryAutoEncryptReport()
+{
+    // the drives provisioned and where their recovery keys went, it's a
+    // record of jobs like the history.
+    if (!checkAuth(kActionQueryHistory)) {
+        sendErrorReply(QDBusError::AccessDenied, "not authorized");
+        return {};
+    }
+    return provisioner->lastReport();
+}
+
+QString DiskEncryptDBus::CryptoErase(const QVariantMap &params)
+{
+    QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    // never cached, every erase asks for the admin.
+    if (!checkAuth(kActionCryptoErase)) {
+        Q_EMIT CryptoEraseResult(dev, "", -kUserCancelled);
+        return "";
+    }
+    if (dev.isEmpty()) {
+        Q_EMIT CryptoEraseResult(dev, "", -kErrorParamsInvalid);
+        return "";
+    }
+
+    auto jobID = JOB_ID.arg(QDateTime::currentMSecsSinceEpoch());
+    CryptoEraseWorker *worker = new CryptoEraseWorker(jobID, params, this);
+    connect(worker, &QThread::finished, this, [=] {
+        int ret = worker->exitError();
+        qInfo() << "crypto erase finished:"
+                << dev
+                << ret;
+        // the worker dropped the crypttab entry of the erased device.
+        if (ret == kSuccess)
+            QtConcurrent::run([] { updateInitrd(); });
+        Q_EMIT CryptoEraseResult(dev, jobID, ret);
+        worker->deleteLater();
+    });
+    JobScheduler::instance()->enqueue(worker, dev);
+    return jobID;
+}
+
+QVariantList DiskEncryptDBus::QueryJobHistory(const QVariantMap &filter)
+{
+    // devices, timings and cpu sets of every user's jobs are in it.
+    if (!checkAuth(kActionQueryHistory)) {
+        sendErrorReply(QDBusError::AccessDenied, "not authorized");
+        return {};
+    }
+    return job_history::query(filter);
+}
+
+QStringList DiskEncryptDBus::ClaimDeferredUnlock()
+{
+    if (!checkAuth(kActionUnlock))
+        return {};
+
+    // each device is handed out once per boot, the plugin may be loaded by
+    // more than one process of the session, and the daemon may be restarted.
+    QStringList devices;
+    const QStringList &deferred = deferred_unlock::devices();
+    for (const auto &dev : deferred) {
+        if (!block_device_utils::bcActiveName(dev).isEmpty() || !deferred_unlock::claim(dev))
+            continue;
+        devices.append(dev);
+    }
+    qInfo() << "deferred devices to unlock:" << devices;
+    return devices;
+}
+
 QString DiskEncryptDBus::QueryTPMToken(const QString &device)
 {
-    QString token;
+    // kept for callers of the json reply, new ones use QueryUsecToken.
+    UsecToken token;
+    disk_encrypt_funcs::bcGetToken(device, &token);
+    return token.isTPM() ? QString(token.toJson()) : QString();
+}
+
+QVariantMap DiskEncryptDBus::QueryUsecToken(const QString &device)
+{
+    UsecToken token;
     disk_encrypt_funcs::bcGetToken(device, &token);
-    return token;
+    return token.isTPM() ? token.toVariantMap() : QVariantMap();
+}
+
+QVariantMap DiskEncryptDBus::QueryTPMLockout()
+{
+    // tpm2_getcap may wait for the TPM, keep the main loop free.
+    setDelayedReply(true);
+    QDBusMessage msg = message();
+    QDBusConnection conn = connection();
+    QtConcurrent::run([=] {
+        conn.send(msg.createReply(tpm_lockout::query()));
+    });
+    return {};
 }
 
 void DiskEncryptDBus::onEncryptDBusRegistered(const QString &service)
@@ -212,13 +566,13 @@ void DiskEncryptDBus::onEncryptDBusUnregistered(const QString &service)
 
 void DiskEncryptDBus::onFstabDiskEncProgressUpdated(const QString &dev, qint64 offset, qint64 total)
 {
-    Q_EMIT EncryptProgress(currentEncryptingDevice, deviceName, (1.0 * offset) / total);
+    Q_EMIT EncryptProgress(currentEncryptingDevice, deviceNames.value(currentEncryptingDevice), (1.0 * offset) / total);
 }
 
 void DiskEncryptDBus::onFstabDiskEncFinished(const QString &dev, int result, const QString &errstr)
 {
     qInfo() << "device has been encrypted: " << dev << result << errstr;
-    Q_EMIT EncryptDiskResult(dev, deviceName, result != 0 ? -1000 : 0);
+    Q_EMIT EncryptDiskResult(dev, deviceNames.value(currentEncryptingDevice), result != 0 ? -1000 : 0);
     if (result == 0) {
         qInfo() << "encrypt finished, remove encrypt config";
         ::remove(kEncConfigPath);
@@ -232,12 +586,18 @@ bool DiskEncryptDBus::checkAuth(const QString &actID)
             .toBool();
 }
 
-void DiskEncryptDBus::startReencrypt(const QString &dev, const QString &passphrase, const QString &token, int /*cipherPos*/, int recPos)
+void DiskEncryptDBus::startReencrypt(const QString &jobID,
+                                     const QString &dev, const QString &passphrase, const UsecToken &token,
+                                     const QString &activeName, const VolumeKeyPtr &volumeKey,
+                                     int /*cipherPos*/, int recPos, bool unlockRequired)
 {
-    ReencryptWorker *worker = new ReencryptWorker(dev, passphrase, this);
+    ReencryptWorker *worker = new ReencryptWorker(jobID, dev, passphrase, activeName, volumeKey, this);
     connect(worker, &ReencryptWorker::deviceReencryptResult,
-            this, [this](const QString &dev, int result) {
-                Q_EMIT this->EncryptDiskResult(dev, deviceName, result);
+            this, [this, unlockRequired](const QString &dev, int result) {
+                // the data is safe but the filesystem is no longer mounted.
+                if (result == kSuccess && unlockRequired)
+                    result = -kRebootRequired;
+                Q_EMIT this->EncryptDiskResult(dev, deviceNames.value(dev), result);
             });
     connect(worker, &QThread::finished, this, [=] {
         int ret = worker->exitError();
@@ -247,30 +607,35 @@ void DiskEncryptDBus::startReencrypt(const QString &dev, const QString &passphra
         setToken(dev, token);
 
         if (recPos >= 0) {
-            QString tokenJson = QString("{ 'type': 'usec-recoverykey', 'keyslots': ['%1'] }").arg(recPos);
-            setToken(dev, tokenJson);
+            UsecToken recToken;
+            recToken.type = kTokenTypeRecKey;
+            recToken.keyslots = { recPos };
+            setToken(dev, recToken);
         }
     });
-    worker->start();
+
+    // follows the prepare job of the same device, keep it ahead of the others.
+    JobScheduler::instance()->enqueue(worker, dev, true);
 }
 
-void DiskEncryptDBus::setToken(const QString &dev, const QString &token)
+void DiskEncryptDBus::setToken(const QString &dev, const UsecToken &token)
 {
-    if (token.isEmpty())
+    if (token.type.isEmpty())
         return;
 
-    int ret = disk_encrypt_funcs::bcSetToken(dev, token.toStdString().c_str());
+    int ret = disk_encrypt_funcs::bcSetToken(dev, token);
     if (ret != 0)
         qWarning() << "set token failed for device" << dev;
 }
 
 void DiskEncryptDBus::triggerReencrypt()
 {
-    QString clearDev;
-    if (!readEncryptDevice(&currentEncryptingDevice, &clearDev, &deviceName)) {
+    QString clearDev, devName;
+    if (!readEncryptDevice(&currentEncryptingDevice, &clearDev, &devName)) {
         qInfo() << "no encrypt config or config is invalid.";
         return;
     }
+    deviceNames.insert(currentEncryptingDevice, devName);
 
     QFile devHandler("/dev/usec_crypt");
     if (!devHandler.exists()) {
@@ -296,6 +661,30 @@ void DiskEncryptDBus::triggerReencrypt()
     devHandler.close();
 }
 
+void DiskEncryptDBus::checkInterruptedDecrypt()
+{
+    // the header kept for an online decryption is removed when it finishes,
+    // what is left belongs to a decryption that was cut by reboot or crash.
+    // the device can only be unlocked with the kept header, it is resumed
+    // once the device is unlocked through daemon.
+    QDir usec(kBootUsecPath);
+    const QStringList &headers = usec.entryList({ QString("*") + kDecryptHeaderSuffix }, QDir::Files);
+    for (const auto &header : headers) {
+        const QString &spec = "PARTUUID=" + header.chopped(strlen(kDecryptHeaderSuffix));
+        const QString &device = block_device_utils::bcResolveSpec(spec);
+        if (device.isEmpty()) {
+            qWarning() << "device of interrupted decryption is missing" << spec;
+            continue;
+        }
+        if (block_device_utils::bcInterruptedDecryptHeader(device) != usec.filePath(header)) {
+            qWarning() << "kept header does not match the device" << header << device;
+            continue;
+        }
+        qInfo() << "online decryption is interrupted, resume it after unlock" << device;
+        interruptedDecrypts.append(device);
+    }
+}
+
 void DiskEncryptDBus::diskCheck()
 {
     if (updateCrypttab())
@@ -305,20 +694,14 @@ void DiskEncryptDBus::diskCheck()
 void DiskEncryptDBus::getDeviceMapper(QMap<QString, QString> *dev2uuid, QMap<QString, QString> *uuid2dev)
 {
     Q_ASSERT(dev2uuid && uuid2dev);
-    using namespace dfmmount;
-    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
-    Q_ASSERT(monitor);
-
-    const QStringList &objPaths = monitor->getDevices();
-    for (const auto &objPath : objPaths) {
-        auto blkPtr = monitor->createDeviceById(objPath).objectCast<DBlockDevice>();
-        if (!blkPtr) continue;
-
-        QString uuid = blkPtr->getProperty(dfmmount::Property::kBlockIDUUID).toString();
-        if (uuid.isEmpty()) continue;
-
-        QString dev = blkPtr->device();
-        uuid = QString("UUID=") + uuid;
+    auto backend = BlockDeviceBackend::instance();
+    const QStringList &devs = backend->devices();
+    for (const auto &dev : devs) {
+        BlockDeviceInfo info;
+        if (!backend->probe(dev, &info)) continue;
+        if (info.idUUID.isEmpty()) continue;
+
+        QString uuid = QString("UUID=") + info.idUUID;
         dev2uuid->insert(dev, uuid);
         uuid2dev->insert(uuid, dev);
     }
@@ -374,18 +757,23 @@ int DiskEncryptDBus::isEncrypted(const QString &device)
     QString dev = device;
     if (dev.startsWith("UUID"))
         dev = uuid2dev.value(dev);
+    else if (dev.startsWith("PARTUUID="))
+        dev = "/dev/disk/by-partuuid/" + dev.mid(9);
     if (dev.isEmpty()) {
         qDebug() << "cannot find device description. ignore." << device;
         return -1;
     }
 
-    auto devPtr = block_device_utils::bcCreateBlkDev(dev);
-    if (!devPtr) {
-        qDebug() << "cannot construct device pointer by " << dev;
+    if (!block_device_utils::bcDetachedHeader(dev).isEmpty())
+        return 1;
+
+    BlockDeviceInfo info;
+    if (!BlockDeviceBackend::instance()->probe(dev, &info)) {
+        qDebug() << "cannot probe device " << dev;
         return -2;
     }
 
-    return devPtr->isEncrypted() ? 1 : 0;
+    return info.encrypted ? 1 : 0;
 }
 
 void DiskEncryptDBus::updateInitrd()
@@ -6,12 +6,15 @@
 #define DISKENCRYPTDBUS_H
 
 #include "daemonplugin_file_encrypt_global.h"
+#include "encrypt/volumekey.h"
 
 #include <QObject>
 #include <QDBusContext>
 #include <QDBusServiceWatcher>
 
 FILE_ENCRYPT_BEGIN_NS
+class PreflightWorker;
+class AutoEncryptProvisioner;
 class DiskEncryptDBus : public QObject, public QDBusContext
 {
     Q_OBJECT
@@ -26,14 +29,30 @@ public Q_SLOTS:
     QString DecryptDisk(const QVariantMap &params);
     QString ChangeEncryptPassphress(const QVariantMap &params);
     QString QueryTPMToken(const QString &device);
+    QVariantMap QueryUsecToken(const QString &device);
+    QVariantMap QueryTPMLockout();
+    QString CompactKeyslots(const QVariantMap &params);
+    QString ResealTPMTokens(const QVariantMap &params);
+    QString UnlockDevice(const QString &device, const QString &secret, const QVariantMap &options);
+    bool CancelPreflight(const QString &device);
+    QVariantMap PreflightEncrypt(const QVariantMap &params);
+    QVariantList QueryJobHistory(const QVariantMap &filter);
+    QStringList ClaimDeferredUnlock();
+    QVariantMap QueryAutoEncryptReport();
+    QString CryptoErase(const QVariantMap &params);
 
 Q_SIGNALS:
     void PrepareEncryptDiskResult(const QString &device, const QString &devName, const QString &jobID, int errCode);
     void EncryptDiskResult(const QString &device, const QString &devName, int errCode);
     void DecryptDiskResult(const QString &device, const QString &devName, const QString &jobID, int errCode);
     void ChangePassphressResult(const QString &device, const QString &devName, const QString &jobID, int errCode);
+    void ResealTPMTokensResult(const QString &jobID, const QVariantMap &results, int errCode);
+    void CompactKeyslotsResult(const QString &device, const QString &devName, const QString &jobID, const QVariantMap &report, int errCode);
+    void PreflightResult(const QString &device, const QString &jobID, const QVariantMap &report, int errCode);
     void EncryptProgress(const QString &device, const QString &devName, double progress);
     void DecryptProgress(const QString &device, const QString &devName, double progress);
+    void AutoEncryptReport(const QVariantMap &report);
+    void CryptoEraseResult(const QString &device, const QString &jobID, int errCode);
 
 private Q_SLOTS:
     void onEncryptDBusRegistered(const QString &service);
@@ -43,9 +62,16 @@ private Q_SLOTS:
 
 private:
     bool checkAuth(const QString &actID);
-    void startReencrypt(const QString &dev, const QString &passphrase, const QString &token, int cipherPos, int recPos);
-    void setToken(const QString &dev, const QString &token);
+    QString prepareEncrypt(const QVariantMap &params);
+    QString decrypt(const QVariantMap &params);
+    void startPreflight(const QVariantMap &params);
+    void startReencrypt(const QString &jobID,
+                        const QString &dev, const QString &passphrase, const disk_encrypt::UsecToken &token,
+                        const QString &activeName, const VolumeKeyPtr &volumeKey,
+                        int cipherPos, int recPos, bool unlockRequired = false);
+    void setToken(const QString &dev, const disk_encrypt::UsecToken &token);
     void triggerReencrypt();
+    void checkInterruptedDecrypt();
     void diskCheck();
     static void getDeviceMapper(QMap<QString, QString> *dev2uuid, QMap<QString, QString> *uuid2dev);
     static bool updateCrypttab();
@@ -57,7 +83,10 @@ private:
 private:
     QSharedPointer<QDBusServiceWatcher> watcher;
     QString currentEncryptingDevice;
-    QString deviceName;
+    QMap<QString, QString> deviceNames;
+    QMap<QString, PreflightWorker *> preflights;
+    QStringList interruptedDecrypts;
+    AutoEncryptProvisioner *provisioner { nullptr };
 };
 
 FILE_ENCRYPT_END_NS
@@ -0,0 +1,115 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "blockdevicebackend.h"
+#include "encrypt/diskencrypt.h"
+
+#include <dfm-mount/dmount.h>
+
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+
+#include <blkid/blkid.h>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr char kSysBlockPath[] { "/sys/class/block" };
+static constexpr char kBackendEnv[] { "DFM_DISK_ENCRYPT_DEVICE_BACKEND" };
+
+BlockDeviceBackend *BlockDeviceBackend::instance()
+{
+    static BlockDeviceBackend *backend = []() -> BlockDeviceBackend * {
+        const QByteArray &name = qgetenv(kBackendEnv);
+        BlockDeviceBackend *ins = nullptr;
+        if (name == "udisks")
+            ins = new UDisksBackend;
+        else
+            ins = new BlkidBackend;
+        qInfo() << "block device backend:" << ins->name();
+        return ins;
+    }();
+    return backend;
+}
+
+QStringList UDisksBackend::devices()
+{
+    using namespace dfmmount;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    Q_ASSERT(monitor);
+
+    QStringList devs;
+    const QStringList &objPaths = monitor->getDevices();
+    for (const auto &objPath : objPaths) {
+        auto blkPtr = monitor->createDeviceById(objPath).objectCast<DBlockDevice>();
+        if (blkPtr)
+            devs << blkPtr->device();
+    }
+    return devs;
+}
+
+bool UDisksBackend::probe(const QString &device, BlockDeviceInfo *info)
+{
+    Q_ASSERT(info);
+    auto blkDev = block_device_utils::bcCreateBlkDev(device);
+    if (!blkDev)
+        return false;
+
+    info->device = blkDev->device();
+    info->idType = blkDev->getProperty(dfmmount::Property::kBlockIDType).toString();
+    info->idVersion = blkDev->getProperty(dfmmount::Property::kBlockIDVersion).toString();
+    info->idUUID = blkDev->getProperty(dfmmount::Property::kBlockIDUUID).toString();
+    info->size = blkDev->getProperty(dfmmount::Property::kBlockSize).toULongLong();
+    info->encrypted = blkDev->isEncrypted();
+    return true;
+}
+
+QStringList BlkidBackend::devices()
+{
+    QStringList devs;
+    const QStringList &names = QDir(kSysBlockPath).entryList(QDir::AllEntries | QDir::NoDotAndDotDot);
+    for (const auto &name : names) {
+        // entries like 'cciss!c0d0' are named 'cciss/c0d0' under /dev.
+        QString dev = "/dev/" + QString(name).replace('!', '/');
+        if (QFile::exists(dev))
+            devs << dev;
+    }
+    return devs;
+}
+
+bool BlkidBackend::probe(const QString &device, BlockDeviceInfo *info)
+{
+    Q_ASSERT(info);
+    blkid_probe pr = blkid_new_probe_from_filename(device.toStdString().c_str());
+    if (!pr) {
+        qWarning() << "cannot create blkid probe for" << device;
+        return false;
+    }
+
+    blkid_probe_enable_superblocks(pr, 1);
+    blkid_probe_set_superblocks_flags(pr, BLKID_SUBLKS_TYPE | BLKID_SUBLKS_VERSION
+                                              | BLKID_SUBLKS_UUID | BLKID_SUBLKS_USAGE);
+    // 1 means nothing is found, which is a valid result of a blank device.
+    int ret = blkid_do_safeprobe(pr);
+    if (ret < 0) {
+        qWarning() << "blkid probe failed on" << device << ret;
+        blkid_free_probe(pr);
+        return false;
+    }
+
+    auto value = [pr](const char *tag) {
+        const char *val = nullptr;
+        if (blkid_probe_lookup_value(pr, tag, &val, nullptr) == 0 && val)
+            return QString(val);
+        return QString();
+    };
+
+    info->device = device;
+    info->idType = value("TYPE");
+    info->idVersion = value("VERSION");
+    info->idUUID = value("UUID");
+    info->size = static_cast<quint64>(qMax<blkid_loff_t>(0, blkid_probe_get_size(pr)));
+    info->encrypted = value("USAGE") == "crypto";
+    blkid_free_probe(pr);
+    return true;
+}
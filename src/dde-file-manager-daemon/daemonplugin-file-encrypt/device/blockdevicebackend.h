@@ -0,0 +1,56 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef BLOCKDEVICEBACKEND_H
+#define BLOCKDEVICEBACKEND_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+FILE_ENCRYPT_BEGIN_NS
+
+struct BlockDeviceInfo
+{
+    QString device;   // /dev/sdb1
+    QString idType;   // crypto_LUKS, ext4...
+    QString idVersion;
+    QString idUUID;
+    quint64 size { 0 };
+    bool encrypted { false };
+};
+
+// where the daemon learns about block devices from. the encrypt pipeline
+// only needs the probe results, so it can run without UDisks.
+class BlockDeviceBackend
+{
+public:
+    virtual ~BlockDeviceBackend() = default;
+    virtual QString name() const = 0;
+    virtual QStringList devices() = 0;
+    virtual bool probe(const QString &device, BlockDeviceInfo *info) = 0;
+
+    // picked by env DFM_DISK_ENCRYPT_DEVICE_BACKEND (udisks|blkid),
+    // blkid by default.
+    static BlockDeviceBackend *instance();
+};
+
+// asks UDisks over DBus by dfm-mount.
+class UDisksBackend : public BlockDeviceBackend
+{
+public:
+    QString name() const override { return "udisks"; }
+    QStringList devices() override;
+    bool probe(const QString &device, BlockDeviceInfo *info) override;
+};
+
+// lists /sys/class/block and probes the superblocks by libblkid.
+class BlkidBackend : public BlockDeviceBackend
+{
+public:
+    QString name() const override { return "blkid"; }
+    QStringList devices() override;
+    bool probe(const QString &device, BlockDeviceInfo *info) override;
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // BLOCKDEVICEBACKEND_H
@@ -0,0 +1,134 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "cryptaffinity.h"
+
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include <DConfig>
+
+#include <algorithm>
+
+#include <sched.h>
+#include <errno.h>
+#include <string.h>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr char kCpuSetKey[] { "cryptCpuSet" };
+static constexpr char kWorkqueuePath[] { "/sys/bus/workqueue/devices" };
+static constexpr qint64 kApplyInterval { 2000 };   // ms
+
+static QMutex gMtx;
+static QString gCpuSet;
+static QList<int> gCpus;
+
+// "0-3,6" -> 0, 1, 2, 3, 6
+static QList<int> parseCpuList(const QString &cpuSet)
+{
+    QList<int> cpus;
+    const QStringList &ranges = cpuSet.split(',', QString::SkipEmptyParts);
+    for (const auto &range : ranges) {
+        const QStringList &ends = range.trimmed().split('-');
+        bool ok1 = false, ok2 = true;
+        int first = ends.value(0).toInt(&ok1);
+        int last = ends.count() > 1 ? ends.value(1).toInt(&ok2) : first;
+        if (!ok1 || !ok2 || ends.count() > 2 || first < 0 || last < first || last >= CPU_SETSIZE) {
+            qWarning() << "invalid cpu set" << cpuSet;
+            return {};
+        }
+        for (int i = first; i <= last; ++i)
+            cpus.append(i);
+    }
+    return cpus;
+}
+
+// the cpumask format of sysfs: 32 bit hex groups, high first.
+static QByteArray toCpuMask(const QList<int> &cpus)
+{
+    int top = *std::max_element(cpus.cbegin(), cpus.cend());
+    QVector<quint32> groups(top / 32 + 1, 0);
+    for (int cpu : cpus)
+        groups[cpu / 32] |= 1u << (cpu % 32);
+
+    QByteArrayList parts;
+    for (int i = groups.count() - 1; i >= 0; --i)
+        parts << QByteArray::number(groups.at(i), 16).rightJustified(i == groups.count() - 1 ? 1 : 8, '0');
+    return parts.join(',');
+}
+
+static void setCpuSet(const QString &cpuSet)
+{
+    QList<int> cpus = parseCpuList(cpuSet);
+    QMutexLocker locker(&gMtx);
+    gCpuSet = cpus.isEmpty() ? QString() : cpuSet;
+    gCpus = cpus;
+    qInfo() << "dm-crypt cpu set:" << (gCpuSet.isEmpty() ? "unrestricted" : gCpuSet);
+}
+
+void crypt_affinity::init(QObject *owner)
+{
+    auto cfg = Dtk::Core::DConfig::create("org.deepin.dde.file-manager",
+                                          "org.deepin.dde.file-manager.diskencrypt",
+                                          "", owner);
+    QObject::connect(cfg, &Dtk::Core::DConfig::valueChanged, owner, [cfg](const QString &key) {
+        if (key != kCpuSetKey)
+            return;
+        setCpuSet(cfg->value(kCpuSetKey).toString());
+        applyToWorkqueues();
+    });
+    setCpuSet(cfg->value(kCpuSetKey).toString());
+    // mappings unlocked before the daemon starts are moved as well.
+    applyToWorkqueues();
+}
+
+QString crypt_affinity::cpuSet()
+{
+    QMutexLocker locker(&gMtx);
+    return gCpuSet;
+}
+
+bool crypt_affinity::enabled()
+{
+    QMutexLocker locker(&gMtx);
+    return !gCpus.isEmpty();
+}
+
+void crypt_affinity::pinCurrentThread()
+{
+    QMutexLocker locker(&gMtx);
+    if (gCpus.isEmpty())
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : qAsConst(gCpus))
+        CPU_SET(cpu, &set);
+    // pid 0 is the calling thread.
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        qWarning() << "cannot pin worker thread to" << gCpuSet << strerror(errno);
+}
+
+void crypt_affinity::applyToWorkqueues(bool force)
+{
+    static QElapsedTimer lastApplied;
+    QMutexLocker locker(&gMtx);
+    if (gCpus.isEmpty())
+        return;
+    if (!force && lastApplied.isValid() && lastApplied.elapsed() < kApplyInterval)
+        return;
+    lastApplied.start();
+
+    // kcryptd is unbound and exposed to sysfs only on newer kernels.
+    const QByteArray &mask = toCpuMask(gCpus);
+    const QStringList &wqs = QDir(kWorkqueuePath).entryList({ "kcryptd*" }, QDir::AllEntries | QDir::NoDotAndDotDot);
+    for (const auto &wq : wqs) {
+        QFile f(QString("%1/%2/cpumask").arg(kWorkqueuePath).arg(wq));
+        if (!f.open(QIODevice::WriteOnly) || f.write(mask) < 0)
+            qWarning() << "cannot set cpumask of" << wq << f.errorString();
+    }
+}
@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef CRYPTAFFINITY_H
+#define CRYPTAFFINITY_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+class QObject;
+
+FILE_ENCRYPT_BEGIN_NS
+
+// keeps dm-crypt work on the cpus named by dconfig key cryptCpuSet
+// ("2-3,6"), off the cores reserved for latency sensitive workloads.
+// nothing is restricted while the key is empty.
+namespace crypt_affinity {
+// loads the config and follows its changes, call it in main thread.
+void init(QObject *owner);
+QString cpuSet();
+bool enabled();
+
+// the reencrypt worker runs on the set as well.
+void pinCurrentThread();
+// kcryptd workqueues of the mapped devices, the temporary ones set up by
+// reencryption included. throttled unless forced.
+void applyToWorkqueues(bool force = true);
+}   // namespace crypt_affinity
+
+FILE_ENCRYPT_END_NS
+
+#endif   // CRYPTAFFINITY_H
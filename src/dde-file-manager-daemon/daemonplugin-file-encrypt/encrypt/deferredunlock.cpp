@@ -0,0 +1,196 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "deferredunlock.h"
+#include "fault/faultinjection.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutex>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <fstab.h>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr char kStateFile[] { "deferred-unlock.json" };
+// tmpfs, the claims are gone with the boot they were made in.
+static constexpr char kClaimDir[] { "/run/dde-file-manager" };
+static constexpr char kClaimFile[] { "deferred-unlock-claims.json" };
+static QMutex gStateMtx;
+
+static QString statePath()
+{
+    return QString("%1/%2").arg(fault_injection::stateDir()).arg(kStateFile);
+}
+
+static QString claimPath()
+{
+    return QString("%1/%2").arg(kClaimDir).arg(kClaimFile);
+}
+
+static QJsonObject readJson(const QString &path)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+        return {};
+    return QJsonDocument::fromJson(f.readAll()).object();
+}
+
+static void writeJson(const QString &path, const QJsonObject &obj)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "cannot write deferred unlock state" << path;
+        return;
+    }
+    f.write(QJsonDocument(obj).toJson());
+    f.close();
+}
+
+static QJsonObject readState()
+{
+    return readJson(statePath());
+}
+
+static void writeState(const QJsonObject &state)
+{
+    writeJson(statePath(), state);
+}
+
+// fstab specs whose entries are still marked as deferred.
+static QStringList deferredSpecs()
+{
+    QStringList specs;
+    struct fstab *fs;
+    setfsent();
+    while ((fs = getfsent()) != nullptr) {
+        QStringList options = QString(fs->fs_mntops).split(',');
+        if (options.contains(deferred_unlock::kFstabMarker))
+            specs.append(fs->fs_spec);
+    }
+    endfsent();
+    return specs;
+}
+
+bool deferred_unlock::isCriticalMountPoint(const QString &mountPoint)
+{
+    // needed before user can login.
+    static const QStringList kCritical { "/", "/boot", "/usr", "/var", "/home", "/opt", "/data" };
+    return mountPoint.isEmpty() || kCritical.contains(mountPoint) || mountPoint.startsWith("/boot/");
+}
+
+QStringList deferred_unlock::fstabOptions()
+{
+    return { "noauto", "nofail", kFstabTimeout, kFstabMarker };
+}
+
+bool deferred_unlock::add(const QString &device, const QString &fstabSpec)
+{
+    // the state outlives the boot, a kernel name may be another disk then.
+    const QString &deviceSpec = block_device_utils::bcStableSpec(device);
+    if (deviceSpec.isEmpty()) {
+        qWarning() << "no stable name of device, it's unlocked at boot" << device;
+        return false;
+    }
+
+    QMutexLocker locker(&gStateMtx);
+    QJsonObject state = readState();
+    state.insert(deviceSpec, fstabSpec);
+    writeState(state);
+    qInfo() << "device is unlocked after login:" << device << deviceSpec << fstabSpec;
+    return true;
+}
+
+QString deferred_unlock::remove(const QString &deviceSpec)
+{
+    if (deviceSpec.isEmpty())
+        return QString();
+
+    QMutexLocker locker(&gStateMtx);
+    QJsonObject state = readState();
+    if (!state.contains(deviceSpec))
+        return QString();
+    const QString &fstabSpec = state.take(deviceSpec).toString();
+    writeState(state);
+    qInfo() << "device is not unlocked after login anymore:" << deviceSpec << fstabSpec;
+    return fstabSpec;
+}
+
+QStringList deferred_unlock::devices()
+{
+    QMutexLocker locker(&gStateMtx);
+    QJsonObject state = readState();
+    const QStringList &specs = deferredSpecs();
+
+    // the entry has been edited or removed from fstab, don't unlock it anymore.
+    bool changed = false;
+    QStringList devs;
+    for (const auto &deviceSpec : state.keys()) {
+        if (!specs.contains(state.value(deviceSpec).toString())) {
+            state.remove(deviceSpec);
+            changed = true;
+            continue;
+        }
+        // a removable disk may be absent in this boot.
+        const QString &device = block_device_utils::bcResolveSpec(deviceSpec);
+        if (!device.isEmpty())
+            devs.append(device);
+    }
+    if (changed)
+        writeState(state);
+    return devs;
+}
+
+bool deferred_unlock::claim(const QString &device)
+{
+    QMutexLocker locker(&gStateMtx);
+    QJsonObject claims = readJson(claimPath());
+    if (claims.contains(device))
+        return false;
+    claims.insert(device, QDateTime::currentMSecsSinceEpoch());
+    writeJson(claimPath(), claims);
+    return true;
+}
+
+qint64 deferred_unlock::claimedAt(const QString &device)
+{
+    QMutexLocker locker(&gStateMtx);
+    return readJson(claimPath()).value(device).toVariant().toLongLong();
+}
+
+bool deferred_unlock::mountItem(const QString &device, MountItem *item)
+{
+    Q_ASSERT(item);
+    const QString &devPath = QFileInfo(device).canonicalFilePath();
+    QString spec;
+    {
+        QMutexLocker locker(&gStateMtx);
+        const QJsonObject &state = readState();
+        for (auto iter = state.constBegin(); iter != state.constEnd(); ++iter) {
+            if (block_device_utils::bcResolveSpec(iter.key()) == devPath) {
+                spec = iter.value().toString();
+                break;
+            }
+        }
+    }
+    if (spec.isEmpty())
+        return false;
+
+    bool found = false;
+    struct fstab *fs;
+    setfsent();
+    while ((fs = getfsent()) != nullptr) {
+        if (spec != fs->fs_spec)
+            continue;
+        *item = { fs->fs_file, fs->fs_vfstype, fs->fs_mntops };
+        found = true;
+        break;
+    }
+    endfsent();
+    return found;
+}
@@ -0,0 +1,40 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DEFERREDUNLOCK_H
+#define DEFERREDUNLOCK_H
+
+#include "daemonplugin_file_encrypt_global.h"
+#include "diskencrypt.h"
+
+#include <QStringList>
+
+FILE_ENCRYPT_BEGIN_NS
+
+// data partitions that are unlocked and mounted after login instead of at
+// boot, so the TPM and KDF latency is not on the boot critical path.
+namespace deferred_unlock {
+inline constexpr char kFstabMarker[] { "x-dde-deferred-unlock" };
+// boot does not wait for the device more than this.
+inline constexpr char kFstabTimeout[] { "x-systemd.device-timeout=10s" };
+
+bool isCriticalMountPoint(const QString &mountPoint);
+QStringList fstabOptions();
+// the device is recorded by its PARTUUID or LUKS uuid, returns false if it
+// has neither, it's not deferred then.
+bool add(const QString &device, const QString &fstabSpec);
+// drops the device recorded by deviceSpec, returns its fstab spec.
+QString remove(const QString &deviceSpec);
+// the recorded devices that are present, by their current kernel names.
+QStringList devices();
+// each device is handed out once per boot, returns false if it's claimed.
+bool claim(const QString &device);
+// msecs since epoch when the device was claimed in this boot, 0 if not.
+qint64 claimedAt(const QString &device);
+// where the device is mounted after unlocked, by its fstab entry.
+bool mountItem(const QString &device, MountItem *item);
+}   // namespace deferred_unlock
+
+FILE_ENCRYPT_END_NS
+
+#endif   // DEFERREDUNLOCK_H
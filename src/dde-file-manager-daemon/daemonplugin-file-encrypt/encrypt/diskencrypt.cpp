@@ -4,24 +4,41 @@
 #include "diskencrypt.h"
 #include "fsresize/fsresize.h"
 #include "notification/notifications.h"
+#include "scheduler/disktopology.h"
+#include "preflight.h"
+#include "history/jobhistory.h"
+#include "recoverykey.h"
+#include "device/blockdevicebackend.h"
+#include "fault/faultinjection.h"
+#include "cryptaffinity.h"
+#include "pacing.h"
 
 #include <QDebug>
 #include <QFile>
 #include <QTextStream>
 #include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
 #include <QFile>
-#include <QLibrary>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QJsonArray>
+#include <QProcess>
+#include <QElapsedTimer>
+#include <QtConcurrent>
 
 #include <dfm-base/utils/finallyutil.h>
 #include <dfm-mount/dmount.h>
 
 #include <libcryptsetup.h>
 #include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/ioctl.h>
+#include <mntent.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <functional>
+#include <algorithm>
 
 FILE_ENCRYPT_USE_NS
 using namespace disk_encrypt;
@@ -37,36 +54,94 @@ using namespace disk_encrypt;
         return retVal;                    \
     }
 
-// used to record current reencrypting device.
-QString gCurrReencryptingDevice;
-QString gCurrDecryptintDevice;
+// used to record current reencrypting device, jobs on independent disks
+// run concurrently, so each worker thread keeps its own.
+thread_local QString gCurrReencryptingDevice;
+thread_local QString gCurrDecryptintDevice;
 bool gInterruptEncFlag { false };
 
-struct crypt_params_reencrypt *encryptParams()
+// LUKS2 keyslot binary area: key material split into 4000 anti-forensic
+// stripes, aligned to 4K.
+static constexpr uint64_t kAFStripes { 4000 };
+static constexpr uint64_t kLayoutAlign { 4096 };
+static constexpr uint64_t kDataOffsetAlign { 1024 * 1024 };
+// json area, tokens (tpm sealed blobs, recovery key) are stored here.
+static constexpr uint64_t kMetadataSize { 64 * 1024 };
+// passphrase, recovery key, and two spare keyslots for passphrase changing
+// (new slot is added before old one is destroyed) and tpm.
+static constexpr int kReservedKeyslots { 4 };
+// used by reencrypt keyslot to store hotzone checksums when resuming.
+static constexpr uint64_t kReencryptAreaSize { 256 * 1024 };
+// with datashift resilience every hotzone is limited to the shift, for the
+// whole job, and each one commits both header copies. a shift shorter
+// than this multiplies the commits, so the header never ends before it.
+static constexpr uint64_t kMinDataOffset { 16 * 1024 * 1024 };
+
+struct HeaderLayout
 {
-    static struct crypt_params_luks2 reencLuks2
-    {
-        .sector_size = 512
-    };
+    uint64_t metadataSize;
+    uint64_t keyslotsSize;
+    uint64_t dataOffset;   // in 512 bytes sectors
+};
+
+static uint64_t alignUp(uint64_t size, uint64_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+HeaderLayout headerLayout(int keyLenBits)
+{
+    uint64_t slotSize = alignUp(keyLenBits / 8 * kAFStripes, kLayoutAlign);
+    uint64_t keyslotsSize = alignUp(slotSize * kReservedKeyslots + kReencryptAreaSize, kLayoutAlign);
+    uint64_t headerSize = qMax(alignUp(kMetadataSize * 2 + keyslotsSize, kDataOffsetAlign), kMinDataOffset);
+    // the keyslots area takes up the padding, it's headroom for more
+    // keyslots, so the header ends exactly where the data starts. a backup
+    // of the header is as long as the data offset, recoverySuperblock_ext
+    // relies on it.
+    keyslotsSize = headerSize - kMetadataSize * 2;
+    return { kMetadataSize, keyslotsSize, headerSize / 512 };
+}
+
+// the params are returned by value, jobs of different devices run at the
+// same time and each one holds its own copy.
+static const struct crypt_params_luks2 kReencLuks2
+{
+    .sector_size = 512
+};
 
-    static struct crypt_params_reencrypt reencParams
-    {
+struct crypt_params_reencrypt encryptParams(uint64_t dataShift)
+{
+    // the first segment is moved behind the header, shift by exactly the header size.
+    return {
         .mode = CRYPT_REENCRYPT_ENCRYPT,
         .direction = CRYPT_REENCRYPT_BACKWARD,
         .resilience = "datashift",
         .hash = "sha256",
-        .data_shift = 32 * 1024,
+        .data_shift = dataShift,
         .max_hotzone_size = 0,
         .device_size = 0,
-        .luks2 = &reencLuks2,
+        .luks2 = &kReencLuks2,
         .flags = CRYPT_REENCRYPT_INITIALIZE_ONLY | CRYPT_REENCRYPT_MOVE_FIRST_SEGMENT
     };
-    return &reencParams;
 }
-struct crypt_params_reencrypt *decryptParams()
+// data is encrypted in place, the header takes no room on the device.
+struct crypt_params_reencrypt detachedEncryptParams()
 {
-    static struct crypt_params_reencrypt params
-    {
+    return {
+        .mode = CRYPT_REENCRYPT_ENCRYPT,
+        .direction = CRYPT_REENCRYPT_FORWARD,
+        .resilience = "checksum",
+        .hash = "sha256",
+        .data_shift = 0,
+        .max_hotzone_size = 0,
+        .device_size = 0,
+        .luks2 = &kReencLuks2,
+        .flags = CRYPT_REENCRYPT_INITIALIZE_ONLY
+    };
+}
+struct crypt_params_reencrypt decryptParams()
+{
+    return {
         .mode = CRYPT_REENCRYPT_DECRYPT,
         .direction = CRYPT_REENCRYPT_BACKWARD,
         .resilience = "checksum",
@@ -75,23 +150,191 @@ struct crypt_params_reencrypt *decryptParams()
         .max_hotzone_size = 0,
         .device_size = 0
     };
-    return &params;
 }
-struct crypt_params_reencrypt *resumeParams()
+struct crypt_params_reencrypt onlineDecryptParams(uint64_t dataShift)
 {
-    static struct crypt_params_reencrypt params
-    {
-        .mode = CRYPT_REENCRYPT_REENCRYPT,
+    // shift the plain data to the start of the device while decrypting, so the
+    // filesystem superblock ends up in place without taking it offline. the
+    // shift is the data offset, kMinDataOffset for the devices encrypted
+    // here, which bounds the hotzones as in encryption.
+    return {
+        .mode = CRYPT_REENCRYPT_DECRYPT,
         .direction = CRYPT_REENCRYPT_FORWARD,
-        .resilience = "checksum",
+        .resilience = "datashift-checksum",
         .hash = "sha256",
+        .data_shift = dataShift,
+        .max_hotzone_size = 0,
+        .device_size = 0,
+        .flags = CRYPT_REENCRYPT_MOVE_FIRST_SEGMENT
+    };
+}
+// resume the operation recorded in the header as it was started.
+struct crypt_params_reencrypt resumeParams(const struct crypt_params_reencrypt &recorded)
+{
+    return {
+        .mode = recorded.mode,
+        .direction = recorded.direction,
+        .resilience = recorded.resilience,
+        .hash = recorded.hash,
+        .data_shift = recorded.data_shift,
         .max_hotzone_size = 0,
         .device_size = 0,
         .flags = CRYPT_REENCRYPT_RESUME_ONLY
     };
-    return &params;
 }
-void parseCipher(const QString &fullCipher, QString *cipher, QString *mode, int *len)
+// the keyslot named in the usec token of type, -1 if there is no such token.
+int tokenKeyslot(struct crypt_device *cdev, const QString &type)
+{
+    for (int i = 0; i < 32 /* LUKS2_TOKENS_MAX */; ++i) {
+        const char *json { nullptr };
+        if (crypt_token_json_get(cdev, i, &json) < 0)
+            continue;
+        UsecToken token = UsecToken::fromJson(json);
+        if (token.type == type && !token.keyslots.isEmpty() && token.keyslots.first() >= 0)
+            return token.keyslots.first();
+    }
+    return -1;
+}
+
+QList<int> tokenKeyslots(struct crypt_device *cdev)
+{
+    QList<int> keyslots;
+    for (int i = 0; i < 32 /* LUKS2_TOKENS_MAX */; ++i) {
+        const char *json { nullptr };
+        if (crypt_token_json_get(cdev, i, &json) < 0)
+            continue;
+        keyslots.append(UsecToken::fromJson(json).keyslots);
+    }
+    return keyslots;
+}
+
+QList<int> activeKeyslots(struct crypt_device *cdev)
+{
+    QList<int> keyslots;
+    int max = crypt_keyslot_max(CRYPT_LUKS2);
+    for (int i = 0; i < max; ++i) {
+        auto status = crypt_keyslot_status(cdev, i);
+        if (status == CRYPT_SLOT_ACTIVE || status == CRYPT_SLOT_ACTIVE_LAST)
+            keyslots.append(i);
+    }
+    return keyslots;
+}
+
+// the keyslot of user's passphrase: named by the tpm token, or the only
+// active slot besides the recovery key's one. -1 if it cannot be told.
+int primaryKeyslot(struct crypt_device *cdev)
+{
+    int slot = tokenKeyslot(cdev, kTokenTypeTPM);
+    if (slot >= 0)
+        return slot;
+
+    int recSlot = tokenKeyslot(cdev, kTokenTypeRecKey);
+    if (recSlot < 0)
+        return -1;
+    QList<int> keyslots = activeKeyslots(cdev);
+    keyslots.removeAll(recSlot);
+    return keyslots.count() == 1 ? keyslots.first() : -1;
+}
+
+// try the passphrase on the keyslots named by tokens only, so that the kdf
+// is not run on every stale slot in turn. any slot is tried if the keyslots
+// cannot be told.
+int unlockTargeted(struct crypt_device *cdev, const std::function<int(int)> &unlock)
+{
+    int primary = primaryKeyslot(cdev);
+    int recovery = tokenKeyslot(cdev, kTokenTypeRecKey);
+    int ret = -EPERM;
+    for (int slot : { primary, recovery }) {
+        if (slot < 0)
+            continue;
+        ret = unlock(slot);
+        if (ret != -EPERM && ret != -ENOENT)
+            return ret;
+    }
+    if (primary < 0 || recovery < 0)
+        ret = unlock(CRYPT_ANY_SLOT);
+    return ret;
+}
+
+// the volume key is used directly when the job already holds it, so the
+// passphrase is not derived again for every step. it needs the keyslot
+// context api of libcryptsetup 2.6, see CMakeLists.txt.
+int initReencrypt(struct crypt_device *cdev, const char *name,
+                  const QString &passphrase, const VolumeKeyPtr &volumeKey,
+                  int keyslotOld, int keyslotNew,
+                  const char *cipher, const char *mode,
+                  const struct crypt_params_reencrypt *params)
+{
+#ifdef DFM_CRYPTSETUP_KEYSLOT_CONTEXT
+    if (volumeKey && volumeKey->isValid()) {
+        struct crypt_keyslot_context *kc { nullptr };
+        int ret = crypt_keyslot_context_init_by_volume_key(cdev, volumeKey->data(), volumeKey->size(), &kc);
+        if (ret == 0) {
+            ret = crypt_reencrypt_init_by_keyslot_context(cdev, name, kc, kc,
+                                                          keyslotOld, keyslotNew,
+                                                          cipher, mode, params);
+            crypt_keyslot_context_free(kc);
+            if (ret >= 0)
+                return ret;
+        }
+        qInfo() << "cannot init reencrypt by volume key, fallback to passphrase" << ret;
+    }
+#else
+    Q_UNUSED(volumeKey)
+#endif
+
+    std::string pass = passphrase.toStdString();
+    auto init = [&](int slotOld, int slotNew) {
+        return crypt_reencrypt_init_by_passphrase(cdev, name,
+                                                  pass.c_str(), pass.length(),
+                                                  slotOld, slotNew,
+                                                  cipher, mode, params);
+    };
+    if (keyslotOld != CRYPT_ANY_SLOT || keyslotNew != CRYPT_ANY_SLOT)
+        return init(keyslotOld, keyslotNew);
+
+    // decryption unlocks the old segment, encryption the new one.
+    bool decrypt = params && params->mode == CRYPT_REENCRYPT_DECRYPT;
+    return unlockTargeted(cdev, [&](int slot) {
+        return decrypt ? init(slot, CRYPT_ANY_SLOT) : init(CRYPT_ANY_SLOT, slot);
+    });
+}
+
+int activateDevice(struct crypt_device *cdev, const QString &name,
+                   const QString &passphrase, const VolumeKeyPtr &volumeKey,
+                   uint32_t flags)
+{
+    int ret = 0;
+    if (volumeKey && volumeKey->isValid()) {
+        ret = crypt_activate_by_volume_key(cdev, name.toStdString().c_str(),
+                                           volumeKey->data(), volumeKey->size(), flags);
+    } else {
+        std::string cName = name.toStdString();
+        std::string pass = passphrase.toStdString();
+        ret = unlockTargeted(cdev, [&](int slot) {
+            return crypt_activate_by_passphrase(cdev, cName.c_str(), slot,
+                                                pass.c_str(), pass.length(), flags);
+        });
+    }
+    if (ret >= 0)
+        crypt_affinity::applyToWorkqueues();
+    return ret;
+}
+
+// the header of a device encrypted in detached mode is kept in /boot, so is
+// the copy of a device whose online decryption was interrupted, the one on
+// device has been overwritten by the shifted data.
+int initCrypt(struct crypt_device **cdev, const QString &device)
+{
+    QString header = block_device_utils::bcDetachedHeader(device);
+    if (header.isEmpty())
+        header = block_device_utils::bcInterruptedDecryptHeader(device);
+    if (header.isEmpty())
+        return crypt_init(cdev, device.toStdString().c_str());
+    return crypt_init_data_device(cdev, header.toStdString().c_str(), device.toStdString().c_str());
+}
+
+void disk_encrypt_utils::bcParseCipher(const QString &fullCipher, QString *cipher, QString *mode, int *len)
 {
     Q_ASSERT(cipher && mode && len);
     *cipher = fullCipher;
@@ -99,6 +342,14 @@ void parseCipher(const QString &fullCipher, QString *cipher, QString *mode, int
     *len = 256;
 }
 
+quint64 disk_encrypt_utils::bcHeaderSize(const QString &fullCipher)
+{
+    QString cipher, mode;
+    int keyLen;
+    bcParseCipher(fullCipher, &cipher, &mode, &keyLen);
+    return headerLayout(keyLen).dataOffset * 512;
+}
+
 EncryptParams disk_encrypt_utils::bcConvertParams(const QVariantMap &params)
 {
     auto toString = [&params](const QString &key) { return params.value(key).toString(); };
@@ -107,10 +358,37 @@ EncryptParams disk_encrypt_utils::bcConvertParams(const QVariantMap &params)
         .passphrase = toString(encrypt_param_keys::kKeyPassphrase),   // decode()
         .cipher = toString(encrypt_param_keys::kKeyCipher),
         .recoveryPath = toString(encrypt_param_keys::kKeyRecoveryExportPath),
-        .tpmToken = toString(encrypt_param_keys::kKeyTPMToken),
+        .tpmToken = UsecToken::fromVariant(params.value(encrypt_param_keys::kKeyTPMToken)),
+        .detachedHeader = params.value(encrypt_param_keys::kKeyDetachedHeader).toBool(),
     };
 }
 
+uint32_t disk_encrypt_utils::bcActivateFlags(const QString &device, const QVariantMap &options)
+{
+    uint32_t flags = 0;
+    if (options.value(encrypt_param_keys::kKeyReadOnly).toBool())
+        flags |= CRYPT_ACTIVATE_READONLY;
+    if (options.value(encrypt_param_keys::kKeyAllowDiscards).toBool())
+        flags |= CRYPT_ACTIVATE_ALLOW_DISCARDS;
+
+#if defined(CRYPT_ACTIVATE_NO_READ_WORKQUEUE) && defined(CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE)
+    // without kcryptd the crypto runs on the cpu submitting the io, which
+    // may be a restricted one. same_cpu_crypt is left off for the same reason.
+    if (crypt_affinity::enabled())
+        return flags;
+
+    // dm-crypt queues bios to kcryptd to reorder them for spinning disks,
+    // flash devices are faster without the extra hops.
+    const auto &disks = disk_topology::physicalDisksOf(device);
+    bool allFlash = !disks.isEmpty()
+            && std::none_of(disks.cbegin(), disks.cend(),
+                            [](const PhysicalDisk &disk) { return disk.rotational; });
+    if (allFlash)
+        flags |= CRYPT_ACTIVATE_NO_READ_WORKQUEUE | CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE;
+#endif
+    return flags;
+}
+
 bool disk_encrypt_utils::bcValidateParams(const EncryptParams &params)
 {
     if (!params.isValid()) {
@@ -146,74 +424,45 @@ bool disk_encrypt_utils::bcValidateParams(const EncryptParams &params)
     return true;
 }
 
-QString disk_encrypt_utils::bcExpRecFile(const EncryptParams &params)
+int disk_encrypt_utils::bcExpRecFile(const EncryptParams &params, QString *recKey)
 {
+    Q_ASSERT(recKey);
     if (params.recoveryPath.isEmpty())
-        return "";
-
-    while (1) {
-        if (!QDir(params.recoveryPath).exists()) {
-            qWarning() << "the recovery key path does not exists!"
-                       << params.recoveryPath;
-            break;
-        }
-        QString recKey = bcGenRecKey();
-        if (recKey.isEmpty()) {
-            qWarning() << "no recovery key generated, give up export.";
-            break;
-        }
-
-        QString recFileName = QString("%1/%2_recovery_key.txt")
-                                      .arg(params.recoveryPath)
-                                      .arg(params.device.mid(5));
-        QFile recFile(recFileName);
-        if (!recFile.open(QIODevice::ReadWrite)) {
-            qWarning() << "cannot create recovery file!";
-            break;
-        }
-
-        recFile.write(recKey.toLocal8Bit());
-        recFile.flush();
-        recFile.close();
-
-        return QString(recKey);
+        return kSuccess;
+
+    // user asked for a recovery key, the encryption does not go on without it.
+    CHECK_BOOL(QDir(params.recoveryPath).exists(),
+               "the recovery key path does not exists " + params.recoveryPath, -kErrorParamsInvalid);
+    QString key = bcGenRecKey();
+    CHECK_BOOL(!key.isEmpty(), "no recovery key generated " + params.device, -kErrorAddKeyslot);
+
+    QString recFileName = QString("%1/%2_recovery_key.txt")
+                                  .arg(params.recoveryPath)
+                                  .arg(params.device.mid(5));
+    QFile recFile(recFileName);
+    CHECK_BOOL(recFile.open(QIODevice::WriteOnly | QIODevice::Truncate),
+               "cannot create recovery file " + recFileName, -kErrorOpenFileFailed);
+    bool written = (recFile.write(key.toLocal8Bit()) == key.length()) && recFile.flush();
+    written = (fsync(recFile.handle()) == 0) && written;
+    recFile.close();
+    if (!written) {
+        qWarning() << "cannot write recovery file" << recFileName;
+        recFile.remove();
+        return -kErrorOpenFileFailed;
     }
 
-    return "";
+    *recKey = key;
+    return kSuccess;
 }
 
 QString disk_encrypt_utils::bcGenRecKey()
 {
-    QString recKey;
-    QLibrary lib("usec-recoverykey");
-    dfmbase::FinallyUtil finalClear([&] { if (lib.isLoaded()) lib.unload(); });
-
-    if (!lib.load()) {
-        qWarning() << "libusec-recoverykey load failed. use uuid as recovery key";
-        return recKey;
-    }
-
-    typedef int (*FnGenKey)(char *, const size_t, const size_t);
-    FnGenKey fn = (FnGenKey)(lib.resolve("usec_get_recovery_key"));
-    if (!fn) {
-        qWarning() << "libusec-recoverykey resolve failed. use uuid as recovery key";
-        return recKey;
-    }
-
-    static const size_t kRecoveryKeySize = 24;
-    char genKey[kRecoveryKeySize + 1];
-    int ret = fn(genKey, kRecoveryKeySize, 1);
-    if (ret != 0) {
-        qWarning() << "libusec-recoverykey generate failed. use uuid as recovery key";
-        return recKey;
-    }
-
-    recKey = genKey;
-    return recKey;
+    return RecoveryKeyGenerator::instance()->take();
 }
 
 int disk_encrypt_funcs::bcInitHeaderFile(const EncryptParams &params,
-                                         QString &headerPath, int *keyslotCipher, int *keyslotRecKey)
+                                         QString &headerPath, int *keyslotCipher, int *keyslotRecKey,
+                                         VolumeKeyPtr *volumeKey)
 {
     if (!disk_encrypt_utils::bcValidateParams(params))
         return -kErrorParamsInvalid;
@@ -231,44 +480,108 @@ int disk_encrypt_funcs::bcInitHeaderFile(const EncryptParams &params,
         return -kErrorDeviceMounted;
     }
 
-    int err = bcDoSetupHeader(params, &headerPath, keyslotCipher, keyslotRecKey);
+    int err = bcDoSetupHeader(params, &headerPath, keyslotCipher, keyslotRecKey, volumeKey);
     return err;
 }
 
-int disk_encrypt_funcs::bcDoSetupHeader(const EncryptParams &params, QString *headerPath, int *keyslotCipher, int *keyslotRecKey)
+int disk_encrypt_funcs::bcDoSetupHeader(const EncryptParams &params, QString *headerPath,
+                                        int *keyslotCipher, int *keyslotRecKey, VolumeKeyPtr *volumeKey)
 {
     Q_ASSERT(headerPath && keyslotCipher && keyslotRecKey);
 
+    QString cipher, mode;
+    int keyLen;
+    disk_encrypt_utils::bcParseCipher(params.cipher, &cipher, &mode, &keyLen);
+    qDebug() << "encrypt with cipher:" << cipher << mode << keyLen;
+
+    const HeaderLayout layout = headerLayout(keyLen);
+    qInfo() << "header layout of" << params.device
+            << "metadata:" << layout.metadataSize
+            << "keyslots:" << layout.keyslotsSize
+            << "data offset(sectors):" << layout.dataOffset;
+
+    // the filesystem check done while the dialog was open is not repeated
+    // before shrinking, unless the filesystem is touched since then. the
+    // benchmark only needs the kernel crypto user api, which dm-crypt does
+    // not, so its failure is no reason to stop: crypt_format checks the
+    // cipher against the kernel itself.
+    PreflightReport report;
+    bool fsChecked = false;
+    if (preflight::take(params.device, &report)) {
+        fsChecked = report.fsChecked;
+        if (report.cipher == params.cipher && report.cipherError != 0)
+            qWarning() << "cannot benchmark cipher" << params.cipher << report.cipherError;
+        CHECK_BOOL(params.detachedHeader || report.hasRoom(), "no room for the header " + params.device, -kErrorResizeFs);
+        qInfo() << "reuse preflight results of" << params.device << report.toVariantMap();
+    }
+
+    // the volume key is generated here and kept by the job for later steps.
+    VolumeKeyPtr vk = VolumeKey::generate(keyLen / 8);
+    CHECK_BOOL(vk, "cannot generate volume key " + params.device, -kErrorFormatLuks);
+
+    // a detached header is formatted in place and stays there, the data
+    // device is neither shrunk nor shifted.
+    const bool detached = params.detachedHeader;
+    const auto reencParams = detached ? detachedEncryptParams() : encryptParams(layout.dataOffset);
+
     QString localPath;
     int ret = 0;
-    ret = bcPrepareHeaderFile(params.device, &localPath);
+    if (detached)
+        ret = bcPrepareDetachedHeader(params.device, layout.dataOffset * 512, &localPath);
+    else
+        ret = bcPrepareHeaderFile(params.device, layout.dataOffset * 512, &localPath);
     if (localPath.isEmpty())
         return -kErrorCreateHeader;
 
-    fs_resize::shrinkFileSystem_ext(params.device);
+    job_history::setCrypt(cipher + "-" + mode, 512, reencParams.resilience);
+
+    // the header is formatted in a file and the keyslots and recovery key
+    // live only in it, so they are prepared while the filesystem is being
+    // shrunk. it's joined before the data device is touched.
+    QFuture<qint64> shrinking;
+    if (!detached) {
+        shrinking = QtConcurrent::run([device = params.device, fsChecked] {
+            QElapsedTimer clock;
+            clock.start();
+            if (!fs_resize::shrinkFileSystem_ext(device, fsChecked))
+                qWarning() << "shrink filesystem failed" << device;
+            return clock.elapsed();
+        });
+    }
+    bool shrinkJoined = detached;
+    auto joinShrink = [&] {
+        if (shrinkJoined)
+            return;
+        shrinkJoined = true;
+        job_history::addPhase("shrink", shrinking.result());
+    };
 
     struct crypt_device *cdev { nullptr };
 
     dfmbase::FinallyUtil finalClear([&] {
+        joinShrink();
         if (cdev) crypt_free(cdev);
         if (ret < 0) {
             ::remove(localPath.toStdString().c_str());
-            fs_resize::expandFileSystem_ext(params.device);
+            if (!detached)
+                fs_resize::expandFileSystem_ext(params.device);
         }
     });
 
+    job_history::enterPhase("format");
     ret = crypt_init(&cdev, localPath.toStdString().c_str());
     CHECK_INT(ret, "init crypt failed " + params.device, -kErrorInitCrypt);
 
     crypt_set_rng_type(cdev, CRYPT_RNG_RANDOM);
 
-    ret = crypt_set_data_offset(cdev, 32 * 1024);   // offset 32M
-    CHECK_INT(ret, "cannot set offset " + params.device, -kErrorSetOffset);
+    ret = crypt_set_metadata_size(cdev, layout.metadataSize, layout.keyslotsSize);
+    CHECK_INT(ret, "cannot set metadata size " + params.device, -kErrorSetOffset);
 
-    QString cipher, mode;
-    int keyLen;
-    parseCipher(params.cipher, &cipher, &mode, &keyLen);
-    qDebug() << "encrypt with cipher:" << cipher << mode << keyLen;
+    // the data of a detached header starts at the beginning of the device.
+    if (!detached) {
+        ret = crypt_set_data_offset(cdev, layout.dataOffset);
+        CHECK_INT(ret, "cannot set offset " + params.device, -kErrorSetOffset);
+    }
 
     std::string cDevice = params.device.toStdString();
     struct crypt_params_luks2 luks2Params = {
@@ -283,26 +596,28 @@ int disk_encrypt_funcs::bcDoSetupHeader(const EncryptParams &params, QString *he
                        cipher.toStdString().c_str(),
                        mode.toStdString().c_str(),
                        nullptr,
-                       nullptr,
-                       keyLen / 8,
+                       vk->data(),
+                       vk->size(),
                        &luks2Params);
     CHECK_INT(ret, "format failed " + params.device, -kErrorFormatLuks);
 
     ret = crypt_keyslot_add_by_volume_key(cdev,
                                           CRYPT_ANY_SLOT,
-                                          nullptr,
-                                          0,
+                                          vk->data(),
+                                          vk->size(),
                                           params.passphrase.toStdString().c_str(),
                                           params.passphrase.length());
     CHECK_INT(ret, "add key failed " + params.device, -kErrorAddKeyslot);
     *keyslotCipher = ret;
 
-    QString recKey = disk_encrypt_utils::bcExpRecFile(params);
+    QString recKey;
+    ret = disk_encrypt_utils::bcExpRecFile(params, &recKey);
+    CHECK_INT(ret, "export recovery key failed " + params.device, ret);
     if (!recKey.isEmpty()) {
         ret = crypt_keyslot_add_by_volume_key(cdev,
                                               CRYPT_ANY_SLOT,
-                                              nullptr,
-                                              0,
+                                              vk->data(),
+                                              vk->size(),
                                               recKey.toStdString().c_str(),
                                               recKey.length());
         if (ret < 0) {
@@ -313,32 +628,39 @@ int disk_encrypt_funcs::bcDoSetupHeader(const EncryptParams &params, QString *he
         *keyslotRecKey = ret;
     }
 
-    ret = crypt_reencrypt_init_by_passphrase(cdev,
-                                             nullptr,
-                                             params.passphrase.toStdString().c_str(),
-                                             params.passphrase.length(),
-                                             CRYPT_ANY_SLOT,
-                                             0,
-                                             cipher.toStdString().c_str(),
-                                             mode.toStdString().c_str(),
-                                             encryptParams());
+    joinShrink();
+    ret = initReencrypt(cdev,
+                        nullptr,
+                        params.passphrase,
+                        vk,
+                        CRYPT_ANY_SLOT,
+                        0,
+                        cipher.toStdString().c_str(),
+                        mode.toStdString().c_str(),
+                        &reencParams);
     CHECK_INT(ret, "init reencryption failed " + params.device, -kErrorInitReencrypt);
 
+    if (detached) {
+        *headerPath = localPath;
+        if (volumeKey)
+            *volumeKey = vk;
+        return kSuccess;
+    }
+
     // active device for expanding fs.
     QString activeDev = QString("dm-%1").arg(params.device.mid(5));
-    ret = crypt_activate_by_passphrase(cdev,
-                                       activeDev.toStdString().c_str(),
-                                       CRYPT_ANY_SLOT,
-                                       params.passphrase.toStdString().c_str(),
-                                       params.passphrase.length(),
-                                       CRYPT_ACTIVATE_NO_JOURNAL);
+    ret = activateDevice(cdev, activeDev, params.passphrase, vk, CRYPT_ACTIVATE_NO_JOURNAL);
     CHECK_INT(ret, "acitve device failed " + params.device + activeDev, -kErrorActive);
 
+    job_history::enterPhase("expand");
+    FAULT_POINT("expand-fs");
     fs_resize::expandFileSystem_ext(QString("/dev/mapper/%1").arg(activeDev));
     ret = crypt_deactivate(nullptr, activeDev.toStdString().c_str());
     CHECK_INT(ret, "deacitvi device failed " + params.device, -kErrorDeactive);
 
     *headerPath = localPath;
+    if (volumeKey)
+        *volumeKey = vk;
     return kSuccess;
 }
 
@@ -365,25 +687,105 @@ int disk_encrypt_funcs::bcInitHeaderDevice(const QString &device,
     return kSuccess;
 }
 
-int disk_encrypt_funcs::bcPrepareHeaderFile(const QString &device, QString *headerPath)
+static int allocateHeaderFile(const QString &device, const QString &localPath, quint64 size)
 {
-    Q_ASSERT(headerPath);
-    QString localPath = QString("/tmp/%1_luks2_pre_enc").arg(device.mid(5));
     int fd = open(localPath.toStdString().c_str(),
                   O_CREAT | O_EXCL | O_WRONLY,
                   S_IRUSR | S_IWUSR);
-    CHECK_INT(fd, "create tmp file failed " + device + strerror(errno), -kErrorOpenFileFailed);
+    CHECK_INT(fd, "create header file failed " + device + strerror(errno), -kErrorOpenFileFailed);
 
-    int ret = posix_fallocate(fd, 0, 32 * 1024 * 1024);
+    int ret = posix_fallocate(fd, 0, static_cast<off_t>(size));
     close(fd);
     CHECK_BOOL(ret == 0, "allocate file failed " + localPath, -kErrorCreateHeader);
+    return kSuccess;
+}
+
+int disk_encrypt_funcs::bcPrepareHeaderFile(const QString &device, quint64 size, QString *headerPath)
+{
+    Q_ASSERT(headerPath);
+    QString localPath = QString("/tmp/%1_luks2_pre_enc").arg(device.mid(5));
+    // it's left by a setup that was killed, the header in it was either never
+    // applied or has been restored to the device already.
+    if (QFile::exists(localPath)) {
+        qWarning() << "remove stale header file" << localPath;
+        QFile::remove(localPath);
+    }
+    int ret = allocateHeaderFile(device, localPath, size);
+    if (ret != kSuccess)
+        return ret;
     *headerPath = localPath;
     return kSuccess;
 }
 
+int disk_encrypt_funcs::bcPrepareDetachedHeader(const QString &device, quint64 size, QString *headerPath)
+{
+    Q_ASSERT(headerPath);
+    // whoever can replace the header can unlock the device.
+    CHECK_BOOL(QDir().mkpath(kDetachedHeaderDir), "cannot create header dir " + device, -kErrorCreateHeader);
+    QFile::setPermissions(kDetachedHeaderDir, QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner);
+
+    QString localPath = block_device_utils::bcDetachedHeaderPath(device);
+    CHECK_BOOL(!localPath.isEmpty(), "no partuuid to key the detached header " + device, -kErrorCreateHeader);
+    int ret = allocateHeaderFile(device, localPath, size);
+    if (ret != kSuccess)
+        return ret;
+    *headerPath = localPath;
+    return kSuccess;
+}
+
+// the data of a detached header is decrypted in place, nothing on the
+// device is overwritten by shifted data, so there is no header to back up
+// and no superblock to recover. the header is dropped when done.
+static int decryptDetached(const QString &device, const QString &passphrase,
+                           const QString &activeName, const QString &headerPath)
+{
+    struct crypt_device *cdev = nullptr;
+    dfmbase::FinallyUtil finalClear([&] {
+        if (cdev) crypt_free(cdev);
+        gCurrDecryptintDevice.clear();
+    });
+    gCurrDecryptintDevice = device;
+
+    int ret = initCrypt(&cdev, device);
+    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
+
+    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
+    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
+
+    std::string cActiveName = activeName.toStdString();
+    const auto decParams = decryptParams();
+    ret = initReencrypt(cdev,
+                        activeName.isEmpty() ? nullptr : cActiveName.c_str(),
+                        passphrase,
+                        nullptr,
+                        CRYPT_ANY_SLOT,
+                        CRYPT_ANY_SLOT,
+                        nullptr,
+                        nullptr,
+                        &decParams);
+    CHECK_INT(ret, "init reencrypt failed " + device, -kErrorWrongPassphrase);
+
+    job_history::setCrypt(QString("%1-%2").arg(crypt_get_cipher(cdev)).arg(crypt_get_cipher_mode(cdev)),
+                          crypt_get_sector_size(cdev), decParams.resilience);
+    job_history::enterPhase("decrypt");
+    FAULT_POINT("decrypt-hotzone");
+    crypt_affinity::pinCurrentThread();
+    reencrypt_pacing::begin();
+    ret = crypt_reencrypt(cdev, disk_encrypt_funcs::bcDecryptProgress);
+    CHECK_INT(ret, "decrypt failed" + device, -kErrorReencryptFailed);
+
+    ::remove(headerPath.toStdString().c_str());
+    qInfo() << "detached header is removed" << headerPath;
+    return kSuccess;
+}
+
 int disk_encrypt_funcs::bcDecryptDevice(const QString &device,
                                         const QString &passphrase)
 {
+    const QString &detachedHeader = block_device_utils::bcDetachedHeader(device);
+    if (!detachedHeader.isEmpty())
+        return decryptDetached(device, passphrase, "", detachedHeader);
+
     // backup header first
     QString headerPath;
     uint32_t flags;
@@ -395,6 +797,7 @@ int disk_encrypt_funcs::bcDecryptDevice(const QString &device,
     });
     gCurrDecryptintDevice = device;
 
+    job_history::enterPhase("backup-header");
     int ret = bcBackupCryptHeader(device, headerPath);
     CHECK_INT(ret, "backup header failed " + device, -kErrorBackupHeader);
 
@@ -415,32 +818,115 @@ int disk_encrypt_funcs::bcDecryptDevice(const QString &device,
                "device is under encrypting... " + device + " the flags are: " + QString::number(flags),
                -kErrorWrongFlags);
 
-    ret = crypt_reencrypt_init_by_passphrase(cdev,
-                                             nullptr,
-                                             passphrase.toStdString().c_str(),
-                                             passphrase.length(),
-                                             CRYPT_ANY_SLOT,
-                                             CRYPT_ANY_SLOT,
-                                             nullptr,
-                                             nullptr,
-                                             decryptParams());
+    const auto decParams = decryptParams();
+    ret = initReencrypt(cdev,
+                        nullptr,
+                        passphrase,
+                        nullptr,
+                        CRYPT_ANY_SLOT,
+                        CRYPT_ANY_SLOT,
+                        nullptr,
+                        nullptr,
+                        &decParams);
     CHECK_INT(ret, "init reencrypt failed " + device, -kErrorWrongPassphrase);
 
+    job_history::setCrypt(QString("%1-%2").arg(crypt_get_cipher(cdev)).arg(crypt_get_cipher_mode(cdev)),
+                          crypt_get_sector_size(cdev), decParams.resilience);
+    job_history::enterPhase("decrypt");
+    FAULT_POINT("decrypt-hotzone");
+    crypt_affinity::pinCurrentThread();
+    reencrypt_pacing::begin();
     ret = crypt_reencrypt(cdev, bcDecryptProgress);
     CHECK_INT(ret, "decrypt failed" + device, -kErrorReencryptFailed);
 
+    job_history::enterPhase("recover-fs");
+    FAULT_POINT("recover-superblock");
     bool res = fs_resize::recoverySuperblock_ext(device, headerPath);
     CHECK_BOOL(res, "recovery fs failed " + device, -kErrorResizeFs);
     return 0;
 }
 
+int disk_encrypt_funcs::bcDecryptDeviceOnline(const QString &device,
+                                              const QString &passphrase,
+                                              const QString &activeName)
+{
+    const QString &detachedHeader = block_device_utils::bcDetachedHeader(device);
+    if (!detachedHeader.isEmpty())
+        return decryptDetached(device, passphrase, activeName, detachedHeader);
+
+    // the on-disk header is overwritten by the shifted data, so the detached
+    // copy must survive a power loss until the decryption finishes.
+    QString headerPath = block_device_utils::bcDecryptHeaderPath(device);
+    CHECK_BOOL(!headerPath.isEmpty(), "no partuuid to key the header copy " + device, -kErrorBackupHeader);
+    uint32_t flags;
+    struct crypt_device *cdev = nullptr;
+    int ret = 0;
+    dfmbase::FinallyUtil finalClear([&] {
+        if (cdev) crypt_free(cdev);
+        if (ret == 0) ::remove(headerPath.toStdString().c_str());
+        gCurrDecryptintDevice.clear();
+    });
+    gCurrDecryptintDevice = device;
+
+    QDir().mkpath(kBootUsecPath);
+    if (!QFile::exists(headerPath)) {
+        ret = bcBackupCryptHeader(device, headerPath);
+        CHECK_INT(ret, "backup header failed " + device, -kErrorBackupHeader);
+    } else {
+        qInfo() << "resume online decryption with header" << headerPath;
+    }
+
+    ret = crypt_init_data_device(&cdev,
+                                 headerPath.toStdString().c_str(),
+                                 device.toStdString().c_str());
+    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
+
+    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
+    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
+
+    ret = crypt_persistent_flags_get(cdev,
+                                     CRYPT_FLAGS_REQUIREMENTS,
+                                     &flags);
+    CHECK_INT(ret, "get device flag failed " + device, -kErrorGetReencryptFlag);
+    bool underEncrypting = (flags & CRYPT_REQUIREMENT_OFFLINE_REENCRYPT);
+    CHECK_BOOL(!underEncrypting,
+               "device is under encrypting... " + device + " the flags are: " + QString::number(flags),
+               -kErrorWrongFlags);
+
+    // an interrupted decryption of a device that is not unlocked is resumed
+    // offline from the saved header.
+    std::string cActiveName = activeName.toStdString();
+    const auto decParams = onlineDecryptParams(crypt_get_data_offset(cdev));
+    ret = initReencrypt(cdev,
+                        activeName.isEmpty() ? nullptr : cActiveName.c_str(),
+                        passphrase,
+                        nullptr,
+                        CRYPT_ANY_SLOT,
+                        CRYPT_ANY_SLOT,
+                        nullptr,
+                        nullptr,
+                        &decParams);
+    CHECK_INT(ret, "init reencrypt failed " + device, -kErrorWrongPassphrase);
+
+    job_history::setCrypt(QString("%1-%2").arg(crypt_get_cipher(cdev)).arg(crypt_get_cipher_mode(cdev)),
+                          crypt_get_sector_size(cdev), decParams.resilience);
+    job_history::enterPhase("decrypt");
+    FAULT_POINT("decrypt-datashift");
+    crypt_affinity::pinCurrentThread();
+    reencrypt_pacing::begin();
+    ret = crypt_reencrypt(cdev, bcDecryptProgress);
+    CHECK_INT(ret, "decrypt failed" + device, -kErrorReencryptFailed);
+    return 0;
+}
+
 int disk_encrypt_funcs::bcBackupCryptHeader(const QString &device, QString &headerPath)
 {
-    headerPath = "/tmp/dm_header_" + device.mid(5);
+    if (headerPath.isEmpty())
+        headerPath = "/tmp/dm_header_" + device.mid(5);
     struct crypt_device *cdev = nullptr;
     dfmbase::FinallyUtil finalClear([&] { if (cdev) crypt_free(cdev); });
 
-    int ret = crypt_init(&cdev, device.toStdString().c_str());
+    int ret = initCrypt(&cdev, device);
     CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
 
     ret = crypt_header_backup(cdev,
@@ -451,10 +937,13 @@ int disk_encrypt_funcs::bcBackupCryptHeader(const QString &device, QString &head
 }
 
 int disk_encrypt_funcs::bcResumeReencrypt(const QString &device,
-                                          const QString &passphrase)
+                                          const QString &passphrase,
+                                          const QString &activeName,
+                                          const VolumeKeyPtr &volumeKey)
 {
     qDebug() << "start resume encryption for device"
-             << device;
+             << device
+             << activeName;
     gCurrReencryptingDevice = device;
     struct crypt_device *cdev { nullptr };
     dfmbase::FinallyUtil finalClear([&] {
@@ -462,9 +951,7 @@ int disk_encrypt_funcs::bcResumeReencrypt(const QString &device,
         gCurrDecryptintDevice.clear();
     });
 
-    int ret = crypt_init_data_device(&cdev,
-                                     device.toStdString().c_str(),
-                                     device.toStdString().c_str());
+    int ret = initCrypt(&cdev, device);
     CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
 
     ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
@@ -479,30 +966,61 @@ int disk_encrypt_funcs::bcResumeReencrypt(const QString &device,
                "wrong flags " + device + " flags " + QString::number(flags),
                -kErrorWrongFlags);
 
-    ret = crypt_reencrypt_init_by_passphrase(cdev,
-                                             nullptr,
-                                             passphrase.toStdString().c_str(),
-                                             passphrase.length(),
-                                             CRYPT_ANY_SLOT,
-                                             CRYPT_ANY_SLOT,
-                                             nullptr,
-                                             nullptr,
-                                             resumeParams());
+    // the flag is set by decryption too, only the encryption started by
+    // bcDoSetupHeader is resumed here.
+    struct crypt_params_reencrypt recorded {};
+    crypt_reencrypt_info info = crypt_reencrypt_status(cdev, &recorded);
+    const bool detached = !block_device_utils::bcDetachedHeader(device).isEmpty();
+    const auto direction = detached ? CRYPT_REENCRYPT_FORWARD : CRYPT_REENCRYPT_BACKWARD;
+    CHECK_BOOL(info != CRYPT_REENCRYPT_NONE && info != CRYPT_REENCRYPT_INVALID
+                       && recorded.mode == CRYPT_REENCRYPT_ENCRYPT
+                       && recorded.direction == direction,
+               "not an interrupted encryption " + device
+                       + " mode " + QString::number(recorded.mode)
+                       + " direction " + QString::number(recorded.direction),
+               -kErrorWrongFlags);
+
+    // with an active name the device is reencrypted online through its
+    // mapping, the filesystem on it stays mounted during the whole process.
+    bool online = !activeName.isEmpty();
+    std::string cActiveName = activeName.toStdString();
+    // a hotzone cut by crash is recovered from the resilience data here,
+    // a cleanly paused one has nothing to recover.
+    if (info == CRYPT_REENCRYPT_CRASH)
+        job_history::enterPhase("recover-hotzone");
+    const auto reencParams = resumeParams(recorded);
+    ret = initReencrypt(cdev,
+                        online ? cActiveName.c_str() : nullptr,
+                        passphrase,
+                        volumeKey,
+                        CRYPT_ANY_SLOT,
+                        CRYPT_ANY_SLOT,
+                        nullptr,
+                        nullptr,
+                        &reencParams);
     CHECK_INT(ret, "init reencrypt failed " + device, -kErrorInitReencrypt);
 
+    job_history::setCrypt(QString("%1-%2").arg(crypt_get_cipher(cdev)).arg(crypt_get_cipher_mode(cdev)),
+                          crypt_get_sector_size(cdev), reencParams.resilience);
+    job_history::enterPhase("encrypt");
+    FAULT_POINT("encrypt-hotzone");
+    crypt_affinity::pinCurrentThread();
+    reencrypt_pacing::begin();
     ret = crypt_reencrypt(cdev, bcEncryptProgress);
     CHECK_INT(ret, "start resume failed " + device, -kErrorReencryptFailed);
 
+    // the filesystem has been expanded when the header was set up and the
+    // mapping is still in use, nothing to do for online encryption.
+    if (online)
+        return kSuccess;
+
     // active device for expanding fs.
     QString activeDev = QString("dm-%1").arg(device.mid(5));
-    ret = crypt_activate_by_passphrase(cdev,
-                                       activeDev.toStdString().c_str(),
-                                       CRYPT_ANY_SLOT,
-                                       passphrase.toStdString().c_str(),
-                                       passphrase.length(),
-                                       CRYPT_ACTIVATE_NO_JOURNAL);
+    ret = activateDevice(cdev, activeDev, passphrase, volumeKey, CRYPT_ACTIVATE_NO_JOURNAL);
     CHECK_INT(ret, "acitve device failed " + device + activeDev, -kErrorActive);
 
+    job_history::enterPhase("expand");
+    FAULT_POINT("expand-fs");
     fs_resize::expandFileSystem_ext(QString("/dev/mapper/%1").arg(activeDev));
 
     ret = crypt_deactivate(nullptr,
@@ -511,8 +1029,78 @@ int disk_encrypt_funcs::bcResumeReencrypt(const QString &device,
     return kSuccess;
 }
 
+int disk_encrypt_funcs::bcActivateDevice(const QString &device,
+                                         const QString &passphrase,
+                                         const QString &activeName,
+                                         const VolumeKeyPtr &volumeKey)
+{
+    struct crypt_device *cdev { nullptr };
+    dfmbase::FinallyUtil finalClear([&] { if (cdev) crypt_free(cdev); });
+
+    int ret = initCrypt(&cdev, device);
+    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
+
+    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
+    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
+
+    ret = activateDevice(cdev, activeName, passphrase, volumeKey, 0);
+    CHECK_INT(ret, "active device failed " + device + activeName, -kErrorActive);
+    return kSuccess;
+}
+
+int disk_encrypt_funcs::bcUnlockDevice(const QString &device,
+                                       const QString &passphrase,
+                                       uint32_t flags,
+                                       QString *clearDev)
+{
+    Q_ASSERT(clearDev);
+
+    QString activeName = block_device_utils::bcActiveName(device);
+    if (!activeName.isEmpty()) {
+        qInfo() << "device is already unlocked" << device << activeName;
+        *clearDev = "/dev/mapper/" + activeName;
+        return kSuccess;
+    }
+
+    struct crypt_device *cdev { nullptr };
+    dfmbase::FinallyUtil finalClear([&] { if (cdev) crypt_free(cdev); });
+
+    int ret = initCrypt(&cdev, device);
+    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
+
+    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
+    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
+
+    // same name as UDisks uses, so it is recognized as the cleartext device.
+    activeName = QString("luks-%1").arg(crypt_get_uuid(cdev));
+    ret = activateDevice(cdev, activeName, passphrase, nullptr, flags);
+    CHECK_INT(ret, "unlock device failed " + device, ret == -EPERM ? -kErrorWrongPassphrase : -kErrorActive);
+
+    *clearDev = "/dev/mapper/" + activeName;
+    return kSuccess;
+}
+
+int disk_encrypt_funcs::bcGetUUID(const QString &device, QString *uuid)
+{
+    Q_ASSERT(uuid);
+    struct crypt_device *cdev { nullptr };
+    dfmbase::FinallyUtil finalClear([&] { if (cdev) crypt_free(cdev); });
+
+    int ret = initCrypt(&cdev, device);
+    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
+
+    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
+    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
+
+    *uuid = crypt_get_uuid(cdev);
+    return kSuccess;
+}
+
 int disk_encrypt_funcs::bcEncryptProgress(uint64_t size, uint64_t offset, void *)
 {
+    job_history::progress(size, offset);
+    crypt_affinity::applyToWorkqueues(false);
+    reencrypt_pacing::pace();
     Q_EMIT SignalEmitter::instance()->updateEncryptProgress(gCurrReencryptingDevice,
                                                             double(offset) / size);
     return 0;
@@ -520,6 +1108,9 @@ int disk_encrypt_funcs::bcEncryptProgress(uint64_t size, uint64_t offset, void *
 
 int disk_encrypt_funcs::bcDecryptProgress(uint64_t size, uint64_t offset, void *)
 {
+    job_history::progress(size, offset);
+    crypt_affinity::applyToWorkqueues(false);
+    reencrypt_pacing::pace();
     Q_EMIT SignalEmitter::instance()->updateDecryptProgress(gCurrDecryptintDevice,
                                                             double(offset) / size);
     return 0;
@@ -530,14 +1121,16 @@ int disk_encrypt_funcs::bcChangePassphrase(const QString &device, const QString
     struct crypt_device *cdev { nullptr };
     dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
 
-    int ret = crypt_init_data_device(&cdev, device.toStdString().c_str(), nullptr);
+    int ret = initCrypt(&cdev, device);
     CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
 
     ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
     CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
 
+    // the old slot is replaced by the new one, never leaves a stale slot.
+    int oldSlot = primaryKeyslot(cdev);
     ret = crypt_keyslot_change_by_passphrase(cdev,
-                                             CRYPT_ANY_SLOT,
+                                             oldSlot >= 0 ? oldSlot : CRYPT_ANY_SLOT,
                                              CRYPT_ANY_SLOT,
                                              oldPassphrase.toStdString().c_str(),
                                              oldPassphrase.length(),
@@ -549,56 +1142,240 @@ int disk_encrypt_funcs::bcChangePassphrase(const QString &device, const QString
     return kSuccess;
 }
 
-int disk_encrypt_funcs::bcChangePassphraseByRecKey(const QString &device, const QString &recoveryKey, const QString &newPassphrase, int *keyslot)
+int disk_encrypt_funcs::bcChangePassphraseByRecKey(const QString &device, const QString &recoveryKey, const QString &newPassphrase,
+                                                   int *keyslot, int *retiredKeyslot)
 {
+    Q_ASSERT(keyslot && retiredKeyslot);
+    *retiredKeyslot = -1;
+
     struct crypt_device *cdev { nullptr };
     dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
 
-    int ret = crypt_init_data_device(&cdev,
-                                     device.toStdString().c_str(),
-                                     /*device.toStdString().c_str()*/ nullptr);
+    int ret = initCrypt(&cdev, device);
     CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
 
     ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
     CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
 
-    ret = crypt_keyslot_add_by_passphrase(cdev,
+    int recSlot = tokenKeyslot(cdev, kTokenTypeRecKey);
+    int oldSlot = primaryKeyslot(cdev);
+
+    // unlock the volume key by recovery key once, then add the new
+    // passphrase by it. the old passphrase slot is retired by caller after
+    // the token is updated.
+    VolumeKeyPtr vk = VolumeKey::allocate(crypt_get_volume_key_size(cdev));
+    CHECK_BOOL(vk, "cannot allocate volume key " + device, -kErrorAddKeyslot);
+    size_t vkSize = vk->size();
+    ret = crypt_volume_key_get(cdev,
+                               recSlot >= 0 ? recSlot : CRYPT_ANY_SLOT,
+                               vk->data(),
+                               &vkSize,
+                               recoveryKey.toStdString().c_str(),
+                               recoveryKey.length());
+    CHECK_INT(ret, "wrong recovery key " + device, -kErrorWrongPassphrase);
+    if (recSlot < 0)
+        recSlot = ret;
+
+    ret = crypt_keyslot_add_by_volume_key(cdev,
                                           CRYPT_ANY_SLOT,
-                                          recoveryKey.toStdString().c_str(),
-                                          recoveryKey.length(),
+                                          vk->data(),
+                                          vkSize,
                                           newPassphrase.toStdString().c_str(),
                                           newPassphrase.length());
     CHECK_INT(ret, "change passphrase by rec key failed " + device, -kErrorAddKeyslot);
-    Q_ASSERT(keyslot);
     *keyslot = ret;
+    if (oldSlot >= 0 && oldSlot != recSlot && oldSlot != ret)
+        *retiredKeyslot = oldSlot;
+    return kSuccess;
+}
+
+int disk_encrypt_funcs::bcDestroyKeyslot(const QString &device, int keyslot)
+{
+    struct crypt_device *cdev { nullptr };
+    dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
+
+    int ret = initCrypt(&cdev, device);
+    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
+
+    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
+    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
+
+    ret = crypt_keyslot_destroy(cdev, keyslot);
+    CHECK_INT(ret, "destroy keyslot failed " + device + " " + QString::number(keyslot), -kErrorDestroyKeyslot);
+    return kSuccess;
+}
+
+// sys/mount.h conflicts with linux/fs.h.
+#ifndef BLKDISCARD
+#    define BLKDISCARD _IO(0x12, 119)
+#endif
+
+static int discardDataArea(const QString &device, quint64 offset)
+{
+    int fd = open(device.toStdString().c_str(), O_WRONLY | O_CLOEXEC);
+    CHECK_INT(fd, "cannot open device for discard " + device + strerror(errno), -kErrorOpenFileFailed);
+
+    quint64 size = 0;
+    int ret = ioctl(fd, BLKGETSIZE64, &size);
+    if (ret == 0 && size > offset) {
+        uint64_t range[2] { offset, size - offset };
+        ret = ioctl(fd, BLKDISCARD, &range);
+    }
+    int err = errno;
+    close(fd);
+    // not every device can discard, the data is unreadable without the key anyway.
+    if (ret != 0)
+        qWarning() << "discard data area failed" << device << strerror(err);
+    else
+        qInfo() << "data area is discarded" << device << size - offset;
+    return kSuccess;
+}
+
+int disk_encrypt_funcs::bcCryptoErase(const QString &device, bool discard)
+{
+    CHECK_BOOL(block_device_utils::bcActiveName(device).isEmpty(),
+               "device is unlocked, lock it before erasing " + device, -kErrorDeviceMounted);
+    CHECK_BOOL(!block_device_utils::bcIsMounted(device),
+               "device is mounted " + device, -kErrorDeviceMounted);
+    auto status = block_device_utils::bcDevStatus(device);
+    CHECK_BOOL(status == kLUKS1 || status == kLUKS2 || status == kUnknownLUKS,
+               "device is not encrypted " + device, -kErrorParamsInvalid);
+
+    struct crypt_device *cdev { nullptr };
+    dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
+
+    int ret = initCrypt(&cdev, device);
+    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
+
+    ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
+    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
+
+    // the header area ends where the data begins, or it is the whole file
+    // of a detached header.
+    const QString &detachedHeader = block_device_utils::bcDetachedHeader(device);
+    const quint64 dataOffset = crypt_get_data_offset(cdev) * 512;
+    const quint64 headerSize = detachedHeader.isEmpty() ? dataOffset
+                                                        : static_cast<quint64>(QFileInfo(detachedHeader).size());
+    const QString &metadataDev = detachedHeader.isEmpty() ? device : detachedHeader;
+    qInfo() << "crypto erase" << device << "header" << metadataDev << headerSize;
+
+    const bool isLUKS2 = QString(crypt_get_type(cdev)) == CRYPT_LUKS2;
+    const int maxSlots = crypt_keyslot_max(isLUKS2 ? CRYPT_LUKS2 : CRYPT_LUKS1);
+    for (int slot = 0; slot < maxSlots; ++slot) {
+        auto slotStatus = crypt_keyslot_status(cdev, slot);
+        if (slotStatus == CRYPT_SLOT_INACTIVE || slotStatus == CRYPT_SLOT_INVALID)
+            continue;
+        ret = crypt_keyslot_destroy(cdev, slot);
+        CHECK_INT(ret, "destroy keyslot failed " + device + " " + QString::number(slot), -kErrorDestroyKeyslot);
+    }
+    for (int i = 0; isLUKS2 && i < 32 /* LUKS2_TOKENS_MAX */; ++i) {
+        const char *json { nullptr };
+        if (crypt_token_json_get(cdev, i, &json) >= 0)
+            crypt_token_json_set(cdev, i, nullptr);
+    }
+
+    // keyslots are gone, wiping the header area drops both metadata copies
+    // and leaves no LUKS signature behind.
+    ret = crypt_wipe(cdev, metadataDev.toStdString().c_str(), CRYPT_WIPE_ZERO,
+                     0, headerSize, 1024 * 1024, 0, nullptr, nullptr);
+    CHECK_INT(ret, "wipe header failed " + device, -kErrorWipeHeader);
+    crypt_free(cdev);
+    cdev = nullptr;
+
+    if (!detachedHeader.isEmpty())
+        ::remove(detachedHeader.toStdString().c_str());
+    if (discard)
+        discardDataArea(device, dataOffset);
     return kSuccess;
 }
 
-int disk_encrypt_funcs::bcGetToken(const QString &device, QString *tokenJson)
+int disk_encrypt_funcs::bcCompactKeyslots(const QString &device, const QString &passphrase,
+                                          bool reportOnly, QVariantMap *report)
 {
-    Q_ASSERT(tokenJson);
+    Q_ASSERT(report);
     struct crypt_device *cdev { nullptr };
     dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
 
-    int ret = crypt_init(&cdev,
-                         device.toStdString().c_str());
+    int ret = initCrypt(&cdev, device);
+    CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
+
+    ret = crypt_load(cdev, CRYPT_LUKS2, nullptr);
+    CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
+
+    uint32_t flags;
+    ret = crypt_persistent_flags_get(cdev, CRYPT_FLAGS_REQUIREMENTS, &flags);
+    CHECK_INT(ret, "get device flag failed " + device, -kErrorGetReencryptFlag);
+    CHECK_BOOL(!(flags & (CRYPT_REQUIREMENT_OFFLINE_REENCRYPT | CRYPT_REQUIREMENT_ONLINE_REENCRYPT)),
+               "device is under reencrypting " + device,
+               -kErrorWrongFlags);
+
+    // the passphrase tells which slot is user's one.
+    std::string pass = passphrase.toStdString();
+    int passSlot = unlockTargeted(cdev, [&](int slot) {
+        return crypt_activate_by_passphrase(cdev, nullptr, slot, pass.c_str(), pass.length(), 0);
+    });
+    CHECK_INT(passSlot, "wrong passphrase " + device, -kErrorWrongPassphrase);
+    CHECK_BOOL(passSlot != tokenKeyslot(cdev, kTokenTypeRecKey),
+               "recovery key cannot tell the passphrase slot " + device,
+               -kErrorWrongPassphrase);
+
+    int recSlot = tokenKeyslot(cdev, kTokenTypeRecKey);
+    const QList<int> &active = activeKeyslots(cdev);
+    const QList<int> &referenced = tokenKeyslots(cdev);
+    QVariantList stale, removed;
+    for (int slot : active) {
+        if (slot != passSlot && !referenced.contains(slot))
+            stale.append(slot);
+    }
+
+    auto toVariantList = [](const QList<int> &list) {
+        QVariantList ret;
+        for (int v : list) ret.append(v);
+        return ret;
+    };
+    report->insert("activeKeyslots", toVariantList(active));
+    report->insert("tokenKeyslots", toVariantList(referenced));
+    report->insert("passphraseKeyslot", passSlot);
+    report->insert("recoveryKeyslot", recSlot);
+    report->insert("staleKeyslots", stale);
+    report->insert("removedKeyslots", removed);
+    qInfo() << "keyslots of" << device << *report;
+
+    if (reportOnly || stale.isEmpty())
+        return kSuccess;
+
+    // without the recovery token the recovery key's slot looks stale too.
+    CHECK_BOOL(recSlot >= 0, "recovery keyslot is unknown, cannot compact " + device, -kErrorKeyslotsUnknown);
+
+    for (const auto &slot : stale) {
+        ret = crypt_keyslot_destroy(cdev, slot.toInt());
+        CHECK_INT(ret, "destroy keyslot failed " + device + " " + slot.toString(), -kErrorDestroyKeyslot);
+        removed.append(slot);
+        report->insert("removedKeyslots", removed);
+    }
+    return kSuccess;
+}
+
+int disk_encrypt_funcs::bcGetToken(const QString &device, UsecToken *token)
+{
+    Q_ASSERT(token);
+    struct crypt_device *cdev { nullptr };
+    dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
+
+    int ret = initCrypt(&cdev, device);
     CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
 
     ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
     CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
 
     for (int i = 0; i < 32 /* LUKS2_TOKENS_MAX */; ++i) {
-        const char *token { nullptr };
-        if ((ret = crypt_token_json_get(cdev, i, &token)) < 0)
+        const char *json { nullptr };
+        if ((ret = crypt_token_json_get(cdev, i, &json)) < 0)
             continue;
-        QString json(token);
-        if (json.contains("usec-tpm2")) {
-            // qInfo() << "found token:" << json;
-            QJsonDocument doc = QJsonDocument::fromJson(token);
-            QJsonObject obj = doc.object();
-            obj.insert("token_index", i);
-            doc.setObject(obj);
-            *tokenJson = doc.toJson();
+        UsecToken found = UsecToken::fromJson(json);
+        if (found.isTPM()) {
+            found.index = i;
+            *token = found;
             return kSuccess;
         }
     }
@@ -607,43 +1384,43 @@ int disk_encrypt_funcs::bcGetToken(const QString &device, QString *tokenJson)
     return kSuccess;
 }
 
-int disk_encrypt_funcs::bcSetToken(const QString &device, const QString &token)
+int disk_encrypt_funcs::bcSetToken(const QString &device, const UsecToken &token)
 {
-    if (token.isEmpty())
+    if (token.type.isEmpty())
         return 0;
-
-    QJsonDocument doc = QJsonDocument::fromJson(token.toLocal8Bit());
-    QJsonObject obj = doc.object();
-    int tokenIndex = obj.value("token_index").toInt(CRYPT_ANY_TOKEN);
+    CHECK_BOOL(token.isValid(), "token is not valid " + device, -kErrorSetTokenFailed);
 
     struct crypt_device *cdev { nullptr };
     dfmbase::FinallyUtil finalClear([&] {if (cdev) crypt_free(cdev); });
 
-    int ret = crypt_init(&cdev,
-                         device.toStdString().c_str());
+    int ret = initCrypt(&cdev, device);
     CHECK_INT(ret, "init device failed " + device, -kErrorInitCrypt);
 
     ret = crypt_load(cdev, CRYPT_LUKS, nullptr);
     CHECK_INT(ret, "load device failed " + device, -kErrorLoadCrypt);
 
     ret = crypt_token_json_set(cdev,
-                               tokenIndex,
-                               token.toStdString().c_str());
+                               token.index >= 0 ? token.index : CRYPT_ANY_TOKEN,
+                               token.toJson().constData());
     CHECK_INT(ret, "set token failed " + device, -kErrorSetTokenFailed);
     return 0;
 }
 
 EncryptStatus block_device_utils::bcDevStatus(const QString &device)
 {
-    auto blkDev = block_device_utils::bcCreateBlkDev(device);
-    if (!blkDev) {
-        qWarning() << "cannot create block device handler:"
+    // only LUKS2 supports detached reencryption.
+    if (!bcDetachedHeader(device).isEmpty() || !bcInterruptedDecryptHeader(device).isEmpty())
+        return kLUKS2;
+
+    BlockDeviceInfo info;
+    if (!BlockDeviceBackend::instance()->probe(device, &info)) {
+        qWarning() << "cannot probe block device:"
                    << device;
         return kStatusError;
     }
 
-    const QString &idType = blkDev->getProperty(dfmmount::Property::kBlockIDType).toString();
-    const QString &idVersion = blkDev->getProperty(dfmmount::Property::kBlockIDVersion).toString();
+    const QString &idType = info.idType;
+    const QString &idVersion = info.idVersion;
 
     if (idType == "crypto_LUKS") {
         if (idVersion == "1")
@@ -680,13 +1457,190 @@ DevPtr block_device_utils::bcCreateBlkDev(const QString &device)
     return blkDev.objectCast<dfmmount::DBlockDevice>();
 }
 
+static QList<MountItem> mountItemsOf(const QString &device)
+{
+    QList<MountItem> items;
+    struct stat devStat;
+    if (stat(device.toStdString().c_str(), &devStat) != 0)
+        return items;
+
+    FILE *mounts = setmntent("/proc/self/mounts", "r");
+    if (!mounts) {
+        qWarning() << "cannot read mount table";
+        return items;
+    }
+    dfmbase::FinallyUtil finalClear([&] { endmntent(mounts); });
+
+    struct mntent *ent { nullptr };
+    while ((ent = getmntent(mounts)) != nullptr) {
+        struct stat entStat;
+        if (stat(ent->mnt_fsname, &entStat) != 0
+            || !S_ISBLK(entStat.st_mode)
+            || entStat.st_rdev != devStat.st_rdev)
+            continue;
+        items.append({ ent->mnt_dir, ent->mnt_type, ent->mnt_opts });
+    }
+    return items;
+}
+
 bool block_device_utils::bcIsMounted(const QString &device)
 {
-    auto blkDev = block_device_utils::bcCreateBlkDev(device);
-    if (!blkDev) {
-        qWarning() << "cannot create block device handler:"
-                   << device;
+    // read the mount table directly, the mount points cached by UDisks
+    // may lag behind an unmount done by the daemon itself.
+    return !mountItemsOf(device).isEmpty();
+}
+
+bool block_device_utils::bcMountItem(const QString &device, MountItem *item)
+{
+    Q_ASSERT(item);
+    auto items = mountItemsOf(device);
+    // bind mounts cannot be restored on the new mapping reliably.
+    CHECK_BOOL(items.count() <= 1, "device is mounted more than once " + device, false);
+    if (items.isEmpty())
         return false;
+    *item = items.constFirst();
+    return true;
+}
+
+int block_device_utils::bcUnmount(const MountItem &item)
+{
+    int ret = umount2(item.mountPoint.toStdString().c_str(), 0);
+    CHECK_BOOL(ret == 0,
+               "unmount failed " + item.mountPoint + " " + strerror(errno),
+               -kErrorUnmountFailed);
+    return kSuccess;
+}
+
+int block_device_utils::bcMount(const QString &device, const MountItem &item)
+{
+    int ret = QProcess::execute("mount", { "-t", item.fsType,
+                                           "-o", item.options,
+                                           device, item.mountPoint });
+    CHECK_BOOL(ret == 0,
+               "mount failed " + device + " " + item.mountPoint,
+               -kErrorMountFailed);
+    return kSuccess;
+}
+
+quint64 block_device_utils::bcDeviceSize(const QString &device)
+{
+    int fd = open(device.toStdString().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    quint64 size = 0;
+    if (ioctl(fd, BLKGETSIZE64, &size) != 0)
+        size = 0;
+    close(fd);
+    return size;
+}
+
+QString block_device_utils::bcActiveName(const QString &device)
+{
+    QString devName = QFileInfo(device).canonicalFilePath().mid(5);
+    QDir holders(QString("/sys/class/block/%1/holders").arg(devName));
+    const QStringList &holderNames = holders.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const auto &holder : holderNames) {
+        QFile uuid(QString("/sys/class/block/%1/dm/uuid").arg(holder));
+        if (!uuid.open(QIODevice::ReadOnly) || !uuid.readAll().startsWith("CRYPT-"))
+            continue;
+
+        QFile name(QString("/sys/class/block/%1/dm/name").arg(holder));
+        if (name.open(QIODevice::ReadOnly))
+            return name.readAll().trimmed();
+    }
+    return "";
+}
+
+QString block_device_utils::bcPartUUID(const QString &device)
+{
+    const QString &devPath = QFileInfo(device).canonicalFilePath();
+    QDirIterator iter("/dev/disk/by-partuuid", QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
+    while (iter.hasNext()) {
+        iter.next();
+        if (iter.fileInfo().canonicalFilePath() == devPath)
+            return iter.fileName();
+    }
+    return QString();
+}
+
+QString block_device_utils::bcStableSpec(const QString &device)
+{
+    const QString &partUUID = bcPartUUID(device);
+    if (!partUUID.isEmpty())
+        return "PARTUUID=" + partUUID;
+
+    // probed rather than loaded, loading a header may look for the copies
+    // named by this.
+    BlockDeviceInfo info;
+    if (BlockDeviceBackend::instance()->probe(device, &info)
+        && info.idType == "crypto_LUKS" && !info.idUUID.isEmpty())
+        return "UUID=" + info.idUUID;
+    return QString();
+}
+
+QString block_device_utils::bcResolveSpec(const QString &spec)
+{
+    QString link;
+    if (spec.startsWith("PARTUUID="))
+        link = "/dev/disk/by-partuuid/" + spec.mid(strlen("PARTUUID="));
+    else if (spec.startsWith("UUID="))
+        link = "/dev/disk/by-uuid/" + spec.mid(strlen("UUID="));
+    return link.isEmpty() ? QString() : QFileInfo(link).canonicalFilePath();
+}
+
+QString block_device_utils::bcDetachedHeaderPath(const QString &device)
+{
+    // the data device carries no LUKS signature, the header is found by
+    // the partition uuid, which survives device renaming. a kernel name is
+    // no key: after a renumbering the header would meet another device.
+    const QString &partUUID = bcPartUUID(device);
+    if (partUUID.isEmpty())
+        return QString();
+    return QString("%1/%2.luks2").arg(kDetachedHeaderDir).arg(partUUID);
+}
+
+QString block_device_utils::bcDetachedHeader(const QString &device)
+{
+    const QString &path = bcDetachedHeaderPath(device);
+    return !path.isEmpty() && QFile::exists(path) ? path : QString();
+}
+
+QString block_device_utils::bcDecryptHeaderPath(const QString &device)
+{
+    // the on-disk header is overwritten soon after the decryption starts,
+    // so the copy cannot be keyed by the LUKS uuid, only by the partition.
+    const QString &partUUID = bcPartUUID(device);
+    if (partUUID.isEmpty())
+        return QString();
+    return QString("%1/%2%3").arg(kBootUsecPath).arg(partUUID).arg(kDecryptHeaderSuffix);
+}
+
+static QString headerUUID(const QString &path, const QString &device = QString())
+{
+    struct crypt_device *cdev { nullptr };
+    int ret = device.isEmpty() ? crypt_init(&cdev, path.toStdString().c_str())
+                               : crypt_init_data_device(&cdev, path.toStdString().c_str(), device.toStdString().c_str());
+    if (ret < 0)
+        return QString();
+    QString uuid;
+    if (crypt_load(cdev, CRYPT_LUKS, nullptr) == 0)
+        uuid = crypt_get_uuid(cdev);
+    crypt_free(cdev);
+    return uuid;
+}
+
+QString block_device_utils::bcInterruptedDecryptHeader(const QString &device)
+{
+    const QString &path = bcDecryptHeaderPath(device);
+    if (path.isEmpty() || !QFile::exists(path))
+        return QString();
+
+    // while the header on device is still there it must be the one copied,
+    // a partition uuid may be cloned along with the whole disk.
+    const QString &onDevice = headerUUID(device);
+    if (!onDevice.isEmpty() && onDevice != headerUUID(path, device)) {
+        qWarning() << "the kept header does not belong to" << device << path;
+        return QString();
     }
-    return !blkDev->mountPoints().isEmpty();
+    return path;
 }
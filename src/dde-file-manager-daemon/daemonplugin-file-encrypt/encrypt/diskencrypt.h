@@ -5,6 +5,7 @@
 #define DISK_ENCRYPT_H
 
 #include "daemonplugin_file_encrypt_global.h"
+#include "volumekey.h"
 
 #include <QVariantMap>
 
@@ -23,18 +24,35 @@ enum EncryptStatus {
     kStatusError = 10000,
 };   // enum EncryptStatus
 
+struct MountItem
+{
+    QString mountPoint;
+    QString fsType;
+    QString options;
+};
+
 namespace disk_encrypt_funcs {
-int bcInitHeaderFile(const EncryptParams &params, QString &headerPath, int *keyslotCipher, int *keyslotRecKey);
-int bcGetToken(const QString &device, QString *tokenJson);
+int bcInitHeaderFile(const EncryptParams &params, QString &headerPath, int *keyslotCipher, int *keyslotRecKey, VolumeKeyPtr *volumeKey = nullptr);
+int bcGetToken(const QString &device, UsecToken *token);
 int bcInitHeaderDevice(const QString &device, const QString &passphrase, const QString &headerPath);
-int bcSetToken(const QString &device, const QString &token);
-int bcResumeReencrypt(const QString &device, const QString &passphrase);
+int bcSetToken(const QString &device, const UsecToken &token);
+int bcResumeReencrypt(const QString &device, const QString &passphrase, const QString &activeName = QString(), const VolumeKeyPtr &volumeKey = nullptr);
+int bcActivateDevice(const QString &device, const QString &passphrase, const QString &activeName, const VolumeKeyPtr &volumeKey = nullptr);
+int bcGetUUID(const QString &device, QString *uuid);
+int bcUnlockDevice(const QString &device, const QString &passphrase, uint32_t flags, QString *clearDev);
 int bcChangePassphrase(const QString &device, const QString &oldPassphrase, const QString &newPassphrase, int *keyslot);
-int bcChangePassphraseByRecKey(const QString &device, const QString &oldPassphrase, const QString &newPassphrase, int *keyslot);
+int bcChangePassphraseByRecKey(const QString &device, const QString &oldPassphrase, const QString &newPassphrase, int *keyslot, int *retiredKeyslot);
+int bcDestroyKeyslot(const QString &device, int keyslot);
+// destroys keyslots, tokens and the whole header area (both copies), the
+// data cannot be decrypted anymore. the data area is discarded optionally.
+int bcCryptoErase(const QString &device, bool discard);
+int bcCompactKeyslots(const QString &device, const QString &passphrase, bool reportOnly, QVariantMap *report);
 int bcDecryptDevice(const QString &device, const QString &passphrase);
+int bcDecryptDeviceOnline(const QString &device, const QString &passphrase, const QString &activeName);
 int bcBackupCryptHeader(const QString &device, QString &headerPath);
-int bcDoSetupHeader(const EncryptParams &params, QString *headerPath, int *keyslotCipher, int *keyslotRecKey);
-int bcPrepareHeaderFile(const QString &device, QString *headerPath);
+int bcDoSetupHeader(const EncryptParams &params, QString *headerPath, int *keyslotCipher, int *keyslotRecKey, VolumeKeyPtr *volumeKey = nullptr);
+int bcPrepareHeaderFile(const QString &device, quint64 size, QString *headerPath);
+int bcPrepareDetachedHeader(const QString &device, quint64 size, QString *headerPath);
 
 int bcEncryptProgress(uint64_t size, uint64_t offset, void *usrptr);
 int bcDecryptProgress(uint64_t size, uint64_t offset, void *usrptr);
@@ -45,8 +63,11 @@ namespace disk_encrypt_utils {
 EncryptParams bcConvertParams(const QVariantMap &params);
 bool bcValidateParams(const EncryptParams &params);
 
-QString bcExpRecFile(const EncryptParams &params);
+int bcExpRecFile(const EncryptParams &params, QString *recKey);
 QString bcGenRecKey();
+uint32_t bcActivateFlags(const QString &device, const QVariantMap &options);
+void bcParseCipher(const QString &fullCipher, QString *cipher, QString *mode, int *len);
+quint64 bcHeaderSize(const QString &fullCipher);
 }   // namespace disk_encrypt_utils
 
 typedef QSharedPointer<dfmmount::DBlockDevice> DevPtr;
@@ -54,6 +75,30 @@ namespace block_device_utils {
 DevPtr bcCreateBlkDev(const QString &device);
 EncryptStatus bcDevStatus(const QString &device);
 bool bcIsMounted(const QString &device);
+bool bcMountItem(const QString &device, MountItem *item);
+int bcUnmount(const MountItem &item);
+int bcMount(const QString &device, const MountItem &item);
+// size of the block device in bytes, 0 if it cannot be read.
+quint64 bcDeviceSize(const QString &device);
+QString bcActiveName(const QString &device);
+// the partition uuid of device, empty if it has none.
+QString bcPartUUID(const QString &device);
+// a name of device that survives renumbering: PARTUUID=, or UUID= of its
+// LUKS header. empty if it has neither.
+QString bcStableSpec(const QString &device);
+// the device named by a spec of bcStableSpec, empty if it's not present.
+QString bcResolveSpec(const QString &spec);
+// the header file of a device encrypted in detached mode, empty if it has none.
+QString bcDetachedHeader(const QString &device);
+// where the detached header of device is stored, named by its PARTUUID.
+// empty if it has none, such a device cannot be encrypted detached.
+QString bcDetachedHeaderPath(const QString &device);
+// where the header is kept while the device is decrypted online, named by
+// its PARTUUID. empty if it has none, it cannot be decrypted online then.
+QString bcDecryptHeaderPath(const QString &device);
+// the kept header of an online decryption that did not finish, empty if
+// none or it does not match the header still on device.
+QString bcInterruptedDecryptHeader(const QString &device);
 }   // namespace block_device_utils
 
 FILE_ENCRYPT_END_NS
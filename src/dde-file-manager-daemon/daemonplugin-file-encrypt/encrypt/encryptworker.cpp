@@ -3,12 +3,17 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "encryptworker.h"
 #include "diskencrypt.h"
+#include "deferredunlock.h"
+#include "history/jobhistory.h"
+
+#include <dfm-base/utils/finallyutil.h>
 
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QFile>
 #include <QDir>
+#include <QFileInfo>
 #include <QRegularExpression>
 #include <QSettings>
 
@@ -16,7 +21,6 @@ FILE_ENCRYPT_USE_NS
 using namespace disk_encrypt;
 
 #define DEV_KEY QString("device/%1")
-static constexpr char kBootUsecPath[] { "/boot/usec-crypt" };
 
 void createUsecPathIfNotExist()
 {
@@ -43,6 +47,9 @@ void PrencryptWorker::run()
         return;
     }
 
+    job_history::begin(jobID, "encrypt-prepare", params.value(encrypt_param_keys::kKeyDevice).toString());
+    dfmbase::FinallyUtil recordJob([this] { job_history::finish(exitError()); });
+
     auto encParams = disk_encrypt_utils::bcConvertParams(params);
     if (!disk_encrypt_utils::bcValidateParams(encParams)) {
         setExitCode(-kErrorParamsInvalid);
@@ -50,38 +57,99 @@ void PrencryptWorker::run()
         return;
     }
 
+    // online mode: the partition is unmounted only while the header is being
+    // set up, then it is mounted back through the crypt mapping and the data
+    // is encrypted in background.
+    MountItem mountItem;
+    bool online = params.value(encrypt_param_keys::kKeyOnlineMode, false).toBool()
+            && block_device_utils::bcMountItem(encParams.device, &mountItem);
+    if (online) {
+        int err = block_device_utils::bcUnmount(mountItem);
+        if (err != kSuccess) {
+            setExitCode(err);
+            return;
+        }
+    }
+
+    auto restoreMount = [&] {
+        if (online)
+            block_device_utils::bcMount(encParams.device, mountItem);
+    };
+
     QString localHeaderFile;
     int err = disk_encrypt_funcs::bcInitHeaderFile(encParams,
                                                    localHeaderFile,
                                                    &keyslotCipher,
-                                                   &keyslotRecKey);
+                                                   &keyslotRecKey,
+                                                   &vk);
     if (err != kSuccess || localHeaderFile.isEmpty()) {
         setExitCode(-kErrorCreateHeader);
         qDebug() << "cannot generate local header"
                  << params;
+        restoreMount();
         return;
     }
 
-    int ret = disk_encrypt_funcs::bcInitHeaderDevice(encParams.device,
+    // a detached header is already in its place.
+    int ret = encParams.detachedHeader
+            ? kSuccess
+            : disk_encrypt_funcs::bcInitHeaderDevice(encParams.device,
                                                      encParams.passphrase,
                                                      localHeaderFile);
     if (ret != 0) {
         setExitCode(-kErrorApplyHeader);
         qDebug() << "cannot init device encrypt"
                  << params;
+        restoreMount();
         return;
     }
 
-    if (!encParams.tpmToken.isEmpty()) {
+    if (encParams.tpmToken.isTPM()) {
         QFile f(QString(TOKEN_FILE_PATH).arg(encParams.device.mid(5)));
-        if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            f.write(encParams.tpmToken.toJson());
+            f.flush();
+            f.close();
+        } else {
             qWarning() << "cannot open file to cache token";
-            return;
         }
-        f.write(encParams.tpmToken.toLocal8Bit());
-        f.flush();
-        f.close();
     }
+
+    if (online)
+        setExitCode(goOnline(encParams.device, encParams.passphrase, mountItem));
+}
+
+int PrencryptWorker::goOnline(const QString &device, const QString &passphrase, const MountItem &mountItem)
+{
+    QString activeName = QString("dm-%1").arg(device.mid(5));
+    int ret = disk_encrypt_funcs::bcActivateDevice(device, passphrase, activeName, vk);
+    if (ret != kSuccess && vk) {
+        qWarning() << "cannot activate by volume key, retry by passphrase" << device << ret;
+        ret = disk_encrypt_funcs::bcActivateDevice(device, passphrase, activeName);
+    }
+    if (ret != kSuccess) {
+        // the header is on the device already, the raw filesystem cannot be
+        // mounted any more. the data is encrypted offline then, the entry
+        // lets the device be opened on next boot.
+        qWarning() << "cannot activate device, encrypt it offline" << device << ret;
+        needsUnlock = true;
+        if (writeCrypttab(device, activeName, mountItem.mountPoint) != kSuccess)
+            qWarning() << "cannot add crypttab item for" << device;
+        setFstabTimeout();
+        return kSuccess;
+    }
+    onlineActiveName = activeName;
+
+    // the data is kept even if the mapping cannot be mounted again,
+    // so the reencryption keeps going and the user can mount it later.
+    ret = block_device_utils::bcMount("/dev/mapper/" + activeName, mountItem);
+    if (ret != kSuccess)
+        qWarning() << "cannot mount device back after activated" << device << mountItem.mountPoint;
+
+    if (writeCrypttab(device, activeName, mountItem.mountPoint) != kSuccess)
+        qWarning() << "cannot add crypttab item for" << device;
+    setFstabTimeout();
+    return kSuccess;
 }
 
 int PrencryptWorker::writeEncryptParams()
@@ -103,6 +171,8 @@ int PrencryptWorker::writeEncryptParams()
     obj.insert("key-size", "256");
     obj.insert("mode", encMode.value(params.value(encrypt_param_keys::kKeyEncMode).toInt()));
     obj.insert("device-name", params.value(encrypt_param_keys::kKeyDeviceName).toString());
+    if (params.value(encrypt_param_keys::kKeyDetachedHeader, false).toBool())
+        obj.insert("detached-header", block_device_utils::bcDetachedHeaderPath(dev));
 
     QString expPath = params.value(encrypt_param_keys::kKeyRecoveryExportPath).toString();
     if (!expPath.isEmpty()) {
@@ -132,6 +202,26 @@ int PrencryptWorker::writeEncryptParams()
     return -kSuccess;
 }
 
+bool PrencryptWorker::isDeferred(const QString &mountPoint) const
+{
+    if (deferred_unlock::isCriticalMountPoint(mountPoint))
+        return false;
+    // asked by the deferredUnlock config. besides, a tpm only device that is
+    // encrypted online is opened through crypttab, which cannot unseal the
+    // usec token at boot, so it's always left to the daemon after login.
+    bool online = params.value(encrypt_param_keys::kKeyOnlineMode, false).toBool()
+            && !params.value(encrypt_param_keys::kKeyInitParamsOnly, false).toBool();
+    if (!params.value(encrypt_param_keys::kKeyDeferredUnlock, false).toBool() && !(online && isTPMOnly()))
+        return false;
+    // the device is found after reboot by a name that survives renumbering.
+    return !block_device_utils::bcStableSpec(params.value(encrypt_param_keys::kKeyDevice).toString()).isEmpty();
+}
+
+bool PrencryptWorker::isTPMOnly() const
+{
+    return params.value(encrypt_param_keys::kKeyEncMode).toInt() == kTPMOnly;
+}
+
 int PrencryptWorker::setFstabTimeout()
 {
     static const QString kFstabPath { "/etc/fstab" };
@@ -142,22 +232,34 @@ int PrencryptWorker::setFstabTimeout()
     QByteArray fstabContents = fstab.readAll();
     fstab.close();
 
-    static const QByteArray kTimeoutParam = "x-systemd.device-timeout=0";
+    static const QString kTimeoutParam = "x-systemd.device-timeout=0";
     QString devDesc = params.value(encrypt_param_keys::kKeyDevice).toString();
     QString devUUID = QString("UUID=%1").arg(params.value(encrypt_param_keys::kKeyUUID).toString());
     QByteArrayList fstabLines = fstabContents.split('\n');
     QList<QStringList> fstabItems;
+    bool matched = false;
     bool foundItem = false;
     for (const QString &line : fstabLines) {
         QStringList items = line.split(QRegularExpression(R"(\t| )"), QString::SkipEmptyParts);
         if (items.count() == 6
             && (items[0] == devDesc || items[0] == devUUID)
-            && !foundItem) {
-
-            if (!items[3].contains(kTimeoutParam)) {
-                items[3] += ("," + kTimeoutParam);
-                foundItem = true;
+            && !matched) {
+            matched = true;
+
+            // data partitions are unlocked after login, boot does not wait for them.
+            QStringList options = items[3].split(',');
+            QStringList required { kTimeoutParam };
+            if (isDeferred(items[1]) && deferred_unlock::add(devDesc, items[0])) {
+                required = deferred_unlock::fstabOptions();
+                foundItem = options.removeAll(kTimeoutParam) > 0;
+            }
+            for (const auto &opt : required) {
+                if (!options.contains(opt)) {
+                    options.append(opt);
+                    foundItem = true;
+                }
             }
+            items[3] = options.join(',');
         }
         fstabItems.append(items);
     }
@@ -185,19 +287,80 @@ int PrencryptWorker::setFstabTimeout()
     return kSuccess;
 }
 
-ReencryptWorker::ReencryptWorker(const QString &dev,
+int PrencryptWorker::writeCrypttab(const QString &device, const QString &activeName, const QString &mountPoint)
+{
+    QString uuid;
+    int ret = disk_encrypt_funcs::bcGetUUID(device, &uuid);
+    if (ret != kSuccess)
+        return ret;
+
+    // there is no passphrase to type at boot for tpm only devices, they are
+    // unsealed and opened by daemon after login like deferred ones.
+    QString options = "luks";
+    if (isDeferred(mountPoint))
+        options += ",noauto,nofail";
+
+    // the LUKS uuid lives in the detached header only, the device is named
+    // by its partition uuid instead.
+    QString source = QString("UUID=%1").arg(uuid);
+    const QString &header = block_device_utils::bcDetachedHeader(device);
+    if (!header.isEmpty()) {
+        source = "PARTUUID=" + QFileInfo(header).completeBaseName();
+        options += ",header=" + header;
+    }
+
+    QFile crypttab("/etc/crypttab");
+    if (!crypttab.open(QIODevice::ReadWrite)) {
+        qWarning() << "cannot open crypttab for rw";
+        return -kErrorOpenFileFailed;
+    }
+
+    // an entry left by an earlier encryption of the same device is replaced.
+    const QStringList sources { source, QString("UUID=%1").arg(uuid), device };
+    QByteArrayList lines = crypttab.readAll().split('\n');
+    while (!lines.isEmpty() && lines.last().trimmed().isEmpty())
+        lines.removeLast();
+    for (int i = lines.count() - 1; i >= 0; --i) {
+        const QStringList &items = QString(lines.at(i)).split(QRegularExpression(R"(\t| )"), QString::SkipEmptyParts);
+        if (items.count() >= 2 && !items.first().startsWith('#')
+            && (items.at(0) == activeName || sources.contains(items.at(1)))) {
+            qInfo() << "crypttab item replaced:" << lines.at(i);
+            lines.removeAt(i);
+        }
+    }
+
+    QString item = QString("%1 %2 none %3").arg(activeName, source, options);
+    lines.append(item.toLocal8Bit());
+    crypttab.resize(0);
+    crypttab.write(lines.join('\n') + '\n');
+    crypttab.flush();
+    crypttab.close();
+    qInfo() << "crypttab item added:" << item;
+    return kSuccess;
+}
+
+ReencryptWorker::ReencryptWorker(const QString &jobID,
+                                 const QString &dev,
                                  const QString &passphrase,
+                                 const QString &activeName,
+                                 const VolumeKeyPtr &volumeKey,
                                  QObject *parent)
-    : Worker("", parent),
+    : Worker(jobID, parent),
       passphrase(passphrase),
-      device(dev)
+      device(dev),
+      activeName(activeName),
+      volumeKey(volumeKey)
 {
 }
 
 void ReencryptWorker::run()
 {
+    job_history::begin(jobID, "encrypt", device);
     int ret = disk_encrypt_funcs::bcResumeReencrypt(device,
-                                                    passphrase);
+                                                    passphrase,
+                                                    activeName,
+                                                    volumeKey);
+    job_history::finish(ret);
 
     Q_EMIT deviceReencryptResult(device, ret);
 }
@@ -220,7 +383,20 @@ void DecryptWorker::run()
 
     const QString &device = params.value(encrypt_param_keys::kKeyDevice).toString();
     const QString &passphrase = params.value(encrypt_param_keys::kKeyPassphrase).toString();
-    int ret = disk_encrypt_funcs::bcDecryptDevice(device, passphrase);
+    job_history::begin(jobID, "decrypt", device);
+    dfmbase::FinallyUtil recordJob([this] { job_history::finish(exitError()); });
+
+    // decrypt through the active mapping if the device is unlocked,
+    // the filesystem on it can stay mounted.
+    QString activeName;
+    if (params.value(encrypt_param_keys::kKeyOnlineMode, false).toBool())
+        activeName = block_device_utils::bcActiveName(device);
+
+    // an interrupted online decryption goes on with the shifting it started.
+    bool resume = !block_device_utils::bcInterruptedDecryptHeader(device).isEmpty();
+    int ret = (activeName.isEmpty() && !resume)
+            ? disk_encrypt_funcs::bcDecryptDevice(device, passphrase)
+            : disk_encrypt_funcs::bcDecryptDeviceOnline(device, passphrase, activeName);
     if (ret < 0) {
         setExitCode(ret);
         qDebug() << "decrypt devcei failed"
@@ -228,6 +404,44 @@ void DecryptWorker::run()
                  << ret;
         return;
     }
+
+    if (!activeName.isEmpty())
+        removeCrypttab({ activeName });
+    else if (resume)
+        removeCrypttab({ QString("dm-%1").arg(device.mid(5)) });
+}
+
+int Worker::removeCrypttab(const QStringList &names, const QStringList &sources)
+{
+    QFile crypttab("/etc/crypttab");
+    if (!crypttab.open(QIODevice::ReadOnly)) {
+        qWarning() << "cannot open crypttab for read";
+        return -kErrorOpenFileFailed;
+    }
+    QByteArrayList lines = crypttab.readAll().split('\n');
+    crypttab.close();
+
+    bool removed = false;
+    for (int i = lines.count() - 1; i >= 0; --i) {
+        QString line = lines.at(i);
+        auto items = line.split(QRegularExpression(R"( |\t)"), QString::SkipEmptyParts);
+        if (!line.startsWith("#") && !items.isEmpty()
+            && (names.contains(items.first()) || sources.contains(items.value(1)))) {
+            qInfo() << "crypttab item removed:" << line;
+            lines.removeAt(i);
+            removed = true;
+        }
+    }
+    if (!removed)
+        return kSuccess;
+
+    if (!crypttab.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "cannot open crypttab for update";
+        return -kErrorOpenFileFailed;
+    }
+    crypttab.write(lines.join('\n'));
+    crypttab.close();
+    return kSuccess;
 }
 
 int DecryptWorker::writeDecryptParams()
@@ -261,31 +475,243 @@ ChgPassWorker::ChgPassWorker(const QString &jobID, const QVariantMap &params, QO
 }
 
 void ChgPassWorker::run()
+{
+    setExitCode(changePassphrase(params));
+}
+
+int ChgPassWorker::changePassphrase(const QVariantMap &params)
 {
     QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
     QString oldPass = params.value(encrypt_param_keys::kKeyOldPassphrase).toString();
     QString newPass = params.value(encrypt_param_keys::kKeyPassphrase).toString();
 
     int newSlot = 0;
+    int retiredSlot = -1;
     int ret = 0;
-    if (params.value(encrypt_param_keys::kKeyValidateWithRecKey, false).toBool())
-        ret = disk_encrypt_funcs::bcChangePassphraseByRecKey(dev, oldPass, newPass, &newSlot);
+    bool byRecKey = params.value(encrypt_param_keys::kKeyValidateWithRecKey, false).toBool();
+    if (byRecKey)
+        ret = disk_encrypt_funcs::bcChangePassphraseByRecKey(dev, oldPass, newPass, &newSlot, &retiredSlot);
     else
         ret = disk_encrypt_funcs::bcChangePassphrase(dev, oldPass, newPass, &newSlot);
 
-    QString token = params.value(encrypt_param_keys::kKeyTPMToken).toString();
-    if (!token.isEmpty() && ret == 0) {
+    UsecToken token = UsecToken::fromVariant(params.value(encrypt_param_keys::kKeyTPMToken));
+    if (token.isTPM() && ret == 0) {
         // The value in keyslots represents the keyslot location where the passphrase is located
-        QJsonDocument doc = QJsonDocument::fromJson(token.toLocal8Bit());
-        QJsonObject obj = doc.object();
-        obj.insert("keyslots", QJsonArray::fromStringList({ QString::number(newSlot) }));
-        doc.setObject(obj);
-        token = doc.toJson(QJsonDocument::Compact);
-
+        token.keyslots = { newSlot };
         ret = disk_encrypt_funcs::bcSetToken(dev, token);
-        if (ret != 0)   // update token failed, need to rollback the change.
-            disk_encrypt_funcs::bcChangePassphrase(dev, newPass, oldPass, &newSlot);
+        if (ret != 0) {   // update token failed, need to rollback the change.
+            if (byRecKey)
+                disk_encrypt_funcs::bcDestroyKeyslot(dev, newSlot);
+            else
+                disk_encrypt_funcs::bcChangePassphrase(dev, newPass, oldPass, &newSlot);
+        }
     }
 
+    // the token points to the new slot now, the old passphrase is retired.
+    if (ret == 0 && retiredSlot >= 0)
+        disk_encrypt_funcs::bcDestroyKeyslot(dev, retiredSlot);
+
+    return ret;
+}
+
+ResealWorker::ResealWorker(const QString &jobID, const QVariantList &devices, QObject *parent)
+    : Worker(jobID, parent),
+      devices(devices)
+{
+}
+
+QVariantMap ResealWorker::results()
+{
+    QMutexLocker locker(&mtx);
+    return deviceResults;
+}
+
+void ResealWorker::run()
+{
+    // devices are independent, one failure does not stop the others.
+    int ret = kSuccess;
+    for (const auto &var : devices) {
+        const QVariantMap &params = var.toMap();
+        QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+        int err = ChgPassWorker::changePassphrase(params);
+        qInfo() << "tpm token resealed:" << dev << err;
+        if (ret == kSuccess)
+            ret = err;
+
+        QMutexLocker locker(&mtx);
+        deviceResults.insert(dev, err);
+    }
     setExitCode(ret);
 }
+
+CompactKeyslotsWorker::CompactKeyslotsWorker(const QString &jobID,
+                                             const QVariantMap &params,
+                                             QObject *parent)
+    : Worker(jobID, parent),
+      params(params)
+{
+}
+
+void CompactKeyslotsWorker::run()
+{
+    QString dev = params.value(encrypt_param_keys::kKeyDevice).toString();
+    QString pass = params.value(encrypt_param_keys::kKeyPassphrase).toString();
+    bool reportOnly = params.value(encrypt_param_keys::kKeyReportOnly, true).toBool();
+
+    int ret = disk_encrypt_funcs::bcCompactKeyslots(dev, pass, reportOnly, &keyslotsReport);
+    setExitCode(ret);
+}
+
+PreflightWorker::PreflightWorker(const QString &jobID,
+                                 const QVariantMap &params,
+                                 QObject *parent)
+    : Worker(jobID, parent),
+      params(params)
+{
+}
+
+void PreflightWorker::run()
+{
+    auto encParams = disk_encrypt_utils::bcConvertParams(params);
+    if (!disk_encrypt_utils::bcValidateParams(encParams)) {
+        setExitCode(-kErrorParamsInvalid);
+        qDebug() << "invalid params" << params;
+        return;
+    }
+
+    // results of a former run are outdated anyway.
+    preflight::drop(encParams.device);
+    int ret = preflight::run(encParams.device, encParams.cipher, cancelled, &preflightReport);
+    if (ret == kSuccess)
+        preflight::store(preflightReport);
+    setExitCode(ret);
+}
+
+CryptoEraseWorker::CryptoEraseWorker(const QString &jobID,
+                                     const QVariantMap &params,
+                                     QObject *parent)
+    : Worker(jobID, parent),
+      params(params)
+{
+}
+
+void CryptoEraseWorker::run()
+{
+    const QString &device = params.value(encrypt_param_keys::kKeyDevice).toString();
+    bool discard = params.value(encrypt_param_keys::kKeyDiscard, false).toBool();
+
+    // the names the device is known by at boot, the LUKS uuid and the
+    // detached header are gone with the erase.
+    QString uuid;
+    disk_encrypt_funcs::bcGetUUID(device, &uuid);
+    const QString &partUUID = block_device_utils::bcPartUUID(device);
+    const QString &deviceSpec = block_device_utils::bcStableSpec(device);
+
+    job_history::begin(jobID, "crypto-erase", device);
+    job_history::enterPhase("erase");
+    int ret = disk_encrypt_funcs::bcCryptoErase(device, discard);
+    job_history::finish(ret);
+
+    // a failed erase may leave the header readable, the cached token and
+    // secrets are still needed to unlock it then.
+    if (ret != kSuccess) {
+        setExitCode(ret);
+        return;
+    }
+    removeCachedSecrets(device);
+
+    // nothing is left to open or mount at boot.
+    QStringList names { QString("dm-%1").arg(device.mid(5)) };
+    QStringList sources { device };
+    if (!uuid.isEmpty()) {
+        names.append("luks-" + uuid);
+        sources.append("UUID=" + uuid);
+    }
+    if (!partUUID.isEmpty())
+        sources.append("PARTUUID=" + partUUID);
+    removeCrypttab(names, sources);
+
+    QStringList fstabSpecs { device };
+    for (const auto &name : names)
+        fstabSpecs.append("/dev/mapper/" + name);
+    const QString &fsUUID = params.value(encrypt_param_keys::kKeyUUID).toString();
+    if (!fsUUID.isEmpty())
+        fstabSpecs.append("UUID=" + fsUUID);
+    const QString &deferredSpec = deferred_unlock::remove(deviceSpec);
+    if (!deferredSpec.isEmpty())
+        fstabSpecs.append(deferredSpec);
+    disableFstabItems(fstabSpecs);
+    setExitCode(ret);
+}
+
+int CryptoEraseWorker::disableFstabItems(const QStringList &specs)
+{
+    // the entry is kept for user to edit, boot neither waits for it nor
+    // fails on it.
+    static const QString kFstabPath { "/etc/fstab" };
+    QFile fstab(kFstabPath);
+    if (!fstab.open(QIODevice::ReadOnly))
+        return -kErrorOpenFstabFailed;
+
+    QByteArray fstabContents = fstab.readAll();
+    fstab.close();
+
+    static const QString kTimeoutParam = "x-systemd.device-timeout=0";
+    QByteArrayList fstabLines = fstabContents.split('\n');
+    QList<QStringList> fstabItems;
+    bool changed = false;
+    for (const QString &line : fstabLines) {
+        QStringList items = line.split(QRegularExpression(R"(\t| )"), QString::SkipEmptyParts);
+        if (items.count() == 6 && !items[0].startsWith('#') && specs.contains(items[0])) {
+            QStringList options = items[3].split(',');
+            bool removed = options.removeAll(kTimeoutParam) > 0;
+            bool added = !options.contains("nofail");
+            if (added)
+                options.append("nofail");
+            if (removed || added) {
+                items[3] = options.join(',');
+                changed = true;
+                qInfo() << "fstab item is made nofail:" << line;
+            }
+        }
+        fstabItems.append(items);
+    }
+    if (!changed)
+        return kSuccess;
+
+    QByteArray newContents;
+    for (const auto &items : fstabItems) {
+        newContents += items.join('\t');
+        newContents.append('\n');
+    }
+    if (!fstab.open(QIODevice::Truncate | QIODevice::ReadWrite))
+        return -kErrorOpenFstabFailed;
+    fstab.write(newContents);
+    fstab.flush();
+    fstab.close();
+    return kSuccess;
+}
+
+void CryptoEraseWorker::removeCachedSecrets(const QString &device)
+{
+    const QString &devName = device.mid(5);
+    const QStringList caches {
+        "/tmp/dm_header_" + devName,   // bcBackupCryptHeader
+        QString("/tmp/%1_luks2_pre_enc").arg(devName),   // bcPrepareHeaderFile
+        block_device_utils::bcDecryptHeaderPath(device),   // online decryption
+        QString(TOKEN_FILE_PATH).arg(devName),
+    };
+    for (const auto &cache : caches) {
+        if (QFile::exists(cache) && QFile::remove(cache))
+            qInfo() << "cached secret is removed" << cache;
+    }
+
+    // a pending boot time job of the device.
+    QFile pending(QString("%1/encrypt.json").arg(kBootUsecPath));
+    if (pending.open(QIODevice::ReadOnly)) {
+        const QJsonObject &obj = QJsonDocument::fromJson(pending.readAll()).object();
+        pending.close();
+        if (obj.value("device-path").toString() == device)
+            pending.remove();
+    }
+}
@@ -5,10 +5,14 @@
 #define ENCRYPTWORKER_H
 
 #include "daemonplugin_file_encrypt_global.h"
+#include "diskencrypt.h"
+#include "preflight.h"
 
 #include <QThread>
 #include <QMutex>
 
+#include <atomic>
+
 FILE_ENCRYPT_BEGIN_NS
 #define TOKEN_FILE_PATH QString("/tmp/%1_tpm_token.json")
 
@@ -31,6 +35,8 @@ protected:
         QMutexLocker locker(&mtx);
         exitCode = code;
     }
+    // removes the items mapped to one of names or opening one of sources.
+    int removeCrypttab(const QStringList &names, const QStringList &sources = {});
 
 protected:
     int exitCode { disk_encrypt::kSuccess };
@@ -47,14 +53,26 @@ public:
                              QObject *parent);
     int cipherPos() const { return keyslotCipher; }
     int recKeyPos() const { return keyslotRecKey; }
+    QString activeName() const { return onlineActiveName; }
+    // the online device could not be opened again, it's encrypted offline
+    // and left for the user or next boot to unlock.
+    bool unlockRequired() const { return needsUnlock; }
+    VolumeKeyPtr volumeKey() const { return vk; }
 
 protected:
     void run() override;
     int writeEncryptParams();
     int setFstabTimeout();
+    int goOnline(const QString &device, const QString &passphrase, const MountItem &mountItem);
+    int writeCrypttab(const QString &device, const QString &activeName, const QString &mountPoint);
+    bool isDeferred(const QString &mountPoint) const;
+    bool isTPMOnly() const;
 
 private:
     QVariantMap params;
+    QString onlineActiveName;
+    bool needsUnlock { false };
+    VolumeKeyPtr vk;
     int keyslotCipher { -1 };
     int keyslotRecKey { -1 };
 };
@@ -63,8 +81,11 @@ class ReencryptWorker : public Worker
 {
     Q_OBJECT
 public:
-    explicit ReencryptWorker(const QString &dev,
+    explicit ReencryptWorker(const QString &jobID,
+                             const QString &dev,
                              const QString &passphrase,
+                             const QString &activeName = QString(),
+                             const VolumeKeyPtr &volumeKey = nullptr,
                              QObject *parent = nullptr);
 
 Q_SIGNALS:
@@ -79,6 +100,8 @@ protected:
 private:
     QString passphrase;
     QString device;
+    QString activeName;
+    VolumeKeyPtr volumeKey;
 };
 
 class DecryptWorker : public Worker
@@ -104,9 +127,86 @@ public:
     explicit ChgPassWorker(const QString &jobID,
                            const QVariantMap &params,
                            QObject *parent = nullptr);
+    static int changePassphrase(const QVariantMap &params);
+
+protected:
+    void run() override;
+
+private:
+    QVariantMap params;
+};
+
+class CompactKeyslotsWorker : public Worker
+{
+    Q_OBJECT
+public:
+    explicit CompactKeyslotsWorker(const QString &jobID,
+                                   const QVariantMap &params,
+                                   QObject *parent = nullptr);
+    QVariantMap report() const { return keyslotsReport; }
+
+protected:
+    void run() override;
+
+private:
+    QVariantMap params;
+    QVariantMap keyslotsReport;
+};
+
+// rebinds the tpm tokens of several devices in one job, each device
+// is processed as a passphrase changing.
+class ResealWorker : public Worker
+{
+    Q_OBJECT
+public:
+    explicit ResealWorker(const QString &jobID,
+                          const QVariantList &devices,
+                          QObject *parent = nullptr);
+    QVariantMap results();
+
+protected:
+    void run() override;
+
+private:
+    QVariantList devices;
+    QVariantMap deviceResults;
+};
+
+class PreflightWorker : public Worker
+{
+    Q_OBJECT
+public:
+    explicit PreflightWorker(const QString &jobID,
+                             const QVariantMap &params,
+                             QObject *parent = nullptr);
+    inline void cancel() { cancelled = true; }
+    // valid once the worker is finished.
+    QVariantMap report() const { return preflightReport.toVariantMap(); }
+
+protected:
+    void run() override;
+
+private:
+    QVariantMap params;
+    PreflightReport preflightReport;
+    std::atomic_bool cancelled { false };
+};
+
+// makes an encrypted device unrecoverable by destroying its header and
+// every cached copy of header or token. its crypttab and fstab entries are
+// dropped or made nofail so boot does not wait for it.
+class CryptoEraseWorker : public Worker
+{
+    Q_OBJECT
+public:
+    explicit CryptoEraseWorker(const QString &jobID,
+                               const QVariantMap &params,
+                               QObject *parent = nullptr);
 
 protected:
     void run() override;
+    void removeCachedSecrets(const QString &device);
+    int disableFstabItems(const QStringList &specs);
 
 private:
     QVariantMap params;
@@ -0,0 +1,175 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "pacing.h"
+#include "history/jobhistory.h"
+
+#include <QDir>
+#include <QFile>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QRegularExpression>
+#include <QDBusInterface>
+#include <QDBusConnection>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr char kPowerSupplyPath[] { "/sys/class/power_supply" };
+static constexpr char kThermalPath[] { "/sys/class/thermal" };
+static constexpr char kPressurePath[] { "/proc/pressure" };
+static constexpr qint64 kSampleInterval { 2000 };   // ms
+static constexpr qint64 kMaxPause { 1000 };   // ms
+// pressure thresholds of PSI some avg10, in percent.
+static constexpr double kModeratePressure { 10.0 };
+static constexpr double kHeavyPressure { 40.0 };
+
+namespace {
+struct PacingState
+{
+    bool active { false };
+    PacingLevel level { kPaceFull };
+    QElapsedTimer sampleClock;   // since the level was sampled
+    QElapsedTimer workClock;   // since the last pause ended
+};
+}   // namespace
+
+static thread_local PacingState gPacing;
+
+static QByteArray readSysFile(const QString &path)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+        return {};
+    return f.readAll().trimmed();
+}
+
+// no battery means a desktop, which is always on AC.
+static bool readOnAC()
+{
+    bool hasBattery = false;
+    const QStringList &supplies = QDir(kPowerSupplyPath).entryList(QDir::AllEntries | QDir::NoDotAndDotDot);
+    for (const auto &supply : supplies) {
+        const QString &base = QString("%1/%2/").arg(kPowerSupplyPath).arg(supply);
+        const QByteArray &type = readSysFile(base + "type");
+        if (type == "Mains" && readSysFile(base + "online") == "1")
+            return true;
+        if (type == "Battery" && readSysFile(base + "scope") != "Device")
+            hasBattery = true;
+    }
+    return !hasBattery;
+}
+
+// any zone above its first passive trip point, where the cpu is throttled.
+static bool readThermalThrottled()
+{
+    const QStringList &zones = QDir(kThermalPath).entryList({ "thermal_zone*" }, QDir::AllEntries);
+    for (const auto &zone : zones) {
+        const QString &base = QString("%1/%2/").arg(kThermalPath).arg(zone);
+        bool ok = false;
+        int temp = readSysFile(base + "temp").toInt(&ok);
+        if (!ok)
+            continue;
+        for (int i = 0; i < 16; ++i) {
+            const QByteArray &type = readSysFile(QString("%1trip_point_%2_type").arg(base).arg(i));
+            if (type.isEmpty())
+                break;
+            if (type != "passive")
+                continue;
+            int trip = readSysFile(QString("%1trip_point_%2_temp").arg(base).arg(i)).toInt(&ok);
+            if (ok && trip > 0 && temp >= trip)
+                return true;
+            break;
+        }
+    }
+    return false;
+}
+
+// "some avg10=1.23 avg60=..." of /proc/pressure/<resource>.
+static double readPressure(const QString &resource)
+{
+    static const QRegularExpression reg(R"(^some avg10=([\d.]+))", QRegularExpression::MultilineOption);
+    auto match = reg.match(readSysFile(QString("%1/%2").arg(kPressurePath).arg(resource)));
+    return match.hasMatch() ? match.captured(1).toDouble() : 0;
+}
+
+// logind knows whether anyone is using the seats.
+static bool readIdle()
+{
+    QDBusInterface login1("org.freedesktop.login1", "/org/freedesktop/login1",
+                          "org.freedesktop.login1.Manager", QDBusConnection::systemBus());
+    if (!login1.isValid())
+        return false;
+    return login1.property("IdleHint").toBool();
+}
+
+PacingSignals PacingSignals::sample()
+{
+    PacingSignals sig;
+    sig.onAC = readOnAC();
+    sig.idle = readIdle();
+    sig.thermalThrottled = readThermalThrottled();
+    sig.cpuPressure = readPressure("cpu");
+    sig.ioPressure = readPressure("io");
+    return sig;
+}
+
+PacingLevel PacingSignals::level() const
+{
+    double pressure = qMax(cpuPressure, ioPressure);
+    if (!onAC || thermalThrottled || pressure >= kHeavyPressure)
+        return kPaceGentle;
+    if (!idle || pressure >= kModeratePressure)
+        return kPaceModerate;
+    return kPaceFull;
+}
+
+QString reencrypt_pacing::levelName(PacingLevel level)
+{
+    switch (level) {
+    case kPaceFull:
+        return "full";
+    case kPaceModerate:
+        return "moderate";
+    case kPaceGentle:
+        return "gentle";
+    }
+    return "";
+}
+
+void reencrypt_pacing::begin()
+{
+    gPacing = PacingState();
+    gPacing.active = true;
+    gPacing.workClock.start();
+}
+
+void reencrypt_pacing::pace()
+{
+    if (!gPacing.active)
+        return;
+
+    if (!gPacing.sampleClock.isValid() || gPacing.sampleClock.elapsed() >= kSampleInterval) {
+        const PacingSignals &sig = PacingSignals::sample();
+        PacingLevel level = sig.level();
+        if (level != gPacing.level || !gPacing.sampleClock.isValid())
+            qInfo() << "reencryption pacing:" << levelName(level)
+                    << "ac" << sig.onAC << "idle" << sig.idle << "hot" << sig.thermalThrottled
+                    << "cpu" << sig.cpuPressure << "io" << sig.ioPressure;
+        gPacing.level = level;
+        gPacing.sampleClock.start();
+    }
+
+    // work : pause is 2 : 1 when moderate, 1 : 2 when gentle.
+    qint64 worked = gPacing.workClock.elapsed();
+    qint64 pause = 0;
+    if (gPacing.level == kPaceModerate)
+        pause = worked / 2;
+    else if (gPacing.level == kPaceGentle)
+        pause = worked * 2;
+    pause = qMin(pause, kMaxPause);
+
+    if (pause > 0)
+        QThread::msleep(static_cast<unsigned long>(pause));
+    job_history::addPacing(levelName(gPacing.level), worked, pause);
+    gPacing.workClock.start();
+}
@@ -0,0 +1,40 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PACING_H
+#define PACING_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+FILE_ENCRYPT_BEGIN_NS
+
+enum PacingLevel {
+    kPaceFull,   // on AC and idle, no pause
+    kPaceModerate,   // user is active or some pressure
+    kPaceGentle,   // on battery, hot or heavy pressure
+};
+
+struct PacingSignals
+{
+    bool onAC { true };
+    bool idle { false };
+    bool thermalThrottled { false };
+    double cpuPressure { 0 };   // PSI some avg10, percent
+    double ioPressure { 0 };
+
+    static PacingSignals sample();
+    PacingLevel level() const;
+};
+
+// slows reencryption down by pausing in the progress callback, which is
+// called once per hotzone. the pause is proportional to the time the last
+// hotzone took. state is kept per worker thread.
+namespace reencrypt_pacing {
+void begin();
+void pace();
+QString levelName(PacingLevel level);
+}   // namespace reencrypt_pacing
+
+FILE_ENCRYPT_END_NS
+
+#endif   // PACING_H
@@ -0,0 +1,506 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "preflight.h"
+#include "diskencrypt.h"
+#include "history/jobhistory.h"
+#include "device/blockdevicebackend.h"
+
+#include <QProcess>
+#include <QMutex>
+#include <QMap>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QtConcurrent>
+
+#include <libcryptsetup.h>
+#include <linux/fs.h>
+#include <linux/if_alg.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+FILE_ENCRYPT_USE_NS
+using namespace disk_encrypt;
+
+// a report older than this is not trusted by the committed job.
+static constexpr qint64 kReportLifetime { 10 * 60 * 1000 };
+static constexpr size_t kBenchmarkBuffer { 1024 * 1024 };
+
+// ext2/3/4 superblock
+static constexpr off_t kExtSuperblockOffset { 1024 };
+static constexpr int kExtSuperblockSize { 1024 };
+static constexpr quint16 kExtMagic { 0xEF53 };
+static constexpr quint32 kExtIncompat64Bit { 0x80 };
+
+// throughput of the recent jobs on the same disk model is used to estimate.
+static constexpr int kEstimateSamples { 5 };
+
+static QMutex gReportsMtx;
+static QMap<QString, PreflightReport> gReports;
+
+static quint32 readLE32(const QByteArray &buf, int offset)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(buf.constData()) + offset;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<quint32>(p[3]) << 24);
+}
+
+static quint16 readLE16(const QByteArray &buf, int offset)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(buf.constData()) + offset;
+    return static_cast<quint16>(p[0] | (p[1] << 8));
+}
+
+static QByteArray readExtSuperblock(const QString &device)
+{
+    int fd = open(device.toStdString().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return {};
+
+    QByteArray sb(kExtSuperblockSize, 0);
+    ssize_t len = pread(fd, sb.data(), kExtSuperblockSize, kExtSuperblockOffset);
+    close(fd);
+    if (len != kExtSuperblockSize || readLE16(sb, 56) != kExtMagic)
+        return {};
+    return sb;
+}
+
+// the program is killed as soon as the preflight is cancelled.
+static int runCancellable(const QString &program, const QStringList &args,
+                          const std::atomic_bool &cancelled, QByteArray *output = nullptr)
+{
+    QProcess proc;
+    proc.start(program, args);
+    if (!proc.waitForStarted()) {
+        qWarning() << "cannot start" << program << proc.errorString();
+        return -1;
+    }
+    while (!proc.waitForFinished(100)) {
+        if (proc.state() == QProcess::NotRunning)
+            break;
+        if (cancelled) {
+            proc.kill();
+            proc.waitForFinished();
+            return -ECANCELED;
+        }
+    }
+    if (output)
+        *output = proc.readAllStandardOutput();
+    return proc.exitStatus() == QProcess::NormalExit ? proc.exitCode() : -1;
+}
+
+static quint64 freeSpaceOf(const QString &path)
+{
+    struct statvfs st;
+    if (statvfs(path.toStdString().c_str(), &st) != 0)
+        return 0;
+    return static_cast<quint64>(st.f_bavail) * st.f_frsize;
+}
+
+static PreflightCheck checkBlockDevice(const EncryptParams &params)
+{
+    PreflightCheck result { "block-device" };
+    struct stat blkStat;
+    if (params.device.isEmpty() || stat(params.device.toStdString().c_str(), &blkStat) != 0) {
+        result.error = -kErrorParamsInvalid;
+        result.detail = params.device.isEmpty() ? "no device" : strerror(errno);
+    } else if (!S_ISBLK(blkStat.st_mode)) {
+        result.error = -kErrorParamsInvalid;
+        result.detail = "not a block device";
+    }
+    return result;
+}
+
+bool preflight::isBlockDevice(const QString &device)
+{
+    EncryptParams params;
+    params.device = device;
+    return checkBlockDevice(params).error == kSuccess;
+}
+
+static PreflightCheck checkEncryptStatus(const EncryptParams &params)
+{
+    PreflightCheck result { "encrypt-status" };
+    auto status = block_device_utils::bcDevStatus(params.device);
+    if (status != kNotEncrypted) {
+        result.error = -kErrorDeviceEncrypted;
+        result.detail = QString::number(status);
+    }
+    return result;
+}
+
+static PreflightCheck checkMount(const EncryptParams &params, bool online, bool atBoot)
+{
+    PreflightCheck result { "mount" };
+    // encrypted during next boot, before it is mounted.
+    if (atBoot || !block_device_utils::bcIsMounted(params.device))
+        return result;
+
+    // only a partition mounted once can be encrypted online.
+    MountItem item;
+    if (!online || !block_device_utils::bcMountItem(params.device, &item)) {
+        result.error = -kErrorDeviceMounted;
+        result.detail = online ? "mounted more than once" : "mounted";
+        return result;
+    }
+    result.detail = item.mountPoint;
+    return result;
+}
+
+static PreflightCheck checkFileSystem(const EncryptParams &params, quint64 headerSize)
+{
+    PreflightCheck result { "filesystem" };
+    // the filesystem is left as it is with a detached header.
+    if (params.detachedHeader) {
+        result.detail = "detached header";
+        return result;
+    }
+    const QByteArray sb = readExtSuperblock(params.device);
+    if (sb.isEmpty()) {
+        // the filesystem cannot be shrunk, the header overwrites its head.
+        BlockDeviceInfo info;
+        BlockDeviceBackend::instance()->probe(params.device, &info);
+        const QString &fsType = info.idType;
+        if (!fsType.isEmpty()) {
+            result.error = -kErrorResizeFs;
+            result.detail = "cannot shrink " + fsType;
+        }
+        return result;
+    }
+
+    // the counters in superblock are updated lazily by a mounted fs, but
+    // they are fine for an estimation.
+    quint64 blockSize = 1024ULL << readLE32(sb, 24);
+    quint64 freeBlocks = readLE32(sb, 12);
+    if (readLE32(sb, 96) & kExtIncompat64Bit)
+        freeBlocks |= static_cast<quint64>(readLE32(sb, 344)) << 32;
+    quint64 freeSize = freeBlocks * blockSize;
+    result.detail = QString("free %1 bytes").arg(freeSize);
+    if (freeSize < headerSize)
+        result.error = -kErrorResizeFs;
+    return result;
+}
+
+static PreflightCheck checkCipher(const EncryptParams &params)
+{
+    PreflightCheck result { "cipher" };
+    QString cipher, mode;
+    int keyLen = 0;
+    disk_encrypt_utils::bcParseCipher(params.cipher, &cipher, &mode, &keyLen);
+
+    // binding the kernel crypto api loads the module on demand, without
+    // doing any encryption.
+    const QByteArray &algName = QString("%1(%2)").arg(mode.section('-', 0, 0)).arg(cipher).toLatin1();
+    struct sockaddr_alg sa {};
+    sa.salg_family = AF_ALG;
+    strncpy(reinterpret_cast<char *>(sa.salg_type), "skcipher", sizeof(sa.salg_type) - 1);
+    strncpy(reinterpret_cast<char *>(sa.salg_name), algName.constData(), sizeof(sa.salg_name) - 1);
+
+    int fd = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        // no user api of kernel crypto, leave it to the benchmark.
+        result.detail = "unknown";
+        return result;
+    }
+    // the kernel may refuse the user api of an algorithm that dm-crypt can
+    // use, e.g. when af_alg is restricted, it's not a reason to refuse.
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&sa), sizeof(sa)) != 0) {
+        qWarning() << "cannot bind" << algName << "by AF_ALG:" << strerror(errno);
+        result.detail = QString("%1 is not available by AF_ALG").arg(QString(algName));
+    }
+    close(fd);
+    return result;
+}
+
+static PreflightCheck checkHeaderSpace(const EncryptParams &params, quint64 headerSize)
+{
+    // the header is prepared in /tmp, see bcPrepareHeaderFile, or in /boot
+    // if it's detached.
+    PreflightCheck result { "header-space" };
+    if (params.detachedHeader) {
+        const QString &headerPath = block_device_utils::bcDetachedHeaderPath(params.device);
+        if (headerPath.isEmpty()) {
+            result.error = -kErrorCreateHeader;
+            result.detail = "no partuuid to key the detached header";
+            return result;
+        }
+        if (QFile::exists(headerPath)) {
+            result.error = -kErrorOpenFileFailed;
+            result.detail = headerPath + " exists";
+            return result;
+        }
+        quint64 freeSize = freeSpaceOf("/boot");
+        result.detail = QString("free %1 bytes in /boot").arg(freeSize);
+        if (freeSize < headerSize)
+            result.error = -kErrorCreateHeader;
+        return result;
+    }
+
+    // a stale file is replaced by the job, its space is counted as free.
+    QString localPath = QString("/tmp/%1_luks2_pre_enc").arg(params.device.mid(5));
+    quint64 freeSize = freeSpaceOf("/tmp");
+    if (QFile::exists(localPath))
+        freeSize += static_cast<quint64>(QFileInfo(localPath).size());
+    result.detail = QString("free %1 bytes").arg(freeSize);
+    if (freeSize < headerSize)
+        result.error = -kErrorCreateHeader;
+    return result;
+}
+
+static PreflightCheck checkRecoveryPath(const EncryptParams &params)
+{
+    PreflightCheck result { "recovery-path" };
+    if (params.recoveryPath.isEmpty())
+        return result;
+    if (access(params.recoveryPath.toStdString().c_str(), W_OK) != 0) {
+        result.error = -kErrorParamsInvalid;
+        result.detail = strerror(errno);
+    } else if (freeSpaceOf(params.recoveryPath) == 0) {
+        result.error = -kErrorOpenFileFailed;
+        result.detail = "no space left";
+    }
+    return result;
+}
+
+static PreflightCheck checkToken(const EncryptParams &params)
+{
+    PreflightCheck result { "tpm-token" };
+    // keyslots are bound after the header is formatted.
+    const UsecToken &token = params.tpmToken;
+    if (token.isTPM()
+        && (token.kekPriv.isEmpty() || token.kekPub.isEmpty() || token.iv.isEmpty()
+            || token.enc.isEmpty() || token.pcr.isEmpty() || token.pcrBank.isEmpty())) {
+        result.error = -kErrorParamsInvalid;
+        result.detail = "token is incomplete";
+    }
+    return result;
+}
+
+static QVariantMap estimateCost(const QString &device, quint64 deviceSize, quint64 headerSize)
+{
+    QVariantMap estimate {
+        { "deviceSize", deviceSize },
+        { "headerSize", headerSize },
+    };
+
+    const QString &model = job_history::modelOf(device);
+    const QVariantList &records = job_history::query({ { "type", "encrypt" } });
+    double sum = 0;
+    int samples = 0;
+    for (auto iter = records.crbegin(); iter != records.crend() && samples < kEstimateSamples; ++iter) {
+        const QVariantMap &record = iter->toMap();
+        double throughput = record.value("avgThroughput").toDouble();
+        if (record.value("result").toInt() != kSuccess || throughput <= 0
+            || record.value("model").toString() != model)
+            continue;
+        sum += throughput;
+        ++samples;
+    }
+    if (samples > 0) {
+        double throughput = sum / samples;
+        estimate.insert("throughput", throughput);
+        estimate.insert("seconds", static_cast<qint64>(deviceSize / (1024.0 * 1024.0) / throughput));
+        estimate.insert("samples", samples);
+    }
+    return estimate;
+}
+
+QVariantMap PreflightCheck::toVariantMap() const
+{
+    return {
+        { "name", name },
+        { "error", error },
+        { "detail", detail },
+    };
+}
+
+QVariantMap PreflightReport::toVariantMap() const
+{
+    return {
+        { "device", device },
+        { "cipher", cipher },
+        { "fsChecked", fsChecked },
+        { "deviceSize", deviceSize },
+        { "minFsSize", minFsSize },
+        { "headerSize", headerSize },
+        { "hasRoom", hasRoom() },
+        { "cipherError", cipherError },
+        { "encryptSpeed", encryptSpeed },
+        { "decryptSpeed", decryptSpeed },
+    };
+}
+
+QByteArray preflight::fsStamp(const QString &device)
+{
+    QByteArray sb = readExtSuperblock(device);
+    if (sb.isEmpty())
+        return {};
+    // mount/write time, mount count, state, last check and kbytes written
+    // are all updated once the filesystem is mounted or repaired.
+    return sb.mid(44, 24) + sb.mid(376, 8);
+}
+
+int preflight::run(const QString &device, const QString &cipher,
+                   const std::atomic_bool &cancelled, PreflightReport *report)
+{
+    Q_ASSERT(report);
+    report->device = device;
+    report->cipher = cipher;
+    report->deviceSize = block_device_utils::bcDeviceSize(device);
+    report->headerSize = disk_encrypt_utils::bcHeaderSize(cipher);
+
+    // the filesystem is checked only when it's not mounted, the results of
+    // a mounted one are stale as soon as they are read.
+    const QByteArray sb = readExtSuperblock(device);
+    bool checkFs = !sb.isEmpty() && !block_device_utils::bcIsMounted(device);
+    if (checkFs) {
+        report->fsStamp = fsStamp(device);
+
+        // read only, this pulls all the metadata into the page cache as well.
+        int ret = runCancellable("e2fsck", { "-n", "-f", device }, cancelled);
+        if (ret == -ECANCELED)
+            return -kUserCancelled;
+        report->fsChecked = (ret == 0);
+        qInfo() << "preflight: fs checked" << device << ret;
+
+        QByteArray output;
+        ret = runCancellable("resize2fs", { "-P", device }, cancelled, &output);
+        if (ret == -ECANCELED)
+            return -kUserCancelled;
+        auto match = QRegularExpression(R"(:\s*(\d+)\s*$)").match(QString(output).trimmed());
+        if (ret == 0 && match.hasMatch()) {
+            quint64 blockSize = 1024ULL << readLE32(sb, 24);
+            report->minFsSize = match.captured(1).toULongLong() * blockSize;
+        }
+    }
+    if (cancelled)
+        return -kUserCancelled;
+
+    QString cipherName, mode;
+    int keyLen = 0;
+    disk_encrypt_utils::bcParseCipher(cipher, &cipherName, &mode, &keyLen);
+    report->cipherError = crypt_benchmark(nullptr,
+                                          cipherName.toStdString().c_str(),
+                                          mode.toStdString().c_str(),
+                                          keyLen / 8, 16, kBenchmarkBuffer,
+                                          &report->encryptSpeed,
+                                          &report->decryptSpeed);
+    if (cancelled)
+        return -kUserCancelled;
+
+    // the head of the device is the first segment to be moved.
+    int fd = open(device.toStdString().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, static_cast<off_t>(report->headerSize), POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+
+    report->finishedAt = QDateTime::currentMSecsSinceEpoch();
+    qInfo() << "preflight finished:" << report->toVariantMap();
+    return kSuccess;
+}
+
+QVariantMap preflight::check(const QVariantMap &params)
+{
+    const EncryptParams encParams = disk_encrypt_utils::bcConvertParams(params);
+    bool online = params.value(encrypt_param_keys::kKeyOnlineMode, false).toBool();
+    bool atBoot = params.value(encrypt_param_keys::kKeyInitParamsOnly, false).toBool();
+    quint64 headerSize = disk_encrypt_utils::bcHeaderSize(encParams.cipher);
+
+    // nothing is probed for a path that is not a block device, the checks
+    // run as root and would tell about any file of the system.
+    const PreflightCheck &blockCheck = checkBlockDevice(encParams);
+    if (blockCheck.error != kSuccess) {
+        qWarning() << "encrypt preflight: not a block device" << encParams.device;
+        return { { "device", encParams.device },
+                 { "error", blockCheck.error },
+                 { "checks", QVariantList { blockCheck.toVariantMap() } } };
+    }
+
+    QList<QFuture<PreflightCheck>> futures;
+    if (encParams.passphrase.isEmpty() || encParams.cipher.isEmpty()) {
+        futures.append(QtConcurrent::run([] { return PreflightCheck { "params", -kErrorParamsInvalid, "incomplete" }; }));
+    } else {
+        futures.append(QtConcurrent::run([blockCheck] { return blockCheck; }));
+        futures.append(QtConcurrent::run(checkEncryptStatus, encParams));
+        futures.append(QtConcurrent::run(checkMount, encParams, online, atBoot));
+        futures.append(QtConcurrent::run(checkFileSystem, encParams, headerSize));
+        futures.append(QtConcurrent::run(checkCipher, encParams));
+        futures.append(QtConcurrent::run(checkHeaderSpace, encParams, headerSize));
+        futures.append(QtConcurrent::run(checkRecoveryPath, encParams));
+        futures.append(QtConcurrent::run(checkToken, encParams));
+    }
+    auto estimate = QtConcurrent::run(estimateCost, encParams.device,
+                                      block_device_utils::bcDeviceSize(encParams.device), headerSize);
+
+    // the first failed check is reported as the error of the whole.
+    int error = kSuccess;
+    QVariantList checks;
+    for (auto &future : futures) {
+        const PreflightCheck &result = future.result();
+        if (error == kSuccess)
+            error = result.error;
+        checks.append(result.toVariantMap());
+    }
+
+    QVariantMap report {
+        { "device", encParams.device },
+        { "error", error },
+        { "checks", checks },
+        { "estimate", estimate.result() },
+    };
+    qInfo() << "encrypt preflight:" << report;
+    return report;
+}
+
+void preflight::store(const PreflightReport &report)
+{
+    QMutexLocker locker(&gReportsMtx);
+    gReports.insert(report.device, report);
+}
+
+void preflight::drop(const QString &device)
+{
+    QMutexLocker locker(&gReportsMtx);
+    gReports.remove(device);
+}
+
+bool preflight::has(const QString &device)
+{
+    QMutexLocker locker(&gReportsMtx);
+    auto iter = gReports.constFind(device);
+    return iter != gReports.constEnd()
+            && QDateTime::currentMSecsSinceEpoch() - iter->finishedAt <= kReportLifetime;
+}
+
+bool preflight::take(const QString &device, PreflightReport *report)
+{
+    Q_ASSERT(report);
+    {
+        QMutexLocker locker(&gReportsMtx);
+        if (!gReports.contains(device))
+            return false;
+        *report = gReports.take(device);
+    }
+
+    if (QDateTime::currentMSecsSinceEpoch() - report->finishedAt > kReportLifetime) {
+        qInfo() << "preflight report is outdated" << device;
+        return false;
+    }
+
+    // results about the filesystem hold only if it's untouched since checked.
+    if (!report->fsStamp.isEmpty()
+        && (block_device_utils::bcIsMounted(device) || fsStamp(device) != report->fsStamp)) {
+        qInfo() << "filesystem changed after preflight" << device;
+        report->fsChecked = false;
+        report->minFsSize = 0;
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QVariantMap>
+
+#include <atomic>
+
+FILE_ENCRYPT_BEGIN_NS
+
+/*!
+ * \brief The PreflightReport struct
+ * results of the read-only checks done while the user is still filling the
+ * encrypt dialog. the committed job takes it if the filesystem has not been
+ * touched since, and skips the checks it has already passed.
+ */
+struct PreflightReport
+{
+    QString device;
+    QString cipher;
+    bool fsChecked { false };   // e2fsck -n found no problem
+    quint64 deviceSize { 0 };   // bytes
+    quint64 minFsSize { 0 };   // bytes, 0 if unknown
+    quint64 headerSize { 0 };   // bytes
+    int cipherError { 0 };   // error of benchmarking the cipher, for information only
+    double encryptSpeed { 0 };   // MiB/s
+    double decryptSpeed { 0 };   // MiB/s
+    QByteArray fsStamp;   // ext superblock fields that change on mount/write
+    qint64 finishedAt { 0 };
+
+    inline bool hasRoom() const
+    {
+        return minFsSize == 0 || minFsSize + headerSize <= deviceSize;
+    }
+    QVariantMap toVariantMap() const;
+};
+
+/*!
+ * \brief The PreflightCheck struct
+ * result of one of the cheap checks done before an encrypt job is queued,
+ * error is a negative EncryptOperationStatus or kSuccess.
+ */
+struct PreflightCheck
+{
+    QString name;
+    int error { 0 };
+    QString detail;
+
+    QVariantMap toVariantMap() const;
+};
+
+namespace preflight {
+int run(const QString &device, const QString &cipher,
+        const std::atomic_bool &cancelled, PreflightReport *report);
+void store(const PreflightReport &report);
+void drop(const QString &device);
+bool take(const QString &device, PreflightReport *report);
+// a report of the device is waiting for the job.
+bool has(const QString &device);
+QByteArray fsStamp(const QString &device);
+bool isBlockDevice(const QString &device);
+// runs all the cheap checks concurrently, nothing is written and no
+// external program is run.
+QVariantMap check(const QVariantMap &params);
+}   // namespace preflight
+
+FILE_ENCRYPT_END_NS
+
+#endif   // PREFLIGHT_H
@@ -0,0 +1,152 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "recoverykey.h"
+
+#include <QtConcurrent>
+
+#include <sys/random.h>
+#include <string.h>
+#include <errno.h>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr size_t kRecoveryKeySize { 24 };
+static constexpr int kPoolSize { 4 };
+
+RecoveryKeyGenerator *RecoveryKeyGenerator::instance()
+{
+    static RecoveryKeyGenerator ins;
+    return &ins;
+}
+
+RecoveryKeyGenerator::RecoveryKeyGenerator()
+    : lib("usec-recoverykey")
+{
+    if (lib.load())
+        fnGenKey = reinterpret_cast<FnGenKey>(lib.resolve("usec_get_recovery_key"));
+    if (!fnGenKey)
+        qWarning() << "libusec-recoverykey is not available, generate recovery key in process."
+                   << lib.errorString();
+
+    // one slot more for the terminating zero.
+    pool = VolumeKey::allocate(kPoolSize * (kRecoveryKeySize + 1));
+    if (!pool)
+        qWarning() << "cannot allocate pool for recovery keys";
+}
+
+RecoveryKeyGenerator::~RecoveryKeyGenerator()
+{
+    if (lib.isLoaded())
+        lib.unload();
+}
+
+QString RecoveryKeyGenerator::take()
+{
+    const QStringList &keys = take(1);
+    return keys.isEmpty() ? QString() : keys.first();
+}
+
+QStringList RecoveryKeyGenerator::take(int count)
+{
+    QStringList keys;
+    {
+        QMutexLocker locker(&poolMtx);
+        while (pooled > 0 && keys.count() < count) {
+            --pooled;
+            char *key = pool->data() + pooled * (kRecoveryKeySize + 1);
+            keys.append(QString::fromLatin1(key));
+            explicit_bzero(key, kRecoveryKeySize + 1);
+        }
+    }
+
+    char key[kRecoveryKeySize + 1];
+    while (keys.count() < count) {
+        if (!generate(key))
+            break;
+        keys.append(QString::fromLatin1(key));
+    }
+    explicit_bzero(key, sizeof(key));
+
+    refill();
+    if (keys.count() < count) {
+        qCritical() << "cannot generate recovery keys," << keys.count() << "of" << count;
+        return {};
+    }
+    return keys;
+}
+
+void RecoveryKeyGenerator::refill()
+{
+    {
+        QMutexLocker locker(&poolMtx);
+        if (!pool || refilling || pooled >= kPoolSize)
+            return;
+        refilling = true;
+    }
+
+    QtConcurrent::run([this] {
+        char key[kRecoveryKeySize + 1];
+        QMutexLocker locker(&poolMtx);
+        while (pooled < kPoolSize) {
+            // keys may be taken meanwhile.
+            locker.unlock();
+            bool ok = generate(key);
+            locker.relock();
+            if (!ok)
+                break;
+            if (pooled < kPoolSize) {
+                memcpy(pool->data() + pooled * (kRecoveryKeySize + 1), key, sizeof(key));
+                ++pooled;
+            }
+        }
+        refilling = false;
+        locker.unlock();
+        explicit_bzero(key, sizeof(key));
+    });
+}
+
+bool RecoveryKeyGenerator::generate(char *key)
+{
+    return generateByLibrary(key) || generateInProcess(key);
+}
+
+bool RecoveryKeyGenerator::generateByLibrary(char *key)
+{
+    if (!fnGenKey)
+        return false;
+
+    QMutexLocker locker(&genMtx);
+    int ret = fnGenKey(key, kRecoveryKeySize, 1);
+    key[kRecoveryKeySize] = '\0';
+    if (ret != 0 || strlen(key) != kRecoveryKeySize) {
+        qWarning() << "libusec-recoverykey generate failed." << ret;
+        return false;
+    }
+    return true;
+}
+
+bool RecoveryKeyGenerator::generateInProcess(char *key)
+{
+    // digits only, they are easy to type in when unlocking.
+    // bytes over 249 are dropped so that each digit is uniform.
+    size_t filled = 0;
+    unsigned char buf[kRecoveryKeySize];
+    while (filled < kRecoveryKeySize) {
+        ssize_t n = getrandom(buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            qWarning() << "cannot generate recovery key:" << strerror(errno);
+            explicit_bzero(buf, sizeof(buf));
+            return false;
+        }
+        for (ssize_t i = 0; i < n && filled < kRecoveryKeySize; ++i) {
+            if (buf[i] < 250)
+                key[filled++] = static_cast<char>('0' + buf[i] % 10);
+        }
+    }
+    key[kRecoveryKeySize] = '\0';
+    explicit_bzero(buf, sizeof(buf));
+    return true;
+}
@@ -0,0 +1,57 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef RECOVERYKEY_H
+#define RECOVERYKEY_H
+
+#include "daemonplugin_file_encrypt_global.h"
+#include "volumekey.h"
+
+#include <QLibrary>
+#include <QMutex>
+#include <QStringList>
+
+FILE_ENCRYPT_BEGIN_NS
+
+/*!
+ * \brief The RecoveryKeyGenerator class
+ * generates recovery keys. libusec-recoverykey is loaded once for the
+ * lifetime of the daemon, and a few keys are generated ahead into locked
+ * memory so encrypt jobs do not wait for it. keys are generated in process
+ * when the library is not available.
+ */
+class RecoveryKeyGenerator
+{
+    Q_DISABLE_COPY(RecoveryKeyGenerator)
+public:
+    static RecoveryKeyGenerator *instance();
+
+    // empty if no key can be generated.
+    QString take();
+    QStringList take(int count);
+    // fills the pool in background.
+    void refill();
+
+private:
+    RecoveryKeyGenerator();
+    ~RecoveryKeyGenerator();
+    bool generate(char *key);
+    bool generateByLibrary(char *key);
+    bool generateInProcess(char *key);
+
+private:
+    typedef int (*FnGenKey)(char *, const size_t, const size_t);
+
+    QLibrary lib;
+    FnGenKey fnGenKey { nullptr };
+    QMutex genMtx;   // the library is not known to be reentrant
+
+    QMutex poolMtx;
+    VolumeKeyPtr pool;
+    int pooled { 0 };
+    bool refilling { false };
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // RECOVERYKEY_H
@@ -0,0 +1,117 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "tpmlockout.h"
+
+#include <QProcess>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QRegularExpression>
+#include <QDebug>
+
+FILE_ENCRYPT_USE_NS
+using namespace disk_encrypt;
+
+namespace {
+struct Counters
+{
+    bool inLockout { false };
+    int failedTries { 0 };
+    int maxTries { 0 };
+    int interval { 0 };   // one failure is forgotten after each interval
+};
+}
+
+// the TPM does not tell when the counter is decreased next, it is measured
+// from the last time the counter is seen changed.
+static QMutex gCounterMtx;
+static QElapsedTimer gCounterClock;
+static int gLastCounter { -1 };
+
+static bool readCounters(Counters *counters)
+{
+    // tpm2-tools 4.0 and later take the capability as argument, the older
+    // ones take it by -c.
+    QByteArray output;
+    for (const QStringList &args : { QStringList { "properties-variable" },
+                                     QStringList { "-c", "properties-variable" } }) {
+        QProcess proc;
+        proc.start("tpm2_getcap", args);
+        if (!proc.waitForFinished(3000)) {
+            proc.kill();
+            proc.waitForFinished();
+            continue;
+        }
+        if (proc.exitStatus() == QProcess::NormalExit && proc.exitCode() == 0) {
+            output = proc.readAllStandardOutput();
+            break;
+        }
+    }
+    if (output.isEmpty())
+        return false;
+
+    // TPM2_PT_LOCKOUT_COUNTER: 0x0
+    //   inLockout:                 0
+    QRegularExpression re(R"(^\s*(\w+):\s*(\S+)\s*$)", QRegularExpression::MultilineOption);
+    bool hasCounter = false;
+    auto iter = re.globalMatch(QString(output));
+    while (iter.hasNext()) {
+        auto match = iter.next();
+        const QString &key = match.captured(1);
+        const QString &val = match.captured(2);
+        bool ok = false;
+        int num = val.toInt(&ok, 0);
+        if (key == "inLockout")
+            counters->inLockout = ok ? (num != 0) : (val == "set");
+        else if (!ok)
+            continue;
+        else if (key.endsWith("PT_LOCKOUT_COUNTER")) {
+            counters->failedTries = num;
+            hasCounter = true;
+        } else if (key.endsWith("PT_MAX_AUTH_FAIL"))
+            counters->maxTries = num;
+        else if (key.endsWith("PT_LOCKOUT_INTERVAL"))
+            counters->interval = num;
+    }
+    return hasCounter;
+}
+
+static int recoverySeconds(const Counters &counters)
+{
+    bool locked = counters.inLockout
+            || (counters.maxTries > 0 && counters.failedTries >= counters.maxTries);
+
+    QMutexLocker locker(&gCounterMtx);
+    if (counters.failedTries != gLastCounter) {
+        gLastCounter = counters.failedTries;
+        gCounterClock.start();
+    }
+    if (!locked || counters.interval <= 0)
+        return 0;
+
+    // the counter has to drop below the max, the first interval is partly
+    // gone already. the whole one is assumed if it has not been seen changed.
+    int intervals = qMax(1, counters.failedTries - counters.maxTries + 1);
+    qint64 passed = gCounterClock.elapsed() / 1000;
+    return static_cast<int>((intervals - 1) * counters.interval
+                            + qMax<qint64>(0, counters.interval - passed));
+}
+
+QVariantMap tpm_lockout::query()
+{
+    Counters counters;
+    bool valid = readCounters(&counters);
+    if (!valid)
+        return { { tpm_lockout_keys::kKeyValid, false } };
+
+    int secs = recoverySeconds(counters);
+    qInfo() << "TPM lockout counter:" << counters.failedTries << "/" << counters.maxTries
+            << "in lockout:" << counters.inLockout << "recovers in:" << secs;
+    return {
+        { tpm_lockout_keys::kKeyValid, true },
+        { tpm_lockout_keys::kKeyInLockout, counters.inLockout },
+        { tpm_lockout_keys::kKeyFailedTries, counters.failedTries },
+        { tpm_lockout_keys::kKeyMaxTries, counters.maxTries },
+        { tpm_lockout_keys::kKeyRecoverySeconds, secs }
+    };
+}
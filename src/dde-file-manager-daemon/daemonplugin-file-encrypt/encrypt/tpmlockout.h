@@ -0,0 +1,23 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef TPMLOCKOUT_H
+#define TPMLOCKOUT_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QVariantMap>
+
+FILE_ENCRYPT_BEGIN_NS
+
+// dictionary attack state of the TPM. the counters are read by tpm2-tools
+// which need the resource manager, only the daemon can access it.
+namespace tpm_lockout {
+// keys in tpm_lockout_keys. recoverySeconds is the time left until the
+// TPM accepts an authorization again, 0 if it is not locked.
+QVariantMap query();
+}   // namespace tpm_lockout
+
+FILE_ENCRYPT_END_NS
+
+#endif   // TPMLOCKOUT_H
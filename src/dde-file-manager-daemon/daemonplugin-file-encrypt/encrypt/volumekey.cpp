@@ -0,0 +1,68 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "volumekey.h"
+
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <string.h>
+#include <errno.h>
+
+FILE_ENCRYPT_USE_NS
+
+VolumeKeyPtr VolumeKey::allocate(size_t size)
+{
+    VolumeKeyPtr key(new VolumeKey(size));
+    return key->isValid() ? key : nullptr;
+}
+
+VolumeKeyPtr VolumeKey::generate(size_t size)
+{
+    VolumeKeyPtr key = allocate(size);
+    if (!key)
+        return nullptr;
+
+    size_t filled = 0;
+    while (filled < size) {
+        ssize_t n = getrandom(key->buffer + filled, size - filled, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            qWarning() << "cannot generate volume key:" << strerror(errno);
+            return nullptr;
+        }
+        filled += static_cast<size_t>(n);
+    }
+    return key;
+}
+
+VolumeKey::VolumeKey(size_t size)
+{
+    if (size == 0)
+        return;
+
+    // page aligned, never swapped out or dumped.
+    allocSize = (size + 4095) / 4096 * 4096;
+    void *mem = mmap(nullptr, allocSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        qWarning() << "cannot allocate memory for volume key:" << strerror(errno);
+        return;
+    }
+    if (mlock(mem, allocSize) != 0)
+        qWarning() << "cannot lock memory of volume key:" << strerror(errno);
+    madvise(mem, allocSize, MADV_DONTDUMP);
+
+    buffer = static_cast<char *>(mem);
+    length = size;
+}
+
+VolumeKey::~VolumeKey()
+{
+    if (!buffer)
+        return;
+
+    explicit_bzero(buffer, allocSize);
+    munlock(buffer, allocSize);
+    munmap(buffer, allocSize);
+}
@@ -0,0 +1,44 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef VOLUMEKEY_H
+#define VOLUMEKEY_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QSharedPointer>
+
+FILE_ENCRYPT_BEGIN_NS
+
+/*!
+ * \brief The VolumeKey class
+ * holds the volume key of one job in locked memory, so the passphrase is
+ * derived only once and the later steps (reencrypt init, activation) can
+ * use the key directly. the memory is wiped on destruction.
+ */
+class VolumeKey
+{
+    Q_DISABLE_COPY(VolumeKey)
+public:
+    static QSharedPointer<VolumeKey> allocate(size_t size);
+    static QSharedPointer<VolumeKey> generate(size_t size);
+    ~VolumeKey();
+
+    inline const char *data() const { return buffer; }
+    inline char *data() { return buffer; }
+    inline size_t size() const { return length; }
+    inline bool isValid() const { return buffer && length > 0; }
+
+private:
+    explicit VolumeKey(size_t size);
+
+private:
+    char *buffer { nullptr };
+    size_t length { 0 };
+    size_t allocSize { 0 };
+};
+typedef QSharedPointer<VolumeKey> VolumeKeyPtr;
+
+FILE_ENCRYPT_END_NS
+
+#endif   // VOLUMEKEY_H
@@ -0,0 +1,88 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "faultinjection.h"
+
+#include <QDir>
+#include <QFile>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include <signal.h>
+#include <unistd.h>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr char kFaultEnv[] { "DFM_DISK_ENCRYPT_FAULT" };
+static constexpr char kFaultLog[] { "fault-injection.jsonl" };
+static constexpr char kStateDirEnv[] { "DFM_DISK_ENCRYPT_STATE_DIR" };
+static constexpr int kDefaultMaxDelay { 2000 };   // ms
+
+static std::atomic_bool gFired { false };
+
+static void logInjection(const QString &point, int delay)
+{
+    QDir().mkpath(fault_injection::stateDir());
+    QFile f(QString("%1/%2").arg(fault_injection::stateDir()).arg(kFaultLog));
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Append))
+        return;
+    QJsonObject obj {
+        { "point", point },
+        { "delay", delay },
+        { "pid", static_cast<qint64>(getpid()) },
+        { "time", QDateTime::currentMSecsSinceEpoch() },
+    };
+    f.write(QJsonDocument(obj).toJson(QJsonDocument::Compact) + "\n");
+    // the process dies right after, make sure the record reaches the disk.
+    f.flush();
+    fsync(f.handle());
+}
+
+QString fault_injection::stateDir()
+{
+#ifdef DFM_DISK_ENCRYPT_FAULT_INJECTION
+    const QString &dir = qEnvironmentVariable(kStateDirEnv);
+    if (!dir.isEmpty())
+        return dir;
+#endif
+    return kEncryptStateDir;
+}
+
+void fault_injection::arm(const char *point)
+{
+    if (gFired)
+        return;
+
+    const QString &config = qEnvironmentVariable(kFaultEnv);
+    if (config.isEmpty())
+        return;
+
+    const QStringList &items = config.split(':');
+    const QString &target = items.value(0);
+    if (target != "*" && target != point)
+        return;
+    if (gFired.exchange(true))
+        return;
+
+    bool ok = false;
+    int maxDelay = items.value(1).toInt(&ok);
+    if (!ok || maxDelay < 0)
+        maxDelay = kDefaultMaxDelay;
+    int delay = QRandomGenerator::global()->bounded(maxDelay + 1);
+
+    // killed from aside so the crash lands in the middle of the work that
+    // follows the point, not on the boundary of it.
+    qWarning() << "fault injection armed at" << point << "in" << delay << "ms";
+    QString name(point);
+    std::thread([name, delay] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        logInjection(name, delay);
+        ::kill(getpid(), SIGKILL);
+    }).detach();
+}
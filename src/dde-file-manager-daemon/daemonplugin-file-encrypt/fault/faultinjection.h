@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef FAULTINJECTION_H
+#define FAULTINJECTION_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+FILE_ENCRYPT_BEGIN_NS
+
+// crash points for power loss tests, only built with ENABLE_FAULT_INJECTION.
+// env DFM_DISK_ENCRYPT_FAULT=<point|*>[:<max delay ms>] kills the daemon at
+// a random moment within the delay after the point is passed, once per
+// process. the chosen point and delay are appended to
+// stateDir()/fault-injection.jsonl before the kill.
+namespace fault_injection {
+void arm(const char *point);
+// kEncryptStateDir, or the dir named by env DFM_DISK_ENCRYPT_STATE_DIR when
+// the points are built in, so the tests keep away from the live job state.
+QString stateDir();
+}   // namespace fault_injection
+
+FILE_ENCRYPT_END_NS
+
+#ifdef DFM_DISK_ENCRYPT_FAULT_INJECTION
+#    define FAULT_POINT(point) FILE_ENCRYPT_NS::fault_injection::arm(point)
+#else
+#    define FAULT_POINT(point)
+#endif
+
+#endif   // FAULTINJECTION_H
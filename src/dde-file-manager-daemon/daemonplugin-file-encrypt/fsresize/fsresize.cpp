@@ -7,18 +7,24 @@
 
 using namespace daemonplugin_file_encrypt;
 
-bool fs_resize::shrinkFileSystem_ext(const QString &device)
+bool fs_resize::shrinkFileSystem_ext(const QString &device, bool checked)
 {
     // TODO(xust): not find the API of resize2fs, use BIN program temp
-    QString cmd = QString("e2fsck -f -y %1").arg(device);
-    int ret = ::system(cmd.toStdString().c_str());
-    if (ret != 0) {
-        qWarning() << "e2fsck failed!"
-                   << ret;
-        return false;
+    QString cmd;
+    int ret = 0;
+    if (!checked) {
+        cmd = QString("e2fsck -f -y %1").arg(device);
+        ret = ::system(cmd.toStdString().c_str());
+        if (ret != 0) {
+            qWarning() << "e2fsck failed!"
+                       << ret;
+            return false;
+        }
     }
 
-    cmd = QString("resize2fs -M %1").arg(device);
+    // a read only check does not record itself in the superblock, resize2fs
+    // would ask for another one without force.
+    cmd = QString("resize2fs %1-M %2").arg(checked ? "-f " : "").arg(device);
     ret = ::system(cmd.toStdString().c_str());
     if (ret != 0) {
         qWarning() << "resize2fs failed"
@@ -12,7 +12,8 @@ namespace fs_resize {
 bool shrinkFileSystem(const QString &device);
 bool expandFileSystem(const QString &device);
 
-bool shrinkFileSystem_ext(const QString &device);
+// the repair pass is skipped if the filesystem is known clean and untouched.
+bool shrinkFileSystem_ext(const QString &device, bool checked = false);
 bool expandFileSystem_ext(const QString &device);
 bool recoverySuperblock_ext(const QString &device, const QString &cryptHeaderPath);
 }   // namespace fs_resize
@@ -5,6 +5,8 @@
 #ifndef GLOBALTYPESDEFINE_H
 #define GLOBALTYPESDEFINE_H
 
+#include "usectoken.h"
+
 #include <QString>
 
 namespace disk_encrypt {
@@ -18,12 +20,29 @@ inline constexpr char kKeyOldPassphrase[] { "oldPassphrase" };
 inline constexpr char kKeyCipher[] { "cipher" };
 inline constexpr char kKeyRecoveryExportPath[] { "exportRecKeyTo" };
 inline constexpr char kKeyInitParamsOnly[] { "initParamsOnly" };
+inline constexpr char kKeyOnlineMode[] { "onlineMode" };
 inline constexpr char kKeyTPMConfig[] { "tpmConfig" };
 inline constexpr char kKeyTPMToken[] { "tpmToken" };
 inline constexpr char kKeyValidateWithRecKey[] { "usingRecKey" };
 inline constexpr char kKeyDeviceName[] { "deviceName" };
+inline constexpr char kKeyReportOnly[] { "reportOnly" };
+inline constexpr char kKeyAllowDiscards[] { "allowDiscards" };
+inline constexpr char kKeyReadOnly[] { "readOnly" };
+inline constexpr char kKeyDeferredUnlock[] { "deferredUnlock" };
+inline constexpr char kKeyDevices[] { "devices" };
+inline constexpr char kKeyDetachedHeader[] { "detachedHeader" };
+inline constexpr char kKeyDiscard[] { "discard" };
 }   // namespace encrypt_param_keys
 
+// reply of QueryTPMLockout.
+namespace tpm_lockout_keys {
+inline constexpr char kKeyValid[] { "valid" };
+inline constexpr char kKeyInLockout[] { "inLockout" };
+inline constexpr char kKeyFailedTries[] { "failedTries" };
+inline constexpr char kKeyMaxTries[] { "maxTries" };
+inline constexpr char kKeyRecoverySeconds[] { "recoverySeconds" };
+}   // namespace tpm_lockout_keys
+
 enum EncryptOperationStatus {
     kSuccess = 0,
     kUserCancelled,
@@ -56,6 +75,11 @@ enum EncryptOperationStatus {
     kErrorOpenFileFailed,
     kErrorSetTokenFailed,
     kErrorResizeFs,
+    kErrorUnmountFailed,
+    kErrorMountFailed,
+    kErrorDestroyKeyslot,
+    kErrorKeyslotsUnknown,
+    kErrorWipeHeader,
 
     kErrorUnknown,
 };
@@ -76,7 +100,9 @@ struct DeviceEncryptParam
     QString exportPath;
     QString deviceDisplayName;
     bool initOnly;
+    bool online;
     bool validateByRecKey;
+    bool detachedHeader;
 };
 
 }
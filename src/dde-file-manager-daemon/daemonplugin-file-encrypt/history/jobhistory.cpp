@@ -0,0 +1,330 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "jobhistory.h"
+#include "scheduler/disktopology.h"
+#include "encrypt/cryptaffinity.h"
+#include "encrypt/diskencrypt.h"
+#include "fault/faultinjection.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr char kHistoryFile[] { "job-history.jsonl" };
+static constexpr char kCheckpointDir[] { "checkpoints" };
+// the log is rotated to one backup when it grows over this.
+static constexpr qint64 kMaxHistorySize { 1024 * 1024 };
+static constexpr qint64 kThroughputWindow { 1000 };   // ms
+static constexpr double kMiB { 1024.0 * 1024.0 };
+
+namespace {
+struct ActiveJob
+{
+    bool active { false };
+    JobRecord record;
+
+    QString phase;
+    QElapsedTimer phaseClock;
+    QElapsedTimer beginClock;
+    QString deviceSpec;   // stable name of the device, see bcStableSpec
+    quint64 checkpoint { 0 };   // offset reached by the interrupted job
+    QString pacingLevel;
+
+    bool progressing { false };
+    QElapsedTimer clock;   // started at the first progress report
+    quint64 firstOffset { 0 };
+    quint64 lastOffset { 0 };
+    qint64 windowStart { 0 };
+    quint64 windowOffset { 0 };
+};
+}   // namespace
+
+static thread_local ActiveJob gJob;
+static QMutex gHistoryMtx;
+
+static void leavePhase()
+{
+    if (gJob.phase.isEmpty())
+        return;
+    // a phase may be entered more than once in one job.
+    QVariantMap &phases = gJob.record.phases;
+    phases.insert(gJob.phase, phases.value(gJob.phase).toLongLong() + gJob.phaseClock.elapsed());
+    gJob.phase.clear();
+}
+
+// one checkpoint per device and job type, a failed decryption is not
+// resumed by an encryption. the device is named by what survives a reboot,
+// a kernel name may belong to another disk then.
+static QString checkpointPath(const ActiveJob &job)
+{
+    if (job.deviceSpec.isEmpty())
+        return QString();
+    return QString("%1/%2/%3.%4").arg(fault_injection::stateDir()).arg(kCheckpointDir)
+            .arg(QString(job.deviceSpec).replace('/', '_')).arg(job.record.type);
+}
+
+static bool readCheckpoint(const ActiveJob &job, quint64 *offset)
+{
+    const QString &path = checkpointPath(job);
+    if (path.isEmpty())
+        return false;
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+    bool ok = false;
+    *offset = f.readAll().trimmed().toULongLong(&ok);
+    return ok;
+}
+
+static void writeCheckpoint(const ActiveJob &job, quint64 offset)
+{
+    const QString &path = checkpointPath(job);
+    if (path.isEmpty())
+        return;
+    QDir().mkpath(QString("%1/%2").arg(fault_injection::stateDir()).arg(kCheckpointDir));
+    // the checkpoint is what a crash leaves, it's written aside and synced
+    // before replacing the former one, which is never seen truncated.
+    const QString &tmpPath = path + ".tmp";
+    QFile f(tmpPath);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return;
+    f.write(QByteArray::number(offset));
+    f.flush();
+    ::fsync(f.handle());
+    f.close();
+    if (::rename(tmpPath.toStdString().c_str(), path.toStdString().c_str()) != 0)
+        qWarning() << "cannot save checkpoint" << path << strerror(errno);
+}
+
+static QString historyPath()
+{
+    return QString("%1/%2").arg(fault_injection::stateDir()).arg(kHistoryFile);
+}
+
+static void appendRecord(const JobRecord &record)
+{
+    QMutexLocker locker(&gHistoryMtx);
+    const QString &dir = fault_injection::stateDir();
+    if (!QDir().mkpath(dir)) {
+        qWarning() << "cannot create job history dir" << dir;
+        return;
+    }
+    QFile::setPermissions(dir, QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner);
+
+    const QString &path = historyPath();
+    if (QFileInfo(path).size() > kMaxHistorySize) {
+        QFile::remove(path + ".1");
+        QFile::rename(path, path + ".1");
+    }
+
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "cannot open job history" << path;
+        return;
+    }
+    f.setPermissions(QFile::ReadOwner | QFile::WriteOwner);
+    QJsonObject obj = QJsonObject::fromVariantMap(record.toVariantMap());
+    f.write(QJsonDocument(obj).toJson(QJsonDocument::Compact) + "\n");
+    f.close();
+}
+
+QVariantMap JobRecord::toVariantMap() const
+{
+    return {
+        { "jobID", jobID },
+        { "type", type },
+        { "device", device },
+        { "model", model },
+        { "size", size },
+        { "cipher", cipher },
+        { "sectorSize", sectorSize },
+        { "resilience", resilience },
+        { "cpuSet", cpuSet },
+        { "phases", phases },
+        { "pacing", pacing },
+        { "bytesMoved", bytesMoved },
+        { "avgThroughput", avgThroughput },
+        { "minThroughput", minThroughput },
+        { "resumed", resumed },
+        { "timeToResume", timeToResume },
+        { "bytesReprocessed", bytesReprocessed },
+        { "result", result },
+        { "startedAt", startedAt },
+        { "finishedAt", finishedAt },
+    };
+}
+
+void job_history::begin(const QString &jobID, const QString &type, const QString &device)
+{
+    gJob = ActiveJob();
+    gJob.active = true;
+
+    JobRecord &record = gJob.record;
+    record.jobID = jobID;
+    record.type = type;
+    record.device = device;
+    record.size = block_device_utils::bcDeviceSize(device);
+    record.startedAt = QDateTime::currentMSecsSinceEpoch();
+    record.model = modelOf(device);
+    record.cpuSet = crypt_affinity::cpuSet();
+    gJob.beginClock.start();
+    gJob.deviceSpec = block_device_utils::bcStableSpec(device);
+    record.resumed = readCheckpoint(gJob, &gJob.checkpoint);
+}
+
+QString job_history::modelOf(const QString &device)
+{
+    QStringList models;
+    const auto &disks = disk_topology::physicalDisksOf(device);
+    for (const auto &disk : disks)
+        models.append(disk.model.isEmpty() ? disk.name : disk.model);
+    return models.join(",");
+}
+
+void job_history::setCrypt(const QString &cipher, int sectorSize, const QString &resilience)
+{
+    if (!gJob.active)
+        return;
+    gJob.record.cipher = cipher;
+    gJob.record.sectorSize = sectorSize;
+    gJob.record.resilience = resilience;
+}
+
+void job_history::enterPhase(const QString &name)
+{
+    if (!gJob.active)
+        return;
+    leavePhase();
+    gJob.phase = name;
+    gJob.phaseClock.start();
+}
+
+void job_history::addPhase(const QString &name, qint64 msecs)
+{
+    if (!gJob.active)
+        return;
+    QVariantMap &phases = gJob.record.phases;
+    phases.insert(name, phases.value(name).toLongLong() + msecs);
+}
+
+void job_history::addPacing(const QString &level, qint64 workMsecs, qint64 pauseMsecs)
+{
+    if (!gJob.active)
+        return;
+    QVariantMap &pacing = gJob.record.pacing;
+    QVariantMap times = pacing.value(level).toMap();
+    times.insert("work", times.value("work").toLongLong() + workMsecs);
+    times.insert("pause", times.value("pause").toLongLong() + pauseMsecs);
+    pacing.insert(level, times);
+    if (level != gJob.pacingLevel) {
+        if (!gJob.pacingLevel.isEmpty())
+            pacing.insert("changes", pacing.value("changes").toInt() + 1);
+        gJob.pacingLevel = level;
+    }
+}
+
+void job_history::progress(quint64 size, quint64 offset)
+{
+    Q_UNUSED(size)
+    if (!gJob.active)
+        return;
+
+    if (!gJob.progressing) {
+        gJob.progressing = true;
+        gJob.clock.start();
+        gJob.firstOffset = offset;
+        gJob.windowOffset = offset;
+
+        JobRecord &record = gJob.record;
+        if (record.resumed) {
+            record.timeToResume = gJob.beginClock.elapsed();
+            record.bytesReprocessed = gJob.checkpoint > offset ? gJob.checkpoint - offset : 0;
+        }
+    }
+    gJob.lastOffset = offset;
+
+    qint64 elapsed = gJob.clock.elapsed();
+    qint64 window = elapsed - gJob.windowStart;
+    if (window < kThroughputWindow || offset < gJob.windowOffset)
+        return;
+
+    double throughput = (offset - gJob.windowOffset) / kMiB / (window / 1000.0);
+    double &minThroughput = gJob.record.minThroughput;
+    minThroughput = (minThroughput == 0) ? throughput : qMin(minThroughput, throughput);
+    gJob.windowStart = elapsed;
+    gJob.windowOffset = offset;
+    writeCheckpoint(gJob, offset);
+}
+
+void job_history::finish(int result)
+{
+    if (!gJob.active)
+        return;
+
+    leavePhase();
+    JobRecord &record = gJob.record;
+    record.result = result;
+    record.finishedAt = QDateTime::currentMSecsSinceEpoch();
+    if (gJob.progressing && gJob.lastOffset > gJob.firstOffset) {
+        record.bytesMoved = gJob.lastOffset - gJob.firstOffset;
+        qint64 elapsed = gJob.clock.elapsed();
+        if (elapsed > 0)
+            record.avgThroughput = record.bytesMoved / kMiB / (elapsed / 1000.0);
+        // finished within one window.
+        if (record.minThroughput == 0)
+            record.minThroughput = record.avgThroughput;
+    }
+
+    // keep the checkpoint of a failed job, it may be resumed.
+    if (result == 0 && !checkpointPath(gJob).isEmpty())
+        QFile::remove(checkpointPath(gJob));
+    appendRecord(record);
+    gJob = ActiveJob();
+}
+
+QVariantList job_history::query(const QVariantMap &filter)
+{
+    const QString &device = filter.value("device").toString();
+    const QString &type = filter.value("type").toString();
+    qint64 since = filter.value("since", 0).toLongLong();
+    int limit = filter.value("limit", 0).toInt();
+
+    QVariantList records;
+    QMutexLocker locker(&gHistoryMtx);
+    for (const QString &path : { historyPath() + ".1", historyPath() }) {
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly))
+            continue;
+        while (!f.atEnd()) {
+            const QByteArray &line = f.readLine().trimmed();
+            if (line.isEmpty())
+                continue;
+            QVariantMap record = QJsonDocument::fromJson(line).object().toVariantMap();
+            if (record.isEmpty()
+                || (!device.isEmpty() && record.value("device").toString() != device)
+                || (!type.isEmpty() && record.value("type").toString() != type)
+                || record.value("finishedAt").toLongLong() < since)
+                continue;
+            records.append(record);
+        }
+    }
+
+    // the latest ones are kept.
+    if (limit > 0 && records.count() > limit)
+        records = records.mid(records.count() - limit);
+    return records;
+}
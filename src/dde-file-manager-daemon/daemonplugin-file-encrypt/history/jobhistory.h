@@ -0,0 +1,68 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef JOBHISTORY_H
+#define JOBHISTORY_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QVariantMap>
+
+FILE_ENCRYPT_BEGIN_NS
+
+/*!
+ * \brief The JobRecord struct
+ * outcome of one encrypt/decrypt job, appended to the history log as one
+ * json line when the job finishes.
+ */
+struct JobRecord
+{
+    QString jobID;
+    QString type;   // encrypt-prepare, encrypt, decrypt
+    QString device;
+    QString model;
+    quint64 size { 0 };   // bytes
+    QString cipher;
+    int sectorSize { 0 };
+    QString resilience;
+    QString cpuSet;   // cpus dm-crypt is restricted to, empty for all
+    QVariantMap phases;   // phase name -> milliseconds
+    // pacing level -> { work, pause } in milliseconds, and level changes.
+    QVariantMap pacing;
+    quint64 bytesMoved { 0 };
+    double avgThroughput { 0 };   // MiB/s
+    double minThroughput { 0 };   // MiB/s, of windows no shorter than 1s
+    // for a job resuming an interrupted one: the time from begin to the
+    // first progress, and the bytes done before the interruption but
+    // processed again, by the checkpoint saved each second.
+    bool resumed { false };
+    qint64 timeToResume { 0 };   // ms
+    quint64 bytesReprocessed { 0 };
+    int result { 0 };
+    qint64 startedAt { 0 };
+    qint64 finishedAt { 0 };
+
+    QVariantMap toVariantMap() const;
+};
+
+// the job running on current thread is recorded, each job runs in its
+// own worker thread.
+namespace job_history {
+void begin(const QString &jobID, const QString &type, const QString &device);
+void setCrypt(const QString &cipher, int sectorSize, const QString &resilience);
+// the former phase ends when the next one is entered or the job finishes.
+void enterPhase(const QString &name);
+// for phases measured outside of the daemon.
+void addPhase(const QString &name, qint64 msecs);
+void addPacing(const QString &level, qint64 workMsecs, qint64 pauseMsecs);
+void progress(quint64 size, quint64 offset);
+void finish(int result);
+
+QVariantList query(const QVariantMap &filter);
+// models of the disks backing the device, as recorded in history.
+QString modelOf(const QString &device);
+}   // namespace job_history
+
+FILE_ENCRYPT_END_NS
+
+#endif   // JOBHISTORY_H
@@ -0,0 +1,253 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "autoencrypt.h"
+#include "encrypt/diskencrypt.h"
+
+#include <dfm-mount/dmount.h>
+
+#include <DConfig>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+
+FILE_ENCRYPT_USE_NS
+using namespace disk_encrypt;
+
+static constexpr char kPolicyKey[] { "autoEncryptPolicy" };
+static constexpr char kCipherKey[] { "encryptAlgorithm" };
+static constexpr char kReportFile[] { "auto-encrypt-report.json" };
+
+static bool matchesAny(const QStringList &patterns, const QString &value)
+{
+    if (patterns.isEmpty())
+        return true;
+    return std::any_of(patterns.cbegin(), patterns.cend(), [&value](const QString &pattern) {
+        return value.contains(pattern, Qt::CaseInsensitive);
+    });
+}
+
+AutoEncryptPolicy AutoEncryptPolicy::fromVariantMap(const QVariantMap &map)
+{
+    AutoEncryptPolicy policy;
+    policy.enabled = map.value("enabled", false).toBool();
+    policy.vendors = map.value("vendors").toStringList();
+    policy.models = map.value("models").toStringList();
+    policy.minSize = map.value("minSize", 0).toULongLong();
+    policy.maxSize = map.value("maxSize", 0).toULongLong();
+    policy.keyFile = map.value("keyFile").toString();
+    policy.recoveryExportPath = map.value("recoveryExportPath").toString();
+    return policy;
+}
+
+bool AutoEncryptPolicy::matches(const QSharedPointer<dfmmount::DBlockDevice> &blkDev) const
+{
+    using namespace dfmmount;
+    if (!blkDev || blkDev->hintSystem() || blkDev->isEncrypted())
+        return false;
+
+    // only ext can be shrunk for the header.
+    const QString &fsType = blkDev->getProperty(Property::kBlockIDType).toString();
+    if (!fsType.startsWith("ext"))
+        return false;
+
+    quint64 size = blkDev->getProperty(Property::kBlockSize).toULongLong();
+    if (size < minSize || (maxSize > 0 && size > maxSize))
+        return false;
+
+    return matchesAny(vendors, blkDev->getProperty(Property::kDriveVendor).toString())
+            && matchesAny(models, blkDev->getProperty(Property::kDriveModel).toString());
+}
+
+QString AutoEncryptPolicy::readPassphrase() const
+{
+    // the key file must be readable by root only.
+    struct stat st;
+    if (keyFile.isEmpty() || stat(keyFile.toStdString().c_str(), &st) != 0) {
+        qWarning() << "auto encrypt: key file is not available" << keyFile;
+        return "";
+    }
+    if (st.st_uid != 0 || (st.st_mode & (S_IRWXG | S_IRWXO))) {
+        qWarning() << "auto encrypt: key file is accessible by others, ignored" << keyFile;
+        return "";
+    }
+
+    QFile f(keyFile);
+    if (!f.open(QIODevice::ReadOnly))
+        return "";
+    return QString::fromUtf8(f.readAll()).trimmed();
+}
+
+AutoEncryptProvisioner::AutoEncryptProvisioner(QObject *parent)
+    : QObject(parent)
+{
+    cfg = Dtk::Core::DConfig::create("org.deepin.dde.file-manager",
+                                     "org.deepin.dde.file-manager.diskencrypt",
+                                     "", this);
+    connect(cfg, &Dtk::Core::DConfig::valueChanged, this, [this](const QString &key) {
+        if (key == kPolicyKey || key == kCipherKey)
+            loadPolicy();
+    });
+    loadPolicy();
+
+    using namespace dfmmount;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    Q_ASSERT(monitor);
+    monitor->startMonitor();
+    // only attached devices are provisioned. a filesystem created later, e.g.
+    // by decrypting a drive, is left as it is.
+    connect(monitor.data(), &DBlockMonitor::deviceAdded, this, &AutoEncryptProvisioner::onDeviceAttached);
+    connect(monitor.data(), &DBlockMonitor::fileSystemAdded, this, &AutoEncryptProvisioner::onFileSystemProbed);
+    connect(monitor.data(), &DBlockMonitor::deviceRemoved, this, [this](const QString &objPath) {
+        // may be attached again and provisioned in another batch.
+        handledDevices.remove(objPath);
+        probingDevices.remove(objPath);
+    });
+}
+
+void AutoEncryptProvisioner::loadPolicy()
+{
+    policy = AutoEncryptPolicy::fromVariantMap(cfg->value(kPolicyKey).toMap());
+    policy.cipher = cfg->value(kCipherKey, "sm4").toString();
+    qInfo() << "auto encrypt policy loaded, enabled:" << policy.enabled
+            << "vendors:" << policy.vendors << "models:" << policy.models
+            << "size:" << policy.minSize << policy.maxSize;
+}
+
+void AutoEncryptProvisioner::onDeviceAttached(const QString &objPath)
+{
+    if (!policy.enabled || handledDevices.contains(objPath))
+        return;
+
+    using namespace dfmmount;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    auto blkDev = monitor->createDeviceById(objPath).objectCast<DBlockDevice>();
+    // the filesystem may be probed after the device is added.
+    if (blkDev && blkDev->getProperty(Property::kBlockIDType).toString().isEmpty()) {
+        probingDevices.insert(objPath);
+        return;
+    }
+    provision(blkDev);
+}
+
+void AutoEncryptProvisioner::onFileSystemProbed(const QString &objPath)
+{
+    if (!probingDevices.remove(objPath) || !policy.enabled || handledDevices.contains(objPath))
+        return;
+
+    using namespace dfmmount;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    provision(monitor->createDeviceById(objPath).objectCast<DBlockDevice>());
+}
+
+void AutoEncryptProvisioner::provision(const QSharedPointer<dfmmount::DBlockDevice> &blkDev)
+{
+    using namespace dfmmount;
+    if (!policy.matches(blkDev))
+        return;
+    handledDevices.insert(blkDev->path());
+
+    const QString &device = blkDev->device();
+    QVariantMap record {
+        { "device", device },
+        { "vendor", blkDev->getProperty(Property::kDriveVendor).toString() },
+        { "model", blkDev->getProperty(Property::kDriveModel).toString() },
+        { "size", blkDev->getProperty(Property::kBlockSize).toULongLong() },
+        { "startedAt", QDateTime::currentMSecsSinceEpoch() },
+    };
+    if (batchJobs.isEmpty())
+        batchStartedAt = QDateTime::currentMSecsSinceEpoch();
+    batchJobs.insert(device, record);
+    runningJobs.insert(device);
+    qInfo() << "auto encrypt: device matches policy" << record;
+
+    QString passphrase = policy.readPassphrase();
+    if (passphrase.isEmpty()) {
+        jobFinished(device, -kErrorParamsInvalid);
+        return;
+    }
+
+    // automounted by desktop, the job needs it unmounted.
+    MountItem item;
+    if (block_device_utils::bcMountItem(device, &item)) {
+        int ret = block_device_utils::bcUnmount(item);
+        if (ret != kSuccess) {
+            jobFinished(device, ret);
+            return;
+        }
+    }
+
+    Q_EMIT encryptRequested({
+            { encrypt_param_keys::kKeyDevice, device },
+            { encrypt_param_keys::kKeyDeviceName, record.value("model") },
+            { encrypt_param_keys::kKeyCipher, policy.cipher },
+            { encrypt_param_keys::kKeyPassphrase, passphrase },
+            { encrypt_param_keys::kKeyInitParamsOnly, false },
+            { encrypt_param_keys::kKeyOnlineMode, false },
+            { encrypt_param_keys::kKeyRecoveryExportPath, policy.recoveryExportPath },
+            { encrypt_param_keys::kKeyEncMode, kPasswordOnly },
+    });
+}
+
+void AutoEncryptProvisioner::jobFinished(const QString &device, int result)
+{
+    if (!runningJobs.remove(device))
+        return;
+
+    QVariantMap &record = batchJobs[device];
+    record.insert("result", result);
+    record.insert("finishedAt", QDateTime::currentMSecsSinceEpoch());
+    qInfo() << "auto encrypt: job finished" << device << result;
+
+    if (runningJobs.isEmpty())
+        writeReport();
+}
+
+QVariantMap AutoEncryptProvisioner::lastReport() const
+{
+    QFile f(QString("%1/%2").arg(kEncryptStateDir).arg(kReportFile));
+    if (!f.open(QIODevice::ReadOnly))
+        return {};
+    return QJsonDocument::fromJson(f.readAll()).object().toVariantMap();
+}
+
+void AutoEncryptProvisioner::writeReport()
+{
+    int succeeded = 0;
+    QVariantList devices;
+    for (const auto &record : qAsConst(batchJobs)) {
+        if (record.value("result").toInt() == kSuccess)
+            ++succeeded;
+        devices.append(record);
+    }
+
+    QVariantMap report {
+        { "startedAt", batchStartedAt },
+        { "finishedAt", QDateTime::currentMSecsSinceEpoch() },
+        { "total", devices.count() },
+        { "succeeded", succeeded },
+        { "failed", devices.count() - succeeded },
+        { "devices", devices },
+    };
+    batchJobs.clear();
+    qInfo() << "auto encrypt: batch finished" << report;
+
+    if (QDir().mkpath(kEncryptStateDir)) {
+        QFile f(QString("%1/%2").arg(kEncryptStateDir).arg(kReportFile));
+        if (f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            f.write(QJsonDocument(QJsonObject::fromVariantMap(report)).toJson());
+            f.close();
+        } else {
+            qWarning() << "auto encrypt: cannot write report" << f.fileName();
+        }
+    }
+    Q_EMIT batchFinished(report);
+}
@@ -0,0 +1,85 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef AUTOENCRYPT_H
+#define AUTOENCRYPT_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QObject>
+#include <QVariantMap>
+#include <QStringList>
+#include <QSet>
+
+namespace Dtk {
+namespace Core {
+class DConfig;
+}
+}
+
+namespace dfmmount {
+class DBlockDevice;
+}
+
+FILE_ENCRYPT_BEGIN_NS
+
+/*!
+ * \brief The AutoEncryptPolicy struct
+ * provisioning policy set by administrator in dconfig, ext formatted
+ * external drives matching the filters are encrypted when attached.
+ */
+struct AutoEncryptPolicy
+{
+    bool enabled { false };
+    QStringList vendors;   // case insensitive, empty matches all
+    QStringList models;   // case insensitive, empty matches all
+    quint64 minSize { 0 };   // bytes
+    quint64 maxSize { 0 };   // bytes, 0 for no limit
+    QString keyFile;   // holds the passphrase of all provisioned drives
+    QString recoveryExportPath;
+    QString cipher;
+
+    static AutoEncryptPolicy fromVariantMap(const QVariantMap &map);
+    bool matches(const QSharedPointer<dfmmount::DBlockDevice> &blkDev) const;
+    QString readPassphrase() const;
+};
+
+/*!
+ * \brief The AutoEncryptProvisioner class
+ * watches block devices attached and requests the encrypt jobs of the
+ * matched ones. the jobs requested while a batch is running join the
+ * batch, the report is written when all of them are finished.
+ * must be used in main thread.
+ */
+class AutoEncryptProvisioner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AutoEncryptProvisioner(QObject *parent = nullptr);
+    void jobFinished(const QString &device, int result);
+    QVariantMap lastReport() const;
+
+Q_SIGNALS:
+    void encryptRequested(const QVariantMap &params);
+    void batchFinished(const QVariantMap &report);
+
+private:
+    void loadPolicy();
+    void onDeviceAttached(const QString &objPath);
+    void onFileSystemProbed(const QString &objPath);
+    void provision(const QSharedPointer<dfmmount::DBlockDevice> &blkDev);
+    void writeReport();
+
+private:
+    Dtk::Core::DConfig *cfg { nullptr };
+    AutoEncryptPolicy policy;
+    QSet<QString> handledDevices;
+    QSet<QString> probingDevices;   // attached, the filesystem is not probed yet
+    QMap<QString, QVariantMap> batchJobs;   // device -> job record
+    QSet<QString> runningJobs;
+    qint64 batchStartedAt { 0 };
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // AUTOENCRYPT_H
@@ -0,0 +1,67 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "disktopology.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr char kSysBlockPath[] { "/sys/class/block" };
+static constexpr int kMaxStackDepth { 8 };
+
+static bool readRotational(const QString &disk)
+{
+    QFile f(QString("%1/%2/queue/rotational").arg(kSysBlockPath).arg(disk));
+    if (!f.open(QIODevice::ReadOnly))
+        return true;
+    return f.readAll().trimmed() != "0";
+}
+
+static void collectDisks(const QString &blkName, QMap<QString, PhysicalDisk> *disks, int depth)
+{
+    if (depth > kMaxStackDepth)
+        return;
+
+    // dm/md devices: walk down to the devices they are stacked on.
+    QDir slaves(QString("%1/%2/slaves").arg(kSysBlockPath).arg(blkName));
+    const QStringList &slaveNames = slaves.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    if (!slaveNames.isEmpty()) {
+        for (const auto &slave : slaveNames)
+            collectDisks(slave, disks, depth + 1);
+        return;
+    }
+
+    QString sysPath = QFileInfo(QString("%1/%2").arg(kSysBlockPath).arg(blkName)).canonicalFilePath();
+    if (sysPath.isEmpty())
+        return;
+    if (QFile::exists(sysPath + "/partition"))
+        sysPath = QFileInfo(sysPath).path();
+
+    QString disk = QFileInfo(sysPath).fileName();
+    bool rotational = readRotational(disk);
+    QFile modelFile(sysPath + "/device/model");
+    QString model;
+    if (modelFile.open(QIODevice::ReadOnly))
+        model = modelFile.readAll().trimmed();
+
+    // namespaces of one nvme controller share its queues.
+    if (disk.startsWith("nvme")) {
+        QString ctrl = QFileInfo(sysPath + "/device").canonicalFilePath();
+        if (!ctrl.isEmpty())
+            disk = QFileInfo(ctrl).fileName();
+    }
+
+    disks->insert(disk, { disk, rotational, model });
+}
+
+QList<PhysicalDisk> disk_topology::physicalDisksOf(const QString &device)
+{
+    QMap<QString, PhysicalDisk> disks;
+    QString blkName = QFileInfo(device).canonicalFilePath().section('/', -1);
+    if (!blkName.isEmpty())
+        collectDisks(blkName, &disks, 0);
+    return disks.values();
+}
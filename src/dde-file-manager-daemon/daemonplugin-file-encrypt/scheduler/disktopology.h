@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DISKTOPOLOGY_H
+#define DISKTOPOLOGY_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+FILE_ENCRYPT_BEGIN_NS
+
+struct PhysicalDisk
+{
+    QString name;   // sda, nvme0 (controller of nvme namespaces)...
+    bool rotational;
+    QString model;
+};
+
+namespace disk_topology {
+QList<PhysicalDisk> physicalDisksOf(const QString &device);
+}   // namespace disk_topology
+
+FILE_ENCRYPT_END_NS
+
+#endif   // DISKTOPOLOGY_H
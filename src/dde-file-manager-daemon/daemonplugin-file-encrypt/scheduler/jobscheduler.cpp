@@ -0,0 +1,76 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "jobscheduler.h"
+#include "disktopology.h"
+
+#include <algorithm>
+
+FILE_ENCRYPT_USE_NS
+
+JobScheduler *JobScheduler::instance()
+{
+    static JobScheduler ins;
+    return &ins;
+}
+
+JobScheduler::JobScheduler(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void JobScheduler::enqueue(QThread *worker, const QString &device, bool prior)
+{
+    Q_ASSERT(worker);
+
+    Job job;
+    job.worker = worker;
+    job.device = device;
+    const auto &disks = disk_topology::physicalDisksOf(device);
+    for (const auto &disk : disks) {
+        job.disks.append(disk.name);
+        qInfo() << "job of" << device << "is on disk" << disk.name
+                << (disk.rotational ? "(rotational)" : "(non-rotational)");
+    }
+    // cannot resolve the topology, treat device itself as a disk.
+    if (job.disks.isEmpty())
+        job.disks.append(device);
+
+    prior ? pendingJobs.prepend(job) : pendingJobs.append(job);
+    schedule();
+}
+
+void JobScheduler::schedule()
+{
+    for (int i = 0; i < pendingJobs.count();) {
+        const Job job = pendingJobs.at(i);
+        if (!job.worker) {
+            pendingJobs.removeAt(i);
+            continue;
+        }
+
+        bool busy = std::any_of(job.disks.cbegin(), job.disks.cend(),
+                                [this](const QString &disk) { return busyDisks.contains(disk); });
+        if (busy) {
+            qInfo() << "disk is busy, job of" << job.device << "is queued";
+            ++i;
+            continue;
+        }
+
+        pendingJobs.removeAt(i);
+        for (const auto &disk : job.disks)
+            busyDisks.insert(disk);
+        connect(job.worker, &QThread::finished, this, [this, job] {
+            release(job.disks);
+        });
+        qInfo() << "start job of" << job.device;
+        job.worker->start();
+    }
+}
+
+void JobScheduler::release(const QStringList &disks)
+{
+    for (const auto &disk : disks)
+        busyDisks.remove(disk);
+    schedule();
+}
@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+
+#include "daemonplugin_file_encrypt_global.h"
+
+#include <QObject>
+#include <QThread>
+#include <QPointer>
+#include <QSet>
+
+FILE_ENCRYPT_BEGIN_NS
+
+/*!
+ * \brief The JobScheduler class
+ * runs disk jobs concurrently only when they touch different physical
+ * disks, jobs which share a spindle/controller are run one after another.
+ * must be used in main thread.
+ */
+class JobScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    static JobScheduler *instance();
+
+    // the worker is started by scheduler, prior jobs (e.g. the reencrypt
+    // following a prepare job) are queued ahead of the normal ones.
+    void enqueue(QThread *worker, const QString &device, bool prior = false);
+
+private:
+    explicit JobScheduler(QObject *parent = nullptr);
+    void schedule();
+    void release(const QStringList &disks);
+
+private:
+    struct Job
+    {
+        QPointer<QThread> worker;
+        QString device;
+        QStringList disks;
+    };
+    QList<Job> pendingJobs;
+    QSet<QString> busyDisks;
+};
+
+FILE_ENCRYPT_END_NS
+
+#endif   // JOBSCHEDULER_H
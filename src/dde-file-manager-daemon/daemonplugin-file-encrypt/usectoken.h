@@ -0,0 +1,192 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef USECTOKEN_H
+#define USECTOKEN_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVariantMap>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDBusArgument>
+
+namespace disk_encrypt {
+
+inline constexpr char kTokenTypeTPM[] { "usec-tpm2" };
+inline constexpr char kTokenTypeRecKey[] { "usec-recoverykey" };
+
+/*!
+ * \brief The UsecToken struct
+ * the LUKS2 token shared with usec-crypt-kit. it is parsed and serialized
+ * only here, the sealed blobs are held decoded. in LUKS2 header it is
+ * stored as json, over DBus it is passed as a{sv} with blobs as ay.
+ */
+struct UsecToken
+{
+    int index { -1 };   // index in LUKS2 header, -1 for a new token.
+    QString type;
+    QList<int> keyslots;
+
+    QByteArray kekPriv;
+    QByteArray kekPub;
+    QByteArray iv;
+    QByteArray enc;
+
+    QString primaryKeyAlg;
+    QString primaryHashAlg;
+    QString sessionKeyAlg;
+    QString sessionHashAlg;
+    QString pcr;
+    QString pcrBank;
+    bool pin { false };
+
+    // fields unknown to us are kept as is.
+    QJsonObject extras;
+
+    inline bool isTPM() const { return type == kTokenTypeTPM; }
+
+    inline bool isValid() const
+    {
+        if (type.isEmpty() || keyslots.isEmpty())
+            return false;
+        for (int slot : keyslots) {
+            if (slot < 0)
+                return false;
+        }
+        if (isTPM())
+            return !kekPriv.isEmpty() && !kekPub.isEmpty() && !iv.isEmpty() && !enc.isEmpty()
+                    && !pcr.isEmpty() && !pcrBank.isEmpty();
+        return true;
+    }
+
+    static inline UsecToken fromJsonObject(const QJsonObject &obj)
+    {
+        UsecToken token;
+        QJsonObject rest = obj;
+        auto take = [&rest](const char *key) { return rest.take(key); };
+
+        token.index = take("token_index").toInt(-1);
+        token.type = take("type").toString();
+        const QJsonArray &slotArray = take("keyslots").toArray();
+        for (const auto &slot : slotArray) {
+            bool ok = false;
+            int val = slot.toVariant().toInt(&ok);
+            token.keyslots.append(ok ? val : -1);
+        }
+        token.kekPriv = QByteArray::fromBase64(take("kek-priv").toString().toLatin1());
+        token.kekPub = QByteArray::fromBase64(take("kek-pub").toString().toLatin1());
+        token.iv = QByteArray::fromBase64(take("iv").toString().toLatin1());
+        token.enc = QByteArray::fromBase64(take("enc").toString().toLatin1());
+        token.primaryKeyAlg = take("primary-key-alg").toString();
+        token.primaryHashAlg = take("primary-hash-alg").toString();
+        token.sessionKeyAlg = take("session-key-alg").toString();
+        token.sessionHashAlg = take("session-hash-alg").toString();
+        token.pcr = take("pcr").toString();
+        token.pcrBank = take("pcr-bank").toString();
+        token.pin = take("pin").toString() == "1";
+        token.extras = rest;
+        return token;
+    }
+
+    static inline UsecToken fromJson(const QByteArray &json)
+    {
+        return fromJsonObject(QJsonDocument::fromJson(json).object());
+    }
+
+    // the object stored in LUKS2 header, index is not part of it.
+    inline QJsonObject toJsonObject() const
+    {
+        QJsonObject obj = extras;
+        QStringList slotList;
+        for (int slot : keyslots)
+            slotList.append(QString::number(slot));
+        obj.insert("type", type);
+        obj.insert("keyslots", QJsonArray::fromStringList(slotList));
+
+        auto insertIfAny = [&obj](const char *key, const QString &val) {
+            if (!val.isEmpty()) obj.insert(key, val);
+        };
+        insertIfAny("kek-priv", kekPriv.toBase64());
+        insertIfAny("kek-pub", kekPub.toBase64());
+        insertIfAny("iv", iv.toBase64());
+        insertIfAny("enc", enc.toBase64());
+        insertIfAny("primary-key-alg", primaryKeyAlg);
+        insertIfAny("primary-hash-alg", primaryHashAlg);
+        insertIfAny("session-key-alg", sessionKeyAlg);
+        insertIfAny("session-hash-alg", sessionHashAlg);
+        insertIfAny("pcr", pcr);
+        insertIfAny("pcr-bank", pcrBank);
+        if (isTPM())
+            obj.insert("pin", pin ? "1" : "0");
+        return obj;
+    }
+
+    inline QByteArray toJson() const
+    {
+        return QJsonDocument(toJsonObject()).toJson(QJsonDocument::Compact);
+    }
+
+    inline QVariantMap toVariantMap() const
+    {
+        QVariantMap map = extras.toVariantMap();
+        QVariantList slotList;
+        for (int slot : keyslots)
+            slotList.append(slot);
+        map.insert("token_index", index);
+        map.insert("type", type);
+        map.insert("keyslots", slotList);
+        map.insert("kek-priv", kekPriv);
+        map.insert("kek-pub", kekPub);
+        map.insert("iv", iv);
+        map.insert("enc", enc);
+        map.insert("primary-key-alg", primaryKeyAlg);
+        map.insert("primary-hash-alg", primaryHashAlg);
+        map.insert("session-key-alg", sessionKeyAlg);
+        map.insert("session-hash-alg", sessionHashAlg);
+        map.insert("pcr", pcr);
+        map.insert("pcr-bank", pcrBank);
+        map.insert("pin", pin);
+        return map;
+    }
+
+    static inline UsecToken fromVariantMap(QVariantMap map)
+    {
+        UsecToken token;
+        token.index = map.contains("token_index") ? map.take("token_index").toInt() : -1;
+        token.type = map.take("type").toString();
+        QVariant slotVar = map.take("keyslots");
+        if (slotVar.canConvert<QDBusArgument>())
+            slotVar = qdbus_cast<QVariantList>(slotVar.value<QDBusArgument>());
+        const QVariantList &slotList = slotVar.toList();
+        for (const auto &slot : slotList)
+            token.keyslots.append(slot.toInt());
+        token.kekPriv = map.take("kek-priv").toByteArray();
+        token.kekPub = map.take("kek-pub").toByteArray();
+        token.iv = map.take("iv").toByteArray();
+        token.enc = map.take("enc").toByteArray();
+        token.primaryKeyAlg = map.take("primary-key-alg").toString();
+        token.primaryHashAlg = map.take("primary-hash-alg").toString();
+        token.sessionKeyAlg = map.take("session-key-alg").toString();
+        token.sessionHashAlg = map.take("session-hash-alg").toString();
+        token.pcr = map.take("pcr").toString();
+        token.pcrBank = map.take("pcr-bank").toString();
+        token.pin = map.take("pin").toBool();
+        token.extras = QJsonObject::fromVariantMap(map);
+        return token;
+    }
+
+    // nested maps arrive as QDBusArgument when received from DBus.
+    static inline UsecToken fromVariant(const QVariant &var)
+    {
+        if (var.canConvert<QDBusArgument>())
+            return fromVariantMap(qdbus_cast<QVariantMap>(var.value<QDBusArgument>()));
+        return fromVariantMap(var.toMap());
+    }
+};
+
+}   // namespace disk_encrypt
+
+#endif   // USECTOKEN_H
@@ -28,6 +28,9 @@ inline constexpr char kDaemonBusName[] { "com.deepin.filemanager.daemon" };
 inline constexpr char kDaemonBusPath[] { "/com/deepin/filemanager/daemon/DiskEncrypt" };
 inline constexpr char kDaemonBusIface[] { "com.deepin.filemanager.daemon.DiskEncrypt" };
 
+// same as the daemon, the headers are named by PARTUUID.
+inline constexpr char kDetachedHeaderDir[] { "/boot/usec-crypt/headers" };
+
 inline constexpr char kMenuPluginName[] { "dfmplugin_menu" };
 inline constexpr char kComputerMenuSceneName[] { "ComputerMenu" };
 
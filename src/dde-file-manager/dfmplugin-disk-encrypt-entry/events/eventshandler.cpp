@@ -15,6 +15,8 @@
 #include <QDBusConnection>
 #include <QDBusInterface>
 #include <QDBusPendingCall>
+#include <QDBusReply>
+#include <QtConcurrent>
 
 #include <DDialog>
 
@@ -25,6 +27,9 @@ using namespace dfmplugin_diskenc;
 using namespace disk_encrypt;
 DWIDGET_USE_NAMESPACE;
 
+// the kdf of a device and mounting it are done in one call.
+static constexpr int kUnlockTimeout { 120 * 1000 };
+
 EventsHandler *EventsHandler::instance()
 {
     static EventsHandler ins;
@@ -47,6 +52,7 @@ void EventsHandler::bindDaemonSignals()
     conn("DecryptDiskResult", SLOT(onDecryptResult(const QString &, const QString &, const QString &, int)));
     conn("DecryptProgress", SLOT(onDecryptProgress(const QString &, const QString &, double)));
     conn("ChangePassphressResult", SLOT(onChgPassphraseResult(const QString &, const QString &, const QString &, int)));
+    conn("ResealTPMTokensResult", SLOT(onResealResult(const QString &, const QVariantMap &, int)));
 }
 
 void EventsHandler::hookEvents()
@@ -85,14 +91,20 @@ void EventsHandler::onEncryptResult(const QString &dev, const QString &devName,
 
     QString title = tr("Encrypt done");
     QString msg = tr("Device %1 has been encrypted").arg(device);
-    if (code != 0) {
+    dialog_utils::DialogType type = dialog_utils::kInfo;
+    if (code == -kRebootRequired) {
+        // encrypted offline since it could not be opened for online encryption.
+        msg = tr("Device %1 has been encrypted, please unlock it or reboot to mount it again").arg(device);
+        type = dialog_utils::kWarning;
+    } else if (code != 0) {
         title = tr("Encrypt failed");
         msg = tr("Device %1 encrypt failed, please see log for more information.(%2)")
                       .arg(device)
                       .arg(code);
+        type = dialog_utils::kError;
     }
 
-    dialog_utils::showDialog(title, msg, code != 0 ? dialog_utils::kError : dialog_utils::kInfo);
+    dialog_utils::showDialog(title, msg, type);
 }
 
 void EventsHandler::onDecryptResult(const QString &dev, const QString &devName, const QString &, int code)
@@ -115,6 +127,51 @@ void EventsHandler::onChgPassphraseResult(const QString &dev, const QString &dev
     showChgPwdError(dev, devName, code);
 }
 
+void EventsHandler::onResealResult(const QString &, const QVariantMap &results, int code)
+{
+    QApplication::restoreOverrideCursor();
+    showResealResult(results, code);
+}
+
+void EventsHandler::setResealFailures(const QVariantMap &failures)
+{
+    resealFailures = failures;
+}
+
+void EventsHandler::showResealResult(const QVariantMap &results, int code)
+{
+    // devices failed before the job reached the daemon are reported as well.
+    QVariantMap all = resealFailures;
+    resealFailures.clear();
+    for (auto iter = results.cbegin(); iter != results.cend(); ++iter)
+        all.insert(iter.key(), iter.value());
+
+    QStringList done, failed;
+    for (auto iter = all.cbegin(); iter != all.cend(); ++iter) {
+        if (iter.value().toInt() == kSuccess)
+            done.append(iter.key().mid(5));
+        else
+            failed.append(QString("%1(%2)").arg(iter.key().mid(5)).arg(iter.value().toInt()));
+    }
+
+    // the job failed before any device was handled.
+    if (failed.isEmpty() && code != kSuccess)
+        failed.append(tr("partitions(%1)").arg(code));
+
+    if (failed.isEmpty()) {
+        dialog_utils::showDialog(tr("Rebind TPM done"),
+                                 tr("TPM of %1 partition(s) has been rebound").arg(done.count()),
+                                 dialog_utils::kInfo);
+        return;
+    }
+
+    QString msg = tr("Rebind TPM of %1 failed, please see log for more information.")
+                          .arg(failed.join(", "));
+    if (!done.isEmpty())
+        msg += "\n" + tr("TPM of %1 has been rebound.").arg(done.join(", "));
+    dialog_utils::showDialog(tr("Rebind TPM failed"), msg, dialog_utils::kError);
+}
+
 void EventsHandler::onEncryptProgress(const QString &dev, const QString &devName, double progress)
 {
     if (!encryptDialogs.contains(dev)) {
@@ -145,6 +202,44 @@ void EventsHandler::onDecryptProgress(const QString &dev, const QString &devName
     dlg->show();
 }
 
+void EventsHandler::unlockDeferredDevices()
+{
+    // unsealing by tpm and the kdf take seconds for each device, none of
+    // them is done on the gui thread. daemon mounts the devices as well.
+    QtConcurrent::run([] {
+        QDBusInterface iface(kDaemonBusName,
+                             kDaemonBusPath,
+                             kDaemonBusIface,
+                             QDBusConnection::systemBus());
+        if (!iface.isValid())
+            return;
+        iface.setTimeout(kUnlockTimeout);
+
+        QDBusReply<QStringList> reply = iface.call("ClaimDeferredUnlock");
+        const QStringList &devices = reply.value();
+        for (const auto &dev : devices) {
+            // the token cache is gone after reboot, query it again.
+            if (device_utils::encKeyType(dev) != kTPMOnly) {
+                qWarning() << "deferred device is not unlocked by tpm only, skip" << dev;
+                continue;
+            }
+
+            QString passphrase = tpm_passphrase_utils::getPassphraseFromTPM(dev, "");
+            if (passphrase.isEmpty()) {
+                qWarning() << "cannot get passphrase from tpm for deferred device" << dev;
+                continue;
+            }
+
+            QVariantMap options { { encrypt_param_keys::kKeyDeferredUnlock, true } };
+            QDBusReply<QString> unlocked = iface.call("UnlockDevice", dev, passphrase, options);
+            if (!unlocked.isValid())
+                qWarning() << "unlock deferred device failed" << dev << unlocked.error().message();
+            else
+                qInfo() << "deferred device unlocked:" << dev << unlocked.value();
+        }
+    });
+}
+
 bool EventsHandler::onAcquireDevicePwd(const QString &dev, QString *pwd, bool *cancelled)
 {
     if (!pwd || !cancelled)
@@ -167,7 +262,9 @@ bool EventsHandler::onAcquireDevicePwd(const QString &dev, QString *pwd, bool *c
 
     if (pwd->isEmpty() && !*cancelled) {
         QString title;
-        if (type == kTPMAndPIN)
+        if (type != kPasswordOnly && tpm_utils::lockoutStatus().locked())
+            title = tr("TPM is locked");
+        else if (type == kTPMAndPIN)
             title = tr("Wrong PIN");
         else if (type == kPasswordOnly)
             title = tr("Wrong passphrase");
@@ -230,6 +327,12 @@ void EventsHandler::showPreEncryptError(const QString &dev, const QString &devNa
         title = tr("Encrypt disk");
         msg = tr("User cancelled operation");
         break;
+    case kErrorUnmountFailed:
+        title = tr("Encrypt failed");
+        msg = tr("Device %1 is busy, please close the files opened on it and try again.")
+                      .arg(device);
+        showError = true;
+        break;
     default:
         title = tr("Preencrypt failed");
         msg = tr("Device %1 preencrypt failed, please see log for more information.(%2)")
@@ -6,6 +6,7 @@
 
 #include <QObject>
 #include <QMap>
+#include <QVariantMap>
 
 namespace dfmplugin_diskenc {
 class EncryptProcessDialog;
@@ -18,6 +19,9 @@ public:
     void hookEvents();
     bool hasEnDecryptJob();
     bool onAcquireDevicePwd(const QString &dev, QString *pwd, bool *giveup);
+    void unlockDeferredDevices();
+    void setResealFailures(const QVariantMap &failures);
+    void showResealResult(const QVariantMap &results, int code = 0);
 
 private Q_SLOTS:
     void onPreencryptResult(const QString &, const QString &, const QString &, int);
@@ -26,6 +30,7 @@ private Q_SLOTS:
     void onDecryptResult(const QString &, const QString &, const QString &, int);
     void onDecryptProgress(const QString &, const QString &, double);
     void onChgPassphraseResult(const QString &, const QString &, const QString &, int);
+    void onResealResult(const QString &, const QVariantMap &, int);
 
     QString acquirePassphrase(const QString &dev, bool &cancelled);
     QString acquirePassphraseByPIN(const QString &dev, bool &cancelled);
@@ -44,6 +49,7 @@ private:
 
     QMap<QString, EncryptProcessDialog *> encryptDialogs;
     QMap<QString, EncryptProcessDialog *> decryptDialogs;
+    QVariantMap resealFailures;
 signals:
 };
 }
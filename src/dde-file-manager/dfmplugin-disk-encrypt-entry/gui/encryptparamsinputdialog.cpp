@@ -19,6 +19,8 @@
 #include <QEventLoop>
 #include <QtConcurrent/QtConcurrent>
 #include <QAbstractButton>
+#include <QTimer>
+#include <QFileInfo>
 
 #include <DDialog>
 #include <DPasswordEdit>
@@ -26,6 +28,8 @@
 #include <DFileChooserEdit>
 #include <DSpinner>
 
+#include <mntent.h>
+
 using namespace dfmplugin_diskenc;
 using namespace disk_encrypt;
 DWIDGET_USE_NAMESPACE
@@ -36,6 +40,9 @@ enum StepPage {
     kConfirmPage,
 };
 
+// the path is validated only after typing paused for a while.
+static constexpr int kExpPathDebounce { 300 };   // ms
+
 EncryptParamsInputDialog::EncryptParamsInputDialog(const disk_encrypt::DeviceEncryptParam &params,
                                                    QWidget *parent)
     : DTK_WIDGET_NAMESPACE::DDialog(parent),
@@ -43,6 +50,8 @@ EncryptParamsInputDialog::EncryptParamsInputDialog(const disk_encrypt::DeviceEnc
 {
     initUi();
     initConn();
+    // ready by the time the export page is shown.
+    reloadMountTable();
 }
 
 DeviceEncryptParam EncryptParamsInputDialog::getInputs()
@@ -97,6 +106,35 @@ void EncryptParamsInputDialog::initConn()
             this, &EncryptParamsInputDialog::onEncTypeChanged);
     connect(keyExportInput, &DFileChooserEdit::textChanged,
             this, [this](const QString &path) { onExpPathChanged(path, false); });
+
+    expPathTimer = new QTimer(this);
+    expPathTimer->setSingleShot(true);
+    expPathTimer->setInterval(kExpPathDebounce);
+    connect(expPathTimer, &QTimer::timeout,
+            this, &EncryptParamsInputDialog::validateExportPathAsync);
+
+    // a new future replaces the former one, stale results are never reported.
+    expPathWatcher = new QFutureWatcher<QString>(this);
+    connect(expPathWatcher, &QFutureWatcher<QString>::finished, this, [this] {
+        auto btnNext = getButton(1);
+        if (!btnNext || pagesLay->currentIndex() != kExportKeyPage)
+            return;
+        const QString &msg = expPathWatcher->result();
+        btnNext->setEnabled(msg.isEmpty());
+        if (!msg.isEmpty() && !expPathSilent)
+            keyExportInput->showAlertMessage(msg);
+    });
+
+    // a device mounted or unmounted while the dialog is open changes where
+    // the key can be exported to.
+    using namespace dfmmount;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    if (monitor) {
+        connect(monitor.data(), &DBlockMonitor::mountAdded,
+                this, &EncryptParamsInputDialog::reloadMountTable);
+        connect(monitor.data(), &DBlockMonitor::mountRemoved,
+                this, &EncryptParamsInputDialog::reloadMountTable);
+    }
 }
 
 QWidget *EncryptParamsInputDialog::createPasswordPage()
@@ -130,16 +168,32 @@ QWidget *EncryptParamsInputDialog::createPasswordPage()
                         tr("Use TPM+PIN to unlock on this computer (recommended)"),
                         tr("Automatic unlocking on this computer by TPM") });
 
-    if (tpm_utils::checkTPM() != 0) {
-        encType->setItemData(kTPMAndPIN, QVariant(0), Qt::UserRole - 1);
-        encType->setItemData(kTPMOnly, QVariant(0), Qt::UserRole - 1);
+    // TPM options stay disabled until the probe answers, the probe may take
+    // seconds on a busy or broken TPM and must not hold the dialog.
+    encType->setItemData(kTPMAndPIN, QVariant(0), Qt::UserRole - 1);
+    encType->setItemData(kTPMOnly, QVariant(0), Qt::UserRole - 1);
+    encType->setCurrentIndex(kPasswordOnly);
+    onEncTypeChanged(kPasswordOnly);
+
+    auto tpmWatcher = new QFutureWatcher<int>(this);
+    connect(tpmWatcher, &QFutureWatcher<int>::finished, this, [this, tpmWatcher] {
+        tpmWatcher->deleteLater();
+        int ret = tpmWatcher->result();
+        if (ret != 0) {
+            qWarning() << "TPM is not available:" << ret;
+            return;
+        }
 
-        encType->setCurrentIndex(kPasswordOnly);
-        onEncTypeChanged(kPasswordOnly);
-    } else {
-        encType->setCurrentIndex(kTPMAndPIN);
-        onEncTypeChanged(kTPMAndPIN);
-    }
+        encType->setItemData(kTPMAndPIN, QVariant(), Qt::UserRole - 1);
+        encType->setItemData(kTPMOnly, QVariant(), Qt::UserRole - 1);
+        // recommend TPM+PIN only if user has not begun with passphrase.
+        if (encType->currentIndex() == kPasswordOnly
+            && encKeyEdit1->text().isEmpty() && encKeyEdit2->text().isEmpty()) {
+            encType->setCurrentIndex(kTPMAndPIN);
+            onEncTypeChanged(kTPMAndPIN);
+        }
+    });
+    tpmWatcher->setFuture(QtConcurrent::run([] { return tpm_utils::checkTPM(); }));
 
     return wid;
 }
@@ -244,40 +298,85 @@ bool EncryptParamsInputDialog::validatePassword()
     return true;
 }
 
-bool EncryptParamsInputDialog::validateExportPath(const QString &path, QString *msg)
+EncryptParamsInputDialog::MountTable EncryptParamsInputDialog::loadMountTable()
 {
-    auto setMsg = [&](const QString &info) { if (msg) *msg = info; };
-    if (path.isEmpty()) {
-        setMsg(tr("Recovery key export path cannot be empty!"));
-        return false;
-    }
-
-    if (!QDir(path).exists()) {
-        setMsg(tr("Recovery key export path is not exists!"));
-        return false;
-    }
-
-    QString dev = QStorageInfo(path).device();
-    if (dev == params.devDesc) {
-        setMsg(tr("Please export to an external device such as a non-encrypted partition or USB flash drive."));
-        return false;
+    MountTable table;
+    FILE *mtab = setmntent("/proc/self/mounts", "r");
+    if (mtab) {
+        struct mntent *ent = nullptr;
+        while ((ent = getmntent(mtab))) {
+            // /dev/mapper/xxx are links to /dev/dm-x.
+            QString dev = QFileInfo(ent->mnt_fsname).canonicalFilePath();
+            table.mounts.insert(ent->mnt_dir, dev.isEmpty() ? QString(ent->mnt_fsname) : dev);
+        }
+        endmntent(mtab);
     }
+    return table;
+}
 
+void EncryptParamsInputDialog::reloadMountTable()
+{
+    // the device objects of dfm-mount belong to the GUI thread, only the
+    // mount table is read in background.
+    QSet<QString> encrypted;
     using namespace dfmmount;
     auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
     Q_ASSERT(monitor);
-    auto devObjPaths = monitor->resolveDeviceNode(dev, {});
-    if (!devObjPaths.isEmpty()) {
-        auto objPath = devObjPaths.constFirst();
-        auto devPtr = monitor->createDeviceById(objPath);
-        if (devPtr && devPtr->getProperty(Property::kBlockCryptoBackingDevice).toString() != "/") {
-            setMsg(tr("The partition is encrypted, please export to a non-encrypted "
-                      "partition or external device such as a USB flash drive."));
-            return false;
-        }
+    const QStringList &objPaths = monitor->getDevices();
+    for (const auto &objPath : objPaths) {
+        auto devPtr = monitor->createDeviceById(objPath).objectCast<DBlockDevice>();
+        if (devPtr && devPtr->getProperty(Property::kBlockCryptoBackingDevice).toString() != "/")
+            encrypted.insert(devPtr->device());
     }
 
-    return true;
+    mountTable = QtConcurrent::run([encrypted] {
+        MountTable table = loadMountTable();
+        table.encryptedDevices = encrypted;
+        return table;
+    });
+
+    // the shown result may be stale now.
+    if (pagesLay->currentIndex() == kExportKeyPage)
+        onExpPathChanged(keyExportInput->text(), true);
+}
+
+QString EncryptParamsInputDialog::validateExportPath(const QString &path, const QString &selfDevice,
+                                                     const MountTable &table)
+{
+    if (path.isEmpty())
+        return tr("Recovery key export path cannot be empty!");
+
+    QString canonical = QFileInfo(path).canonicalFilePath();
+    if (canonical.isEmpty() || !QFileInfo(canonical).isDir())
+        return tr("Recovery key export path is not exists!");
+
+    // the deepest mount point containing the path.
+    QString mountPoint;
+    for (auto iter = table.mounts.cbegin(); iter != table.mounts.cend(); ++iter) {
+        const QString &mpt = iter.key();
+        bool contains = (mpt == "/") || canonical == mpt || canonical.startsWith(mpt + "/");
+        if (contains && mpt.length() > mountPoint.length())
+            mountPoint = mpt;
+    }
+    const QString &dev = table.mounts.value(mountPoint);
+    if (dev == selfDevice)
+        return tr("Please export to an external device such as a non-encrypted partition or USB flash drive.");
+
+    if (table.encryptedDevices.contains(dev))
+        return tr("The partition is encrypted, please export to a non-encrypted "
+                  "partition or external device such as a USB flash drive.");
+
+    return "";
+}
+
+void EncryptParamsInputDialog::validateExportPathAsync()
+{
+    auto table = mountTable;
+    QString path = keyExportInput->text();
+    QString selfDevice = params.devDesc;
+    expPathWatcher->setFuture(QtConcurrent::run([table, path, selfDevice]() mutable {
+        return validateExportPath(path, selfDevice, table.result());
+    }));
 }
 
 void EncryptParamsInputDialog::setPasswordInputVisible(bool visible)
@@ -300,7 +399,7 @@ void EncryptParamsInputDialog::onButtonClicked(int idx)
             return;
         if (config_utils::exportKeyEnabled()) {
             pagesLay->setCurrentIndex(kExportKeyPage);
-            onExpPathChanged(keyExportInput->text(), true);
+            reloadMountTable();
         } else {
             pagesLay->setCurrentIndex(kConfirmPage);
         }
@@ -379,13 +478,20 @@ void EncryptParamsInputDialog::onEncTypeChanged(int type)
 
 void EncryptParamsInputDialog::onExpPathChanged(const QString &path, bool silent)
 {
+    Q_UNUSED(path)
     auto btnNext = getButton(1);
     if (!btnNext)
         return;
-    QString msg;
-    btnNext->setEnabled(validateExportPath(path, &msg));
-    if (!msg.isEmpty() && !silent)
-        keyExportInput->showAlertMessage(msg);
+
+    // not allowed to go on until the result arrives.
+    btnNext->setEnabled(false);
+    expPathSilent = silent;
+    if (silent) {
+        expPathTimer->stop();
+        validateExportPathAsync();
+    } else {
+        expPathTimer->start();
+    }
 }
 
 bool EncryptParamsInputDialog::encryptByTpm(const QString &deviceName)
@@ -10,6 +10,10 @@
 #include <dtkwidget_global.h>
 #include <DDialog>
 
+#include <QFuture>
+#include <QMap>
+#include <QSet>
+
 DWIDGET_BEGIN_NAMESPACE
 class DPasswordEdit;
 class DFileChooserEdit;
@@ -20,6 +24,9 @@ DWIDGET_END_NAMESPACE
 class QLabel;
 class QStackedLayout;
 class QLayout;
+class QTimer;
+template<typename T>
+class QFutureWatcher;
 
 namespace dfmplugin_diskenc {
 
@@ -37,7 +44,8 @@ protected:
     QWidget *createExportPage();
     QWidget *createConfirmLayout();
     bool validatePassword();
-    bool validateExportPath(const QString &path, QString *msg);
+    void validateExportPathAsync();
+    void reloadMountTable();
     void setPasswordInputVisible(bool visible);
 
 protected Q_SLOTS:
@@ -49,6 +57,16 @@ protected Q_SLOTS:
 private:
     bool encryptByTpm(const QString &deviceName);
 
+    // snapshot of mounts and encrypted devices, the export path is
+    // validated against it off the GUI thread.
+    struct MountTable
+    {
+        QMap<QString, QString> mounts;   // mount point -> device node
+        QSet<QString> encryptedDevices;   // cleartext devices of encrypted partitions
+    };
+    static MountTable loadMountTable();
+    static QString validateExportPath(const QString &path, const QString &selfDevice, const MountTable &table);
+
 private:
     DTK_WIDGET_NAMESPACE::DComboBox *encType { nullptr };
     DTK_WIDGET_NAMESPACE::DPasswordEdit *encKeyEdit1 { nullptr };
@@ -61,7 +79,10 @@ private:
     QStackedLayout *pagesLay { nullptr };
 
 private:
-    bool expPathValid { false };
+    QTimer *expPathTimer { nullptr };
+    QFutureWatcher<QString> *expPathWatcher { nullptr };
+    QFuture<MountTable> mountTable;
+    bool expPathSilent { false };
     QString tpmPassword;
     disk_encrypt::DeviceEncryptParam params;
 };
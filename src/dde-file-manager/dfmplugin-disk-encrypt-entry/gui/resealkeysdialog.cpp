@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "resealkeysdialog.h"
+#include "utils/encryptutils.h"
+
+#include <QFormLayout>
+#include <QLabel>
+
+using namespace dfmplugin_diskenc;
+ResealKeysDialog::ResealKeysDialog(const QStringList &devices, QWidget *parent)
+    : Dtk::Widget::DDialog(parent), devices(devices)
+{
+    initUI();
+    connect(this, &ResealKeysDialog::buttonClicked,
+            this, &ResealKeysDialog::onButtonClicked);
+}
+
+QMap<QString, QString> ResealKeysDialog::getKeys()
+{
+    QMap<QString, QString> keys;
+    for (auto iter = editors.cbegin(); iter != editors.cend(); ++iter) {
+        QString key = iter.value()->text();
+        key.remove("-");
+        if (!key.isEmpty())
+            keys.insert(iter.key(), key);
+    }
+    return keys;
+}
+
+void ResealKeysDialog::onKeyChanged(const QString &key)
+{
+    auto editor = qobject_cast<Dtk::Widget::DPasswordEdit *>(sender());
+    if (!editor)
+        return;
+    QSignalBlocker blocker(editor);
+    editor->setText(recovery_key_utils::formatRecoveryKey(key));
+}
+
+void ResealKeysDialog::onButtonClicked(int idx)
+{
+    if (idx != 1) {
+        reject();
+        return;
+    }
+
+    // empty keys mean the device is skipped, the filled ones must be valid.
+    bool valid = true;
+    for (auto editor : editors) {
+        QString key = editor->text();
+        key.remove("-");
+        if (!key.isEmpty() && key.length() != 24) {
+            editor->showAlertMessage(tr("Recovery key is not valid!"));
+            valid = false;
+        }
+    }
+    if (!valid)
+        return;
+
+    if (getKeys().isEmpty()) {
+        editors.first()->showAlertMessage(tr("Recovery key cannot be empty!"));
+        return;
+    }
+
+    accept();
+}
+
+void ResealKeysDialog::initUI()
+{
+    setIcon(QIcon::fromTheme("drive-harddisk-root"));
+    setTitle(tr("Rebind TPM"));
+    setMessage(tr("TPM of the following partitions cannot be unsealed, "
+                  "please input their recovery keys. Partitions left empty are skipped."));
+    QFrame *content = new QFrame(this);
+    QFormLayout *lay = new QFormLayout(content);
+    for (const auto &dev : devices) {
+        auto editor = new Dtk::Widget::DPasswordEdit(this);
+        editor->setEchoMode(QLineEdit::Normal);
+        editor->setEchoButtonIsVisible(false);
+        editor->setPlaceholderText(tr("Please input recovery key"));
+        connect(editor, &Dtk::Widget::DPasswordEdit::textChanged,
+                this, &ResealKeysDialog::onKeyChanged);
+        lay->addRow(new QLabel(dev.mid(5), this), editor);
+        editors.insert(dev, editor);
+    }
+    addContent(content);
+    addButton(tr("Cancel"));
+    addButton(tr("Confirm"), true, ButtonRecommend);
+    setOnButtonClickedClose(false);
+}
@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef RESEALKEYSDIALOG_H
+#define RESEALKEYSDIALOG_H
+
+#include <ddialog.h>
+#include <dpasswordedit.h>
+
+#include <QMap>
+
+namespace dfmplugin_diskenc {
+
+// collects the recovery keys of all the devices that cannot be unsealed
+// anymore, so rebinding tpm asks the user only once.
+class ResealKeysDialog : public Dtk::Widget::DDialog
+{
+    Q_OBJECT
+public:
+    explicit ResealKeysDialog(const QStringList &devices, QWidget *parent = nullptr);
+    QMap<QString, QString> getKeys();
+
+protected:
+    void onKeyChanged(const QString &key);
+    void onButtonClicked(int idx);
+
+protected:
+    void initUI();
+
+private:
+    QStringList devices;
+    QMap<QString, Dtk::Widget::DPasswordEdit *> editors;
+};
+
+}
+#endif   // RESEALKEYSDIALOG_H
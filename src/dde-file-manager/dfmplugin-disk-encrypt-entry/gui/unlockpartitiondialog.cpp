@@ -37,10 +37,14 @@ void UnlockPartitionDialog::initUI()
     QFrame *content = new QFrame;
     passwordLineEdit = new DPasswordEdit;
     chgUnlockType = new DCommandLinkButton("");
+    lockoutHint = new QLabel;
+    lockoutHint->setWordWrap(true);
+    lockoutHint->setVisible(false);
 
     QVBoxLayout *mainLayout = new QVBoxLayout;
     mainLayout->addSpacing(10);
     mainLayout->addWidget(passwordLineEdit);
+    mainLayout->addWidget(lockoutHint);
     mainLayout->addWidget(chgUnlockType, 0, Qt::AlignRight);
     mainLayout->addSpacing(10);
     content->setLayout(mainLayout);
@@ -67,7 +71,7 @@ void UnlockPartitionDialog::initConnect()
             passwordLineEdit->setText(newText);
         }
         auto unlockBtn = getButton(1);
-        if (unlockBtn) unlockBtn->setEnabled(newText.length() != 0);
+        if (unlockBtn) unlockBtn->setEnabled(newText.length() != 0 && !(currType == kPin && tpmLocked));
     });
 }
 
@@ -97,6 +101,37 @@ void UnlockPartitionDialog::updateUserHint()
         passwordLineEdit->setPlaceholderText(tr("Please input PIN to unlock device"));
         break;
     }
+    updateLockoutHint();
+}
+
+void UnlockPartitionDialog::updateLockoutHint()
+{
+    // every wrong PIN is counted by the TPM, let user know how many are
+    // left before spending one. the counters are read by daemon.
+    tpmLocked = false;
+    lockoutHint->setVisible(false);
+    if (currType != kPin)
+        return;
+
+    tpm_utils::queryLockoutStatus(this, [this](const tpm_utils::LockoutStatus &status) {
+        if (currType != kPin || !status.valid || status.maxTries <= 0)
+            return;
+
+        tpmLocked = status.locked();
+        if (tpmLocked) {
+            if (status.recoverySeconds > 0)
+                lockoutHint->setText(tr("TPM is locked for too many wrong PINs, please retry in %1 minute(s) or unlock by recovery key.")
+                                             .arg((status.recoverySeconds + 59) / 60));
+            else
+                lockoutHint->setText(tr("TPM is locked for too many wrong PINs, please unlock by recovery key."));
+            passwordLineEdit->setEnabled(false);
+            auto unlockBtn = getButton(1);
+            if (unlockBtn) unlockBtn->setEnabled(false);
+        } else {
+            lockoutHint->setText(tr("%1 attempt(s) left before TPM is locked.").arg(status.remainingTries()));
+        }
+        lockoutHint->setVisible(true);
+    });
 }
 
 void UnlockPartitionDialog::handleButtonClicked(int index, QString text)
@@ -123,6 +158,7 @@ void UnlockPartitionDialog::switchUnlockType()
         currType = initType;
     else if (currType == kPin || currType == kPwd)
         currType = kRec;
+    passwordLineEdit->setEnabled(true);
     passwordLineEdit->clear();
     updateUserHint();
 }
@@ -34,6 +34,7 @@ protected Q_SLOTS:
     void handleButtonClicked(int index, QString text);
     void switchUnlockType();
     void updateUserHint();
+    void updateLockoutHint();
 
 protected:
     void showEvent(QShowEvent *event);
@@ -43,6 +44,8 @@ protected:
 private:
     DTK_WIDGET_NAMESPACE::DPasswordEdit *passwordLineEdit = nullptr;
     Dtk::Widget::DCommandLinkButton *chgUnlockType = nullptr;
+    QLabel *lockoutHint = nullptr;
+    bool tpmLocked { false };
     QString key = "";
     UnlockType currType { kPin };
     UnlockType initType { kPin };
@@ -7,6 +7,7 @@
 #include "gui/encryptparamsinputdialog.h"
 #include "gui/decryptparamsinputdialog.h"
 #include "gui/chgpassphrasedialog.h"
+#include "gui/resealkeysdialog.h"
 #include "events/eventshandler.h"
 #include "utils/encryptutils.h"
 
@@ -23,6 +24,9 @@
 #include <QStringList>
 #include <QDBusInterface>
 #include <QDBusReply>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QTimer>
 #include <QApplication>
 
 #include <ddialog.h>
@@ -38,6 +42,7 @@ static constexpr char kActIDEncrypt[] { "de_0_encrypt" };
 static constexpr char kActIDUnlock[] { "de_0_unlock" };
 static constexpr char kActIDDecrypt[] { "de_1_decrypt" };
 static constexpr char kActIDChangePwd[] { "de_2_changePwd" };
+static constexpr char kActIDReseal[] { "de_3_reseal" };
 
 DiskEncryptMenuScene::DiskEncryptMenuScene(QObject *parent)
     : AbstractMenuScene(parent)
@@ -57,8 +62,13 @@ QString DiskEncryptMenuScene::name() const
 bool DiskEncryptMenuScene::initialize(const QVariantHash &params)
 {
     QList<QUrl> selectedItems = params.value(MenuParamKey::kSelectFiles).value<QList<QUrl>>();
-    if (selectedItems.isEmpty())
-        return false;
+    if (selectedItems.isEmpty()) {
+        // rebinding TPM works on all the bound devices at once, it is offered
+        // in the blank area of computer view rather than in a device menu.
+        resealOnly = params.value(MenuParamKey::kIsEmptyArea, false).toBool()
+                && !device_utils::tpmBoundDevices().isEmpty();
+        return resealOnly;
+    }
 
     auto selectedItem = selectedItems.first();
     if (!selectedItem.path().endsWith("blockdev"))
@@ -82,17 +92,32 @@ bool DiskEncryptMenuScene::initialize(const QVariantHash &params)
 
     const QString &idType = selectedItemInfo.value("IdType").toString();
     const QStringList &supportedFS { "ext4", "ext3", "ext2" };
+    // these cannot be shrunk to make room for the header, the header is
+    // kept in /boot instead.
+    const QStringList &detachedFS { "xfs", "btrfs" };
+    // the data of a device encrypted with a detached header has no
+    // signature, it is told by the header kept in /boot.
+    const bool detachedEncrypted = idType != "crypto_LUKS" && device_utils::hasDetachedHeader(device);
     if (idType == "crypto_LUKS") {
         if (selectedItemInfo.value("IdVersion").toString() == "1")
             return false;
         itemEncrypted = true;
-    } else if (!supportedFS.contains(idType)) {
+    } else if (detachedEncrypted) {
+        itemEncrypted = true;
+    } else if (!supportedFS.contains(idType) && !detachedFS.contains(idType)) {
         return false;
     }
 
     QString devMpt = selectedItemInfo.value("MountPoint", "").toString();
     if (devMpt.isEmpty() && selectedItemInfo.contains("ClearBlockDeviceInfo"))
         devMpt = selectedItemInfo.value("ClearBlockDeviceInfo").toHash().value("MountPoint").toString();
+    // udisks does not map it to its cleartext device either.
+    QString clearDev;
+    if (detachedEncrypted) {
+        clearDev = device_utils::clearDevice(device);
+        if (!clearDev.isEmpty())
+            devMpt = device_utils::mountPoint(clearDev);
+    }
 
     QStringList disablePaths { "/boot/efi", "/boot", "/swap" };
     bool disable = std::any_of(disablePaths.cbegin(), disablePaths.cend(),
@@ -112,7 +137,35 @@ bool DiskEncryptMenuScene::initialize(const QVariantHash &params)
 
     selectionMounted = !devMpt.isEmpty();
     param.devDesc = device;
-    param.initOnly = fstab_utils::isFstabItem(devMpt);
+    // mounted ext4 data partitions are encrypted and decrypted online, only
+    // the root partition still requires a reboot to finish the job.
+    bool fstabItem = fstab_utils::isFstabItem(devMpt);
+    // nothing on a detached device tells it's encrypted, it's unlocked at
+    // boot only by its crypttab entry, which is written for fstab items,
+    // with the header found by PARTUUID. the root partition is opened by
+    // initramfs before /boot is there.
+    const bool detachedUsable = fstabItem && devMpt != "/" && device_utils::hasPartUUID(device);
+    if (detachedEncrypted) {
+        param.detachedHeader = true;
+    } else if (detachedFS.contains(idType)) {
+        param.detachedHeader = true;
+        detachedUnsupported = !detachedUsable;
+        if (detachedUnsupported)
+            qInfo() << device << "cannot be encrypted with a detached header";
+    } else if (!itemEncrypted) {
+        // ext is shrunk for the header where it cannot be detached.
+        param.detachedHeader = detachedUsable && config_utils::detachedHeaderEnabled();
+    }
+
+    if (detachedEncrypted) {
+        // udisks cannot lock it, it's decrypted through the mapping while
+        // unlocked and offline otherwise.
+        param.online = !clearDev.isEmpty();
+        param.initOnly = false;
+    } else {
+        param.online = fstabItem && devMpt != "/" && (itemEncrypted || idType == "ext4" || param.detachedHeader);
+        param.initOnly = fstabItem && !param.online;
+    }
     param.uuid = selectedItemInfo.value("IdUUID", "").toString();
     param.deviceDisplayName = info->displayOf(dfmbase::FileInfo::kFileDisplayName);
     param.type = SecKeyType::kPasswordOnly;
@@ -125,6 +178,14 @@ bool DiskEncryptMenuScene::initialize(const QVariantHash &params)
 bool DiskEncryptMenuScene::create(QMenu *)
 {
     bool hasJob = EventsHandler::instance()->hasEnDecryptJob();
+    if (resealOnly) {
+        QAction *act = new QAction(tr("Rebind TPM of encrypted partitions"));
+        act->setProperty(ActionPropertyKey::kActionID, kActIDReseal);
+        actions.insert(kActIDReseal, act);
+        act->setEnabled(!hasJob);
+        return true;
+    }
+
     if (itemEncrypted) {
         QAction *act = nullptr;
 
@@ -151,7 +212,7 @@ bool DiskEncryptMenuScene::create(QMenu *)
         QAction *act = new QAction(tr("Enable partition encryption"));
         act->setProperty(ActionPropertyKey::kActionID, kActIDEncrypt);
         actions.insert(kActIDEncrypt, act);
-        act->setEnabled(!hasJob);
+        act->setEnabled(!hasJob && !detachedUnsupported);
     }
 
     return true;
@@ -162,13 +223,17 @@ bool DiskEncryptMenuScene::triggered(QAction *action)
     QString actID = action->property(ActionPropertyKey::kActionID).toString();
 
     if (actID == kActIDEncrypt)
-        param.initOnly ? encryptDevice(param) : unmountBefore(encryptDevice);
+        (param.initOnly || param.online) ? encryptDevice(param) : unmountBefore(encryptDevice);
     else if (actID == kActIDDecrypt)
-        param.initOnly ? doDecryptDevice(param) : unmountBefore(deencryptDevice);
+        // a locked detached device has nothing to unmount.
+        param.initOnly ? doDecryptDevice(param)
+                       : ((param.online || param.detachedHeader) ? deencryptDevice(param) : unmountBefore(deencryptDevice));
     else if (actID == kActIDChangePwd)
         changePassphrase(param);
     else if (actID == kActIDUnlock)
         unlockDevice(selectedItemInfo.value("Id").toString());
+    else if (actID == kActIDReseal)
+        resealTPMDevices();
     else
         return false;
     return true;
@@ -189,7 +254,8 @@ void DiskEncryptMenuScene::updateState(QMenu *parent)
         }
     }
 
-    if (!before)
+    // the blank area menu may be empty, actions are appended then.
+    if (!before && !acts.isEmpty())
         before = acts.last();
 
     std::for_each(actions.begin(), actions.end(), [=](QAction *val) {
@@ -204,11 +270,29 @@ void DiskEncryptMenuScene::updateState(QMenu *parent)
 
 void DiskEncryptMenuScene::encryptDevice(const DeviceEncryptParam &param)
 {
+    // let daemon check the device while user is filling the params,
+    // the encrypt job reuses the results. the report of the cheap checks
+    // is asked again when the params are complete.
+    QDBusInterface iface(kDaemonBusName,
+                         kDaemonBusPath,
+                         kDaemonBusIface,
+                         QDBusConnection::systemBus());
+    if (iface.isValid()) {
+        QVariantMap params {
+            { encrypt_param_keys::kKeyDevice, param.devDesc },
+            { encrypt_param_keys::kKeyCipher, config_utils::cipherType() },
+            { encrypt_param_keys::kKeyDetachedHeader, param.detachedHeader }
+        };
+        iface.asyncCall("PreflightEncrypt", params);
+    }
+
     EncryptParamsInputDialog dlg(param, qApp->activeWindow());
     int ret = dlg.exec();
     if (ret == QDialog::Accepted) {
         auto inputs = dlg.getInputs();
         doEncryptDevice(inputs);
+    } else if (iface.isValid()) {
+        iface.asyncCall("CancelPreflight", param.devDesc);
     }
 }
 
@@ -281,6 +365,107 @@ void DiskEncryptMenuScene::changePassphrase(DeviceEncryptParam param)
     doChangePassphrase(param);
 }
 
+void DiskEncryptMenuScene::resealTPMDevices()
+{
+    // after the pcr policy changed (firmware or secure boot updated), all the
+    // tpm bound devices are rebound in one daemon job.
+    const QMap<QString, int> &devices = device_utils::tpmBoundDevices();
+    if (devices.isEmpty())
+        return;
+
+    // the PIN is asked once and used for all the devices bound with PIN.
+    QString pin;
+    if (devices.values().contains(kTPMAndPIN)) {
+        DecryptParamsInputDialog dlg(devices.key(kTPMAndPIN));
+        dlg.setInputPIN(true);
+        if (dlg.exec() != QDialog::Accepted)
+            return;
+        if (dlg.usingRecKey()) {
+            dialog_utils::showDialog(tr("Rebind TPM failed"), tr("PIN is required to rebind TPM"),
+                                     dialog_utils::kError);
+            return;
+        }
+        pin = dlg.getKey();
+    }
+
+    // devices whose pcr are not changed can still be unsealed, the recovery
+    // keys of the others are collected in one dialog before sealing anything.
+    QMap<QString, QString> oldKeys;
+    QStringList locked;
+    for (auto iter = devices.cbegin(); iter != devices.cend(); ++iter) {
+        QString devPin = (iter.value() == kTPMAndPIN) ? pin : QString();
+        QString oldKey = tpm_passphrase_utils::getPassphraseFromTPM(iter.key(), devPin);
+        if (oldKey.isEmpty())
+            locked.append(iter.key());
+        else
+            oldKeys.insert(iter.key(), oldKey);
+    }
+
+    QMap<QString, QString> recKeys;
+    if (!locked.isEmpty()) {
+        ResealKeysDialog dlg(locked);
+        if (dlg.exec() == QDialog::Accepted)
+            recKeys = dlg.getKeys();
+    }
+
+    QVariantMap failures;
+    QVariantList resealParams;
+    for (auto iter = devices.cbegin(); iter != devices.cend(); ++iter) {
+        const QString &dev = iter.key();
+        QString devPin = (iter.value() == kTPMAndPIN) ? pin : QString();
+
+        bool byRecKey = recKeys.contains(dev);
+        QString oldKey = byRecKey ? recKeys.value(dev) : oldKeys.value(dev);
+        if (oldKey.isEmpty()) {
+            qInfo() << "skip rebinding tpm of" << dev;
+            continue;
+        }
+
+        QString newKey;
+        int ret = tpm_passphrase_utils::genPassphraseFromTPM(dev, devPin, &newKey);
+        if (ret != tpm_passphrase_utils::kTPMNoError) {
+            qWarning() << "cannot generate passphrase from tpm for" << dev << ret;
+            failures.insert(dev, ret);
+            continue;
+        }
+
+        UsecToken token = renewTPMToken(dev, !devPin.isEmpty());
+        if (!token.isTPM()) {
+            qWarning() << "cannot renew tpm token for" << dev;
+            failures.insert(dev, tpm_passphrase_utils::kTPMEncryptFailed);
+            continue;
+        }
+
+        resealParams.append(QVariantMap {
+                { encrypt_param_keys::kKeyDevice, dev },
+                { encrypt_param_keys::kKeyPassphrase, newKey },
+                { encrypt_param_keys::kKeyOldPassphrase, oldKey },
+                { encrypt_param_keys::kKeyValidateWithRecKey, byRecKey },
+                { encrypt_param_keys::kKeyTPMToken, token.toVariantMap() } });
+    }
+
+    // the devices failed here are reported together with the daemon results.
+    EventsHandler::instance()->setResealFailures(failures);
+    if (resealParams.isEmpty()) {
+        if (!failures.isEmpty())
+            EventsHandler::instance()->showResealResult({});
+        return;
+    }
+
+    QDBusInterface iface(kDaemonBusName,
+                         kDaemonBusPath,
+                         kDaemonBusIface,
+                         QDBusConnection::systemBus());
+    if (iface.isValid()) {
+        QDBusReply<QString> reply = iface.call("ResealTPMTokens",
+                                               QVariantMap { { encrypt_param_keys::kKeyDevices, resealParams } });
+        qDebug() << "reseal tpm tokens jobid:" << reply.value();
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+    } else if (!failures.isEmpty()) {
+        EventsHandler::instance()->showResealResult({});
+    }
+}
+
 void DiskEncryptMenuScene::unlockDevice(const QString &devObjPath)
 {
     auto blkDev = device_utils::createBlockDevice(devObjPath);
@@ -296,13 +481,69 @@ void DiskEncryptMenuScene::unlockDevice(const QString &devObjPath)
     }
 
     QApplication::setOverrideCursor(Qt::WaitCursor);
-    blkDev->unlockAsync(pwd, {}, onUnlocked);
+
+    // unlock by daemon, it knows which keyslot the passphrase belongs to.
+    QDBusInterface iface(kDaemonBusName,
+                         kDaemonBusPath,
+                         kDaemonBusIface,
+                         QDBusConnection::systemBus());
+    if (!iface.isValid()) {
+        // udisks cannot open the device of a detached header.
+        if (!blkDev->isEncrypted()) {
+            QApplication::restoreOverrideCursor();
+            qWarning() << "daemon is required to unlock" << blkDev->device();
+            return;
+        }
+        blkDev->unlockAsync(pwd, {}, onUnlocked);
+        return;
+    }
+
+    auto call = iface.asyncCall("UnlockDevice", blkDev->device(), pwd, QVariantMap());
+    auto watcher = new QDBusPendingCallWatcher(call);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished,
+                     [](QDBusPendingCallWatcher *w) {
+                         QDBusPendingReply<QString> reply = *w;
+                         w->deleteLater();
+                         if (reply.isError()) {
+                             QApplication::restoreOverrideCursor();
+                             qWarning() << "unlock device failed!" << reply.error().name() << reply.error().message();
+                             bool wrongPwd = reply.error().name().endsWith("WrongPassphrase");
+                             dialog_utils::showDialog(tr("Unlock device failed"),
+                                                      wrongPwd ? tr("Wrong passphrase") : "",
+                                                      dialog_utils::kError);
+                             return;
+                         }
+                         onDaemonUnlocked(reply.value(), 10);
+                     });
+}
+
+void DiskEncryptMenuScene::onDaemonUnlocked(const QString &clearDev, int retry)
+{
+    // the mapping is created outside of UDisks, wait for it to be synced.
+    QString objPath = device_utils::resolveDeviceObject(clearDev);
+    if (objPath.isEmpty() && retry > 0) {
+        QTimer::singleShot(200, qApp, [=] { onDaemonUnlocked(clearDev, retry - 1); });
+        return;
+    }
+
+    if (objPath.isEmpty()) {
+        QApplication::restoreOverrideCursor();
+        qWarning() << "cannot find the unlocked device" << clearDev;
+        dialog_utils::showDialog(tr("Mount device failed"), "", dialog_utils::kError);
+        return;
+    }
+    onUnlocked(true, {}, objPath);
 }
 
 void DiskEncryptMenuScene::doEncryptDevice(const DeviceEncryptParam &param)
 {
+    // all the cheap checks are done before sealing the key by tpm.
+    if (!preflightEncrypt(param))
+        return;
+
     // if tpm selected, use tpm to generate the key
-    QString tpmConfig, tpmToken;
+    QString tpmConfig;
+    UsecToken tpmToken;
     if (param.type != kPasswordOnly) {
         tpmConfig = generateTPMConfig();
         tpmToken = generateTPMToken(param.devDesc, param.type == kTPMAndPIN);
@@ -319,12 +560,16 @@ void DiskEncryptMenuScene::doEncryptDevice(const DeviceEncryptParam &param)
             { encrypt_param_keys::kKeyCipher, config_utils::cipherType() },
             { encrypt_param_keys::kKeyPassphrase, param.key },
             { encrypt_param_keys::kKeyInitParamsOnly, param.initOnly },
+            { encrypt_param_keys::kKeyOnlineMode, param.online },
+            { encrypt_param_keys::kKeyDetachedHeader, param.detachedHeader },
             { encrypt_param_keys::kKeyRecoveryExportPath, param.exportPath },
             { encrypt_param_keys::kKeyEncMode, static_cast<int>(param.type) },
-            { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName }
+            { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName },
+            // only tpm sealed keys can be unlocked without user after login.
+            { encrypt_param_keys::kKeyDeferredUnlock, param.type == kTPMOnly && config_utils::deferredUnlockEnabled() }
         };
         if (!tpmConfig.isEmpty()) params.insert(encrypt_param_keys::kKeyTPMConfig, tpmConfig);
-        if (!tpmToken.isEmpty()) params.insert(encrypt_param_keys::kKeyTPMToken, tpmToken);
+        if (tpmToken.isValid()) params.insert(encrypt_param_keys::kKeyTPMToken, tpmToken.toVariantMap());
 
         QDBusReply<QString> reply = iface.call("PrepareEncryptDisk", params);
         qDebug() << "preencrypt device jobid:" << reply.value();
@@ -332,6 +577,52 @@ void DiskEncryptMenuScene::doEncryptDevice(const DeviceEncryptParam &param)
     }
 }
 
+bool DiskEncryptMenuScene::preflightEncrypt(const DeviceEncryptParam &param)
+{
+    QDBusInterface iface(kDaemonBusName,
+                         kDaemonBusPath,
+                         kDaemonBusIface,
+                         QDBusConnection::systemBus());
+    if (!iface.isValid())
+        return true;
+
+    QVariantMap params {
+        { encrypt_param_keys::kKeyDevice, param.devDesc },
+        { encrypt_param_keys::kKeyCipher, config_utils::cipherType() },
+        { encrypt_param_keys::kKeyPassphrase, param.key },
+        { encrypt_param_keys::kKeyInitParamsOnly, param.initOnly },
+        { encrypt_param_keys::kKeyOnlineMode, param.online },
+        { encrypt_param_keys::kKeyDetachedHeader, param.detachedHeader },
+        { encrypt_param_keys::kKeyRecoveryExportPath, param.exportPath },
+    };
+    QDBusReply<QVariantMap> reply = iface.call("PreflightEncrypt", params);
+    // old daemon, the job checks by itself.
+    if (!reply.isValid())
+        return true;
+
+    const QVariantMap &report = reply.value();
+    int error = report.value("error").toInt();
+    if (error == kSuccess)
+        return true;
+    if (error == -kUserCancelled)
+        return false;
+
+    QStringList problems;
+    const QVariantList &checks = report.value("checks").toList();
+    for (const auto &var : checks) {
+        const QVariantMap &check = var.toMap();
+        if (check.value("error").toInt() != kSuccess)
+            problems.append(QString("%1: %2").arg(check.value("name").toString(),
+                                                   check.value("detail").toString()));
+    }
+    dialog_utils::showDialog(tr("Encrypt failed"),
+                             tr("Device %1 cannot be encrypted:\n%2")
+                                     .arg(param.deviceDisplayName)
+                                     .arg(problems.join("\n")),
+                             dialog_utils::kError);
+    return false;
+}
+
 void DiskEncryptMenuScene::doDecryptDevice(const DeviceEncryptParam &param)
 {
     // if tpm selected, use tpm to generate the key
@@ -344,6 +635,7 @@ void DiskEncryptMenuScene::doDecryptDevice(const DeviceEncryptParam &param)
             { encrypt_param_keys::kKeyDevice, param.devDesc },
             { encrypt_param_keys::kKeyPassphrase, param.key },
             { encrypt_param_keys::kKeyInitParamsOnly, param.initOnly },
+            { encrypt_param_keys::kKeyOnlineMode, param.online },
             { encrypt_param_keys::kKeyUUID, param.uuid },
             { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName }
         };
@@ -355,28 +647,12 @@ void DiskEncryptMenuScene::doDecryptDevice(const DeviceEncryptParam &param)
 
 void DiskEncryptMenuScene::doChangePassphrase(const DeviceEncryptParam &param)
 {
-    QString token;
+    UsecToken token;
     if (param.type != SecKeyType::kPasswordOnly) {
         // new tpm token should be setted.
-        QFile f(kGlobalTPMConfigPath + param.devDesc + "/token.json");
-        if (!f.open(QIODevice::ReadOnly)) {
-            qWarning() << "cannot read old tpm token!!!";
+        token = renewTPMToken(param.devDesc, param.type == SecKeyType::kTPMAndPIN);
+        if (!token.isTPM())
             return;
-        }
-        QJsonDocument oldTokenDoc = QJsonDocument::fromJson(f.readAll());
-        f.close();
-        QJsonObject oldTokenObj = oldTokenDoc.object();
-
-        QString newToken = generateTPMToken(param.devDesc, param.type == SecKeyType::kTPMAndPIN);
-        QJsonDocument newTokenDoc = QJsonDocument::fromJson(newToken.toLocal8Bit());
-        QJsonObject newTokenObj = newTokenDoc.object();
-
-        oldTokenObj.insert("enc", newTokenObj.value("enc"));
-        oldTokenObj.insert("kek-priv", newTokenObj.value("kek-priv"));
-        oldTokenObj.insert("kek-pub", newTokenObj.value("kek-pub"));
-        oldTokenObj.insert("iv", newTokenObj.value("iv"));
-        newTokenDoc.setObject(oldTokenObj);
-        token = newTokenDoc.toJson(QJsonDocument::Compact);
     }
 
     QDBusInterface iface(kDaemonBusName,
@@ -389,7 +665,7 @@ void DiskEncryptMenuScene::doChangePassphrase(const DeviceEncryptParam &param)
             { encrypt_param_keys::kKeyPassphrase, param.newKey },
             { encrypt_param_keys::kKeyOldPassphrase, param.key },
             { encrypt_param_keys::kKeyValidateWithRecKey, param.validateByRecKey },
-            { encrypt_param_keys::kKeyTPMToken, token },
+            { encrypt_param_keys::kKeyTPMToken, token.toVariantMap() },
             { encrypt_param_keys::kKeyDeviceName, param.deviceDisplayName }
         };
         QDBusReply<QString> reply = iface.call("ChangeEncryptPassphress", params);
@@ -418,11 +694,10 @@ QString DiskEncryptMenuScene::generateTPMConfig()
     return QJsonDocument(tpmParams).toJson();
 }
 
-QString DiskEncryptMenuScene::generateTPMToken(const QString &device, bool pin)
+UsecToken DiskEncryptMenuScene::generateTPMToken(const QString &device, bool pin)
 {
     QString tpmConfig = generateTPMConfig();
-    QJsonDocument doc = QJsonDocument::fromJson(tpmConfig.toLocal8Bit());
-    QJsonObject token = doc.object();
+    UsecToken token = UsecToken::fromJson(tpmConfig.toLocal8Bit());
 
     // keep same with usec.
     // https://gerrit.uniontech.com/plugins/gitiles/usec-crypt-kit/+/refs/heads/master/src/boot-crypt/util.cpp
@@ -438,29 +713,46 @@ QString DiskEncryptMenuScene::generateTPMToken(const QString &device, bool pin)
     // j["pcr"] = pcr;
     // j["pcr-bank"] = pcr_bank;
 
-    token.remove("keyslot");
-    token.insert("type", "usec-tpm2");
-    token.insert("keyslots", QJsonArray::fromStringList({ "0" }));
-    token.insert("kek-priv", getBase64Of(kGlobalTPMConfigPath + device + "/key.priv"));
-    token.insert("kek-pub", getBase64Of(kGlobalTPMConfigPath + device + "/key.pub"));
-    token.insert("iv", getBase64Of(kGlobalTPMConfigPath + device + "/iv.bin"));
-    token.insert("enc", getBase64Of(kGlobalTPMConfigPath + device + "/cipher.out"));
-    token.insert("pin", pin ? "1" : "0");
-
-    doc.setObject(token);
-    return doc.toJson(QJsonDocument::Compact);
+    token.extras.remove("keyslot");
+    token.type = kTokenTypeTPM;
+    token.keyslots = { 0 };
+    token.kekPriv = readBlob(kGlobalTPMConfigPath + device + "/key.priv");
+    token.kekPub = readBlob(kGlobalTPMConfigPath + device + "/key.pub");
+    token.iv = readBlob(kGlobalTPMConfigPath + device + "/iv.bin");
+    token.enc = readBlob(kGlobalTPMConfigPath + device + "/cipher.out");
+    token.pin = pin;
+    return token;
+}
+
+UsecToken DiskEncryptMenuScene::renewTPMToken(const QString &device, bool pin)
+{
+    QFile f(kGlobalTPMConfigPath + device + "/token.json");
+    if (!f.open(QIODevice::ReadOnly)) {
+        qWarning() << "cannot read old tpm token!!!";
+        return {};
+    }
+    UsecToken token = UsecToken::fromJson(f.readAll());
+    f.close();
+
+    // only the sealed blobs are changed.
+    UsecToken newToken = generateTPMToken(device, pin);
+    token.enc = newToken.enc;
+    token.kekPriv = newToken.kekPriv;
+    token.kekPub = newToken.kekPub;
+    token.iv = newToken.iv;
+    return token;
 }
 
-QString DiskEncryptMenuScene::getBase64Of(const QString &fileName)
+QByteArray DiskEncryptMenuScene::readBlob(const QString &fileName)
 {
     QFile f(fileName);
     if (!f.open(QIODevice::ReadOnly)) {
         qDebug() << "cannot read file of" << fileName;
-        return "";
+        return {};
     }
     QByteArray contents = f.readAll();
     f.close();
-    return QString(contents.toBase64());
+    return contents;
 }
 
 void DiskEncryptMenuScene::onUnlocked(bool ok, dfmmount::OperationErrorInfo info, QString clearDev)
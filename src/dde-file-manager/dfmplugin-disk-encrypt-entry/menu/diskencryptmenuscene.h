@@ -49,16 +49,20 @@ protected:
     static void deencryptDevice(const disk_encrypt::DeviceEncryptParam &param);
     static void changePassphrase(disk_encrypt::DeviceEncryptParam param);
     static void unlockDevice(const QString &dev);
+    static void resealTPMDevices();
 
     static void doEncryptDevice(const disk_encrypt::DeviceEncryptParam &param);
+    static bool preflightEncrypt(const disk_encrypt::DeviceEncryptParam &param);
     static void doDecryptDevice(const disk_encrypt::DeviceEncryptParam &param);
     static void doChangePassphrase(const disk_encrypt::DeviceEncryptParam &param);
 
     static QString generateTPMConfig();
-    static QString generateTPMToken(const QString &device, bool pin);
-    static QString getBase64Of(const QString &fileName);
+    static disk_encrypt::UsecToken generateTPMToken(const QString &device, bool pin);
+    static disk_encrypt::UsecToken renewTPMToken(const QString &device, bool pin);
+    static QByteArray readBlob(const QString &fileName);
 
     static void onUnlocked(bool ok, dfmmount::OperationErrorInfo, QString);
+    static void onDaemonUnlocked(const QString &clearDev, int retry);
     static void onMounted(bool ok, dfmmount::OperationErrorInfo, QString);
 
     void unmountBefore(const std::function<void(const disk_encrypt::DeviceEncryptParam &)> &after);
@@ -69,8 +73,11 @@ protected:
 private:
     QMap<QString, QAction *> actions;
 
+    bool resealOnly { false };
     bool itemEncrypted { false };
     bool selectionMounted { false };
+    // a detached device that could not be unlocked after encryption.
+    bool detachedUnsupported { false };
     QVariantHash selectedItemInfo;
 
     disk_encrypt::DeviceEncryptParam param;
@@ -7,6 +7,7 @@
 #include "events/eventshandler.h"
 
 #include <QTranslator>
+#include <QTimer>
 
 using namespace dfmplugin_diskenc;
 
@@ -38,6 +39,11 @@ bool DiskEncryptEntry::start()
     EventsHandler::instance()->bindDaemonSignals();
     EventsHandler::instance()->hookEvents();
 
+    // data partitions left locked during boot are unlocked once the session is up.
+    QTimer::singleShot(0, EventsHandler::instance(), [] {
+        EventsHandler::instance()->unlockDeferredDevices();
+    });
+
     return true;
 }
 
@@ -12,9 +12,25 @@
 #include <QSettings>
 #include <QDBusInterface>
 #include <QDBusReply>
-#include <QJsonObject>
-#include <QJsonDocument>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
 #include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QDeadlineTimer>
+#include <QtConcurrent>
+#include <QApplication>
+#include <QPointer>
+#include <QEventLoop>
+#include <QTimer>
+
+#include <functional>
+#include <atomic>
 
 #include <dconfig.h>
 #include <DDialog>
@@ -29,6 +45,12 @@ Q_DECLARE_METATYPE(QString *)
 
 using namespace dfmplugin_diskenc;
 
+// the daemon is asked again when the cached counters are older than this.
+static constexpr qint64 kLockoutCacheLifetime { 5000 };
+static tpm_utils::LockoutStatus gLockoutStatus;
+static QElapsedTimer gLockoutClock;
+static QMutex gLockoutMtx;
+
 bool config_utils::exportKeyEnabled()
 {
     auto cfg = Dtk::Core::DConfig::create("org.deepin.dde.file-manager",
@@ -49,6 +71,22 @@ QString config_utils::cipherType()
     return cipher;
 }
 
+bool config_utils::deferredUnlockEnabled()
+{
+    auto cfg = Dtk::Core::DConfig::create("org.deepin.dde.file-manager",
+                                          "org.deepin.dde.file-manager.diskencrypt");
+    cfg->deleteLater();
+    return cfg->value("deferredUnlock", false).toBool();
+}
+
+bool config_utils::detachedHeaderEnabled()
+{
+    auto cfg = Dtk::Core::DConfig::create("org.deepin.dde.file-manager",
+                                          "org.deepin.dde.file-manager.diskencrypt");
+    cfg->deleteLater();
+    return cfg->value("detachedHeader", false).toBool();
+}
+
 bool fstab_utils::isFstabItem(const QString &mpt)
 {
     if (mpt.isEmpty())
@@ -68,29 +106,219 @@ bool fstab_utils::isFstabItem(const QString &mpt)
     return fstabed;
 }
 
-int tpm_utils::checkTPM()
+namespace {
+// result of one tpm call, shared with the tpm thread running it since the
+// caller may be gone when it's finished.
+struct TPMCall
+{
+    QMutex mtx;
+    QWaitCondition cond;
+    bool done { false };
+    bool abandoned { false };   // the caller timed out before it started
+    int ret { 0 };
+    QString strOut;
+    bool boolOut { false };
+    QEventLoop *loop { nullptr };   // the main thread waiting, only touched there
+};
+}   // namespace
+
+// set when a call times out, cleared when the tpm thread gets to the next
+// tpm call. the calls in between fail at once instead of waiting for the
+// whole deadline each.
+static std::atomic_bool gTPMStuck { false };
+
+// the slots of encrypt manager load the tpm library for each call and keep
+// no state, they do not need the main thread. all the calls are run one by
+// one in this thread, a hung one cannot be killed but it never holds the
+// main thread.
+static QObject *tpmContext()
+{
+    static QObject *ctx = [] {
+        auto thread = new QThread;
+        thread->setObjectName("dfm_disk_encrypt_tpm");
+        QObject::connect(qApp, &QCoreApplication::aboutToQuit, thread, &QThread::quit);
+        thread->start();
+
+        auto obj = new QObject;
+        obj->moveToThread(thread);
+        return obj;
+    }();
+    return ctx;
+}
+
+static int callTPM(const char *name, int timeout,
+                   const std::function<int(TPMCall *)> &fn,
+                   QSharedPointer<TPMCall> call = QSharedPointer<TPMCall>::create())
+{
+    if (gTPMStuck) {
+        qWarning() << "TPM is not responding, call is refused:" << name;
+        return tpm_passphrase_utils::kTPMTimeout;
+    }
+
+    // a worker thread has no event loop to run, it waits on the condition.
+    const bool inMainThread = (QThread::currentThread() == qApp->thread());
+    QScopedPointer<QEventLoop> loop;
+    if (inMainThread) {
+        loop.reset(new QEventLoop);
+        call->loop = loop.data();
+    }
+
+    QMetaObject::invokeMethod(tpmContext(), [call, fn, inMainThread] {
+        {
+            QMutexLocker locker(&call->mtx);
+            if (call->abandoned) {
+                gTPMStuck = false;
+                return;
+            }
+        }
+        int ret = fn(call.data());
+        gTPMStuck = false;
+        {
+            QMutexLocker locker(&call->mtx);
+            call->ret = ret;
+            call->done = true;
+            call->cond.wakeAll();
+        }
+        if (inMainThread) {
+            QMetaObject::invokeMethod(qApp, [call] {
+                if (call->loop)
+                    call->loop->quit();
+            }, Qt::QueuedConnection);
+        }
+    }, Qt::QueuedConnection);
+
+    // the main thread keeps painting while it waits, user input is held
+    // back so that no other action starts in the middle of this one.
+    if (inMainThread) {
+        QTimer::singleShot(timeout, loop.data(), &QEventLoop::quit);
+        loop->exec(QEventLoop::ExcludeUserInputEvents);
+        call->loop = nullptr;
+    }
+
+    QMutexLocker locker(&call->mtx);
+    QDeadlineTimer deadline(inMainThread ? 0 : timeout);
+    while (!call->done) {
+        if (inMainThread || !call->cond.wait(&call->mtx, deadline)) {
+            qCritical() << "TPM call timed out:" << name << timeout << "ms";
+            call->abandoned = true;
+            gTPMStuck = true;
+            return tpm_passphrase_utils::kTPMTimeout;
+        }
+    }
+    return call->ret;
+}
+
+int tpm_utils::checkTPM(int timeout)
 {
-    return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_TPMIsAvailablePro").toInt();
+    return callTPM("checkTPM", timeout, [](TPMCall *) {
+        return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_TPMIsAvailablePro").toInt();
+    });
 }
 
-int tpm_utils::getRandomByTPM(int size, QString *output)
+int tpm_utils::getRandomByTPM(int size, QString *output, int timeout)
 {
-    return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_GetRandomByTPMPro", size, output).toInt();
+    auto call = QSharedPointer<TPMCall>::create();
+    int ret = callTPM("getRandom", timeout, [size](TPMCall *c) {
+        return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_GetRandomByTPMPro", size, &c->strOut).toInt();
+    }, call);
+    if (ret != tpm_passphrase_utils::kTPMTimeout && output)
+        *output = call->strOut;
+    return ret;
+}
+
+int tpm_utils::isSupportAlgoByTPM(const QString &algoName, bool *support, int timeout)
+{
+    auto call = QSharedPointer<TPMCall>::create();
+    int ret = callTPM("isSupportAlgo", timeout, [algoName](TPMCall *c) {
+        return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_IsTPMSupportAlgoPro", algoName, &c->boolOut).toInt();
+    }, call);
+    if (ret != tpm_passphrase_utils::kTPMTimeout && support)
+        *support = call->boolOut;
+    return ret;
+}
+
+int tpm_utils::encryptByTPM(const QVariantMap &map, int timeout)
+{
+    return callTPM("encrypt", timeout, [map](TPMCall *) {
+        return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_EncryptByTPMPro", map).toInt();
+    });
+}
+
+int tpm_utils::decryptByTPM(const QVariantMap &map, QString *psw, int timeout)
+{
+    auto call = QSharedPointer<TPMCall>::create();
+    int ret = callTPM("decrypt", timeout, [map](TPMCall *c) {
+        return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_DecryptByTPMPro", map, &c->strOut).toInt();
+    }, call);
+    if (ret != tpm_passphrase_utils::kTPMTimeout && psw)
+        *psw = call->strOut;
+    return ret;
+}
+
+static void requestLockoutStatus(const std::function<void()> &onReply)
+{
+    // the reply is delivered to the main loop, the worker threads only
+    // start the query there.
+    if (QThread::currentThread() != qApp->thread()) {
+        QMetaObject::invokeMethod(qApp, [onReply] { requestLockoutStatus(onReply); }, Qt::QueuedConnection);
+        return;
+    }
+
+    QDBusInterface iface(kDaemonBusName,
+                         kDaemonBusPath,
+                         kDaemonBusIface,
+                         QDBusConnection::systemBus());
+    auto watcher = new QDBusPendingCallWatcher(iface.asyncCall("QueryTPMLockout"), qApp);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, qApp, [onReply](QDBusPendingCallWatcher *call) {
+        QDBusPendingReply<QVariantMap> reply = *call;
+        call->deleteLater();
+
+        const QVariantMap &status = reply.isValid() ? reply.value() : QVariantMap();
+        {
+            QMutexLocker locker(&gLockoutMtx);
+            gLockoutStatus = tpm_utils::LockoutStatus();
+            gLockoutStatus.valid = status.value(disk_encrypt::tpm_lockout_keys::kKeyValid, false).toBool();
+            gLockoutStatus.inLockout = status.value(disk_encrypt::tpm_lockout_keys::kKeyInLockout).toBool();
+            gLockoutStatus.failedTries = status.value(disk_encrypt::tpm_lockout_keys::kKeyFailedTries).toInt();
+            gLockoutStatus.maxTries = status.value(disk_encrypt::tpm_lockout_keys::kKeyMaxTries).toInt();
+            gLockoutStatus.recoverySeconds = status.value(disk_encrypt::tpm_lockout_keys::kKeyRecoverySeconds).toInt();
+            gLockoutClock.start();
+            if (gLockoutStatus.valid)
+                qInfo() << "TPM lockout counter:" << gLockoutStatus.failedTries << "/" << gLockoutStatus.maxTries
+                        << "in lockout:" << gLockoutStatus.inLockout
+                        << "recovers in:" << gLockoutStatus.recoverySeconds;
+        }
+        if (onReply)
+            onReply();
+    });
 }
 
-int tpm_utils::isSupportAlgoByTPM(const QString &algoName, bool *support)
+tpm_utils::LockoutStatus tpm_utils::lockoutStatus()
 {
-    return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_IsTPMSupportAlgoPro", algoName, support).toInt();
+    QMutexLocker locker(&gLockoutMtx);
+    if (!gLockoutClock.isValid() || gLockoutClock.elapsed() >= kLockoutCacheLifetime)
+        requestLockoutStatus({});
+
+    // the time left goes down while the status is cached.
+    LockoutStatus status = gLockoutStatus;
+    if (gLockoutClock.isValid())
+        status.recoverySeconds = qMax(0, status.recoverySeconds - static_cast<int>(gLockoutClock.elapsed() / 1000));
+    return status;
 }
 
-int tpm_utils::encryptByTPM(const QVariantMap &map)
+void tpm_utils::queryLockoutStatus(QObject *context, const std::function<void(const LockoutStatus &)> &onReply)
 {
-    return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_EncryptByTPMPro", map).toInt();
+    QPointer<QObject> guard(context);
+    requestLockoutStatus([guard, onReply] {
+        if (guard)
+            onReply(lockoutStatus());
+    });
 }
 
-int tpm_utils::decryptByTPM(const QVariantMap &map, QString *psw)
+void tpm_utils::invalidateLockoutStatus()
 {
-    return dpfSlotChannel->push("dfmplugin_encrypt_manager", "slot_DecryptByTPMPro", map, psw).toInt();
+    QMutexLocker locker(&gLockoutMtx);
+    gLockoutClock.invalidate();
 }
 
 int device_utils::encKeyType(const QString &dev)
@@ -100,18 +328,12 @@ int device_utils::encKeyType(const QString &dev)
                          kDaemonBusIface,
                          QDBusConnection::systemBus());
     if (iface.isValid()) {
-        QDBusReply<QString> reply = iface.call("QueryTPMToken", dev);
+        QDBusReply<QVariantMap> reply = iface.call("QueryUsecToken", dev);
         if (!reply.isValid()) return 0;
-        QString tokenJson = reply.value();
-        if (tokenJson.isEmpty()) return 0;
-
-        QJsonDocument doc = QJsonDocument::fromJson(tokenJson.toLocal8Bit());
-        QJsonObject obj = doc.object();
-        cacheToken(dev, obj.toVariantMap());
-        QString usePin = obj.value("pin").toString("");
-        if (usePin.isEmpty()) return 0;
-        if (usePin == "1") return 1;
-        if (usePin == "0") return 2;
+        auto token = disk_encrypt::UsecToken::fromVariantMap(reply.value());
+        cacheToken(dev, token);
+        if (!token.isTPM()) return 0;
+        return token.pin ? 1 : 2;
     }
     return 0;
 }
@@ -120,6 +342,11 @@ int tpm_passphrase_utils::genPassphraseFromTPM(const QString &dev, const QString
 {
     Q_ASSERT(passphrase);
 
+    if (tpm_utils::lockoutStatus().locked()) {
+        qWarning() << "TPM is in lockout, cannot seal passphrase for" << dev;
+        return kTPMLocked;
+    }
+
     if ((tpm_utils::getRandomByTPM(kPasswordSize, passphrase) != 0)
         || passphrase->isEmpty()) {
         qCritical() << "TPM get random number failed!";
@@ -178,6 +405,12 @@ int tpm_passphrase_utils::genPassphraseFromTPM(const QString &dev, const QString
 
 QString tpm_passphrase_utils::getPassphraseFromTPM(const QString &dev, const QString &pin)
 {
+    // an attempt in lockout fails anyway after the whole policy session.
+    if (tpm_utils::lockoutStatus().locked()) {
+        qWarning() << "TPM is in lockout, cannot unseal passphrase of" << dev;
+        return "";
+    }
+
     const QString dirPath = kGlobalTPMConfigPath + dev;
     QSettings tpmSets(dirPath + QDir::separator() + "algo.ini", QSettings::IniFormat);
     const QString sessionHashAlgo = tpmSets.value(kConfigKeySessionHashAlgo).toString();
@@ -199,20 +432,17 @@ QString tpm_passphrase_utils::getPassphraseFromTPM(const QString &dev, const QSt
         qCritical() << "Failed to open token.json!";
         return "";
     }
-    QJsonDocument tokenDoc = QJsonDocument::fromJson(file.readAll());
+    auto token = disk_encrypt::UsecToken::fromJson(file.readAll());
     file.close();
 
-    QJsonObject obj = tokenDoc.object();
-    if (!obj.contains("pcr") || !obj.contains("pcr-bank")) {
+    if (token.pcr.isEmpty() || token.pcrBank.isEmpty()) {
         qCritical() << "Failed to get pcr or pcr-bank from token.json!";
         return "";
     }
-    const QString pcr = obj.value("pcr").toString();
-    const QString pcr_bank = obj.value("pcr-bank").toString();
     if (!pin.isEmpty())
         map.insert("PropertyKey_PinCode", pin);
-    map.insert("PropertyKey_Pcr", pcr);
-    map.insert("PropertyKey_PcrBank", pcr_bank);
+    map.insert("PropertyKey_Pcr", token.pcr);
+    map.insert("PropertyKey_PcrBank", token.pcrBank);
 
 
     QString passphrase;
@@ -220,6 +450,8 @@ QString tpm_passphrase_utils::getPassphraseFromTPM(const QString &dev, const QSt
     if (ok != 0) {
         qWarning() << "cannot acquire passphrase from TPM for device"
                    << dev;
+        // a wrong PIN is counted by the TPM.
+        tpm_utils::invalidateLockoutStatus();
     }
 
     qInfo() << "DEBUG INFORMATION>>>>>>>>>>>>>>> got passphrase from TPM of device"
@@ -233,6 +465,24 @@ bool tpm_passphrase_utils::getAlgorithm(QString *sessionHashAlgo, QString *sessi
                                         QString *primaryHashAlgo, QString *primaryKeyAlgo,
                                         QString *minorHashAlgo, QString *minorKeyAlgo)
 {
+    // probing takes a dozen of tpm commands and the result does not change,
+    // sealing several devices in a row probes only once.
+    static QStringList chosen;
+    if (chosen.count() == 6) {
+        *sessionHashAlgo = chosen.at(0);
+        *sessionKeyAlgo = chosen.at(1);
+        *primaryHashAlgo = chosen.at(2);
+        *primaryKeyAlgo = chosen.at(3);
+        *minorHashAlgo = chosen.at(4);
+        *minorKeyAlgo = chosen.at(5);
+        return true;
+    }
+    auto remember = [&] {
+        chosen = { *sessionHashAlgo, *sessionKeyAlgo, *primaryHashAlgo,
+                   *primaryKeyAlgo, *minorHashAlgo, *minorKeyAlgo };
+        return true;
+    };
+
     bool re1 { false };
     bool re2 { false };
     bool re3 { false };
@@ -253,7 +503,7 @@ bool tpm_passphrase_utils::getAlgorithm(QString *sessionHashAlgo, QString *sessi
         (*primaryKeyAlgo) = kTPMPrimaryKeyAlgo;
         (*minorHashAlgo) = kTPMMinorHashAlgo;
         (*minorKeyAlgo) = kTPMMinorKeyAlgo;
-        return true;
+        return remember();
     }
 
     re1 = false;
@@ -276,7 +526,7 @@ bool tpm_passphrase_utils::getAlgorithm(QString *sessionHashAlgo, QString *sessi
         (*primaryKeyAlgo) = kTCMPrimaryKeyAlgo;
         (*minorHashAlgo) = kTCMMinorHashAlgo;
         (*minorKeyAlgo) = kTCMMinorKeyAlgo;
-        return true;
+        return remember();
     }
 
     return false;
@@ -308,6 +558,86 @@ BlockDev device_utils::createBlockDevice(const QString &devObjPath)
     return monitor->createDeviceById(devObjPath).objectCast<DBlockDevice>();
 }
 
+QMap<QString, int> device_utils::tpmBoundDevices()
+{
+    using namespace dfmmount;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    Q_ASSERT(monitor);
+
+    QMap<QString, int> devices;
+    const QStringList &objPaths = monitor->getDevices();
+    for (const auto &objPath : objPaths) {
+        auto blkDev = monitor->createDeviceById(objPath).objectCast<DBlockDevice>();
+        if (!blkDev || !isEncrypted(blkDev))
+            continue;
+        int type = encKeyType(blkDev->device());
+        if (type != disk_encrypt::kPasswordOnly)
+            devices.insert(blkDev->device(), type);
+    }
+    return devices;
+}
+
+QString device_utils::resolveDeviceObject(const QString &devNode)
+{
+    using namespace dfmmount;
+    auto monitor = DDeviceManager::instance()->getRegisteredMonitor(DeviceType::kBlockDevice).objectCast<DBlockMonitor>();
+    Q_ASSERT(monitor);
+    const QStringList &objPaths = monitor->resolveDeviceNode(devNode, {});
+    return objPaths.isEmpty() ? "" : objPaths.constFirst();
+}
+
+QString device_utils::partUUID(const QString &dev)
+{
+    const QString &devPath = QFileInfo(dev).canonicalFilePath();
+    QDirIterator iter("/dev/disk/by-partuuid", QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
+    while (iter.hasNext()) {
+        iter.next();
+        if (iter.fileInfo().canonicalFilePath() == devPath)
+            return iter.fileName();
+    }
+    return "";
+}
+
+bool device_utils::hasPartUUID(const QString &dev)
+{
+    return !partUUID(dev).isEmpty();
+}
+
+bool device_utils::hasDetachedHeader(const QString &dev)
+{
+    const QString &uuid = partUUID(dev);
+    return !uuid.isEmpty() && QFile::exists(QString("%1/%2.luks2").arg(kDetachedHeaderDir).arg(uuid));
+}
+
+bool device_utils::isEncrypted(const BlockDev &blkDev)
+{
+    return blkDev && (blkDev->isEncrypted() || hasDetachedHeader(blkDev->device()));
+}
+
+QString device_utils::clearDevice(const QString &dev)
+{
+    const QString &devName = QFileInfo(dev).canonicalFilePath().mid(5);
+    QDir holders(QString("/sys/class/block/%1/holders").arg(devName));
+    const QStringList &holderNames = holders.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const auto &holder : holderNames) {
+        QFile uuid(QString("/sys/class/block/%1/dm/uuid").arg(holder));
+        if (uuid.open(QIODevice::ReadOnly) && uuid.readAll().startsWith("CRYPT-"))
+            return "/dev/" + holder;
+    }
+    return "";
+}
+
+QString device_utils::mountPoint(const QString &dev)
+{
+    const QString &devPath = QFileInfo(dev).canonicalFilePath();
+    const auto &volumes = QStorageInfo::mountedVolumes();
+    for (const auto &volume : volumes) {
+        if (QFileInfo(QString(volume.device())).canonicalFilePath() == devPath)
+            return volume.rootPath();
+    }
+    return "";
+}
+
 void dialog_utils::showDialog(const QString &title, const QString &msg, DialogType type)
 {
     QString icon;
@@ -330,9 +660,9 @@ void dialog_utils::showDialog(const QString &title, const QString &msg, DialogTy
     d.exec();
 }
 
-void device_utils::cacheToken(const QString &device, const QVariantMap &token)
+void device_utils::cacheToken(const QString &device, const disk_encrypt::UsecToken &token)
 {
-    if (token.isEmpty()) {
+    if (!token.isTPM()) {
         QDir tmp("/tmp");
         tmp.rmpath(kGlobalTPMConfigPath + device);
         return;
@@ -356,29 +686,22 @@ void device_utils::cacheToken(const QString &device, const QVariantMap &token)
     if (!tpmPath.exists())
         tpmPath.mkpath(devTpmConfigPath);
 
-    QJsonObject obj = QJsonObject::fromVariantMap(token);
-    QJsonDocument doc(obj);
-    QByteArray iv = obj.value("iv").toString().toLocal8Bit();
-    QByteArray keyPriv = obj.value("kek-priv").toString().toLocal8Bit();
-    QByteArray keyPub = obj.value("kek-pub").toString().toLocal8Bit();
-    QByteArray cipher = obj.value("enc").toString().toLocal8Bit();
-    iv = QByteArray::fromBase64(iv);
-    keyPriv = QByteArray::fromBase64(keyPriv);
-    keyPub = QByteArray::fromBase64(keyPub);
-    cipher = QByteArray::fromBase64(cipher);
+    // the index is kept for updating the same token when passphrase changed.
+    QJsonObject obj = token.toJsonObject();
+    obj.insert("token_index", token.index);
 
     bool ret = true;
-    ret &= makeFile(devTpmConfigPath + "/token.json", doc.toJson());
-    ret &= makeFile(devTpmConfigPath + "/iv.bin", iv);
-    ret &= makeFile(devTpmConfigPath + "/key.priv", keyPriv);
-    ret &= makeFile(devTpmConfigPath + "/key.pub", keyPub);
-    ret &= makeFile(devTpmConfigPath + "/cipher.out", cipher);
+    ret &= makeFile(devTpmConfigPath + "/token.json", QJsonDocument(obj).toJson());
+    ret &= makeFile(devTpmConfigPath + "/iv.bin", token.iv);
+    ret &= makeFile(devTpmConfigPath + "/key.priv", token.kekPriv);
+    ret &= makeFile(devTpmConfigPath + "/key.pub", token.kekPub);
+    ret &= makeFile(devTpmConfigPath + "/cipher.out", token.enc);
 
     QSettings algo(devTpmConfigPath + "/algo.ini", QSettings::IniFormat);
-    algo.setValue("session_hash_algo", obj.value("session-hash-alg").toString());
-    algo.setValue("session_key_algo", obj.value("session-key-alg").toString());
-    algo.setValue("primary_hash_algo", obj.value("primary-hash-alg").toString());
-    algo.setValue("primary_key_algo", obj.value("primary-key-alg").toString());
+    algo.setValue("session_hash_algo", token.sessionHashAlg);
+    algo.setValue("session_key_algo", token.sessionKeyAlg);
+    algo.setValue("primary_hash_algo", token.primaryHashAlg);
+    algo.setValue("primary_key_algo", token.primaryKeyAlg);
 
     if (!ret)
         tpmPath.rmpath(devTpmConfigPath);
@@ -397,9 +720,16 @@ void dialog_utils::showTPMError(const QString &title, tpm_passphrase_utils::TPME
     case tpm_passphrase_utils::kTPMEncryptFailed:
         msg = QObject::tr("TPM encrypt failed.");
         break;
-    case tpm_passphrase_utils::kTPMLocked:
+    case tpm_passphrase_utils::kTPMTimeout:
+        msg = QObject::tr("TPM does not respond, please try again later.");
+        break;
+    case tpm_passphrase_utils::kTPMLocked: {
         msg = QObject::tr("TPM is locked.");
+        int secs = tpm_utils::lockoutStatus().recoverySeconds;
+        if (secs > 0)
+            msg += QObject::tr(" Please retry in %1 minute(s).").arg((secs + 59) / 60);
         break;
+    }
     default:
         break;
     }
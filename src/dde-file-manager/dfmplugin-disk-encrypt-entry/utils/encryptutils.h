@@ -7,6 +7,9 @@
 
 #include <QString>
 #include <QVariantMap>
+#include <QObject>
+
+#include <functional>
 
 namespace dfmmount {
 class DBlockDevice;
@@ -16,24 +19,54 @@ typedef QSharedPointer<dfmmount::DBlockDevice> BlockDev;
 
 namespace dfmplugin_diskenc {
 
-namespace tpm_utils {
-int checkTPM();
-int getRandomByTPM(int size, QString *output);
-int isSupportAlgoByTPM(const QString &algoName, bool *support);
-int encryptByTPM(const QVariantMap &map);
-int decryptByTPM(const QVariantMap &map, QString *psw);
-}   // namespace tpm_utils
-
 namespace tpm_passphrase_utils {
-
 enum TPMError {
     kTPMNoError,
     kTPMEncryptFailed,
     kTPMLocked,
     kTPMNoRandomNumber,
     kTPMMissingAlog,
+
+    kTPMTimeout = 100,   // no answer from TPM before the deadline
 };
+}   // namespace tpm_passphrase_utils
 
+namespace tpm_utils {
+// deadlines of the calls to TPM, in milliseconds.
+inline constexpr int kTPMProbeTimeout { 5000 };
+inline constexpr int kTPMSealTimeout { 30000 };
+
+// dictionary attack state of the TPM, objects guarded by it cannot be
+// used while the TPM is in lockout.
+struct LockoutStatus
+{
+    bool valid { false };   // the counters cannot be read, e.g. on TCM
+    bool inLockout { false };
+    int failedTries { 0 };
+    int maxTries { 0 };
+    int recoverySeconds { 0 };   // one failure is forgotten after each interval
+
+    inline int remainingTries() const { return qMax(0, maxTries - failedTries); }
+    inline bool locked() const { return valid && (inLockout || (maxTries > 0 && failedTries >= maxTries)); }
+};
+
+// the calls are run one by one in a dedicated thread. they return
+// kTPMTimeout if TPM does not answer in time, and fail at once until the
+// timed out call is finished. called in main thread, events except user
+// input are still processed while waiting.
+int checkTPM(int timeout = kTPMProbeTimeout);
+int getRandomByTPM(int size, QString *output, int timeout = kTPMProbeTimeout);
+int isSupportAlgoByTPM(const QString &algoName, bool *support, int timeout = kTPMProbeTimeout);
+int encryptByTPM(const QVariantMap &map, int timeout = kTPMSealTimeout);
+int decryptByTPM(const QVariantMap &map, QString *psw, int timeout = kTPMSealTimeout);
+// the last status got from daemon, never blocks. a new one is requested
+// when it's out of date.
+LockoutStatus lockoutStatus();
+void queryLockoutStatus(QObject *context, const std::function<void(const LockoutStatus &)> &onReply);
+void invalidateLockoutStatus();
+}   // namespace tpm_utils
+
+namespace tpm_passphrase_utils {
 bool getAlgorithm(QString *sessionHashAlgo, QString *sessionKeyAlgo,
                   QString *primaryHashAlgo, QString *primaryKeyAlgo,
                   QString *minorHashAlgo, QString *minorKeyAlgo);
@@ -44,6 +77,8 @@ QString getPassphraseFromTPM(const QString &dev, const QString &pin);
 namespace config_utils {
 bool exportKeyEnabled();
 QString cipherType();
+bool deferredUnlockEnabled();
+bool detachedHeaderEnabled();
 }   // namespace config_utils
 
 namespace recovery_key_utils {
@@ -56,8 +91,20 @@ bool isFstabItem(const QString &mpt);
 
 namespace device_utils {
 int encKeyType(const QString &dev);
-void cacheToken(const QString &device, const QVariantMap &token);
+void cacheToken(const QString &device, const disk_encrypt::UsecToken &token);
 BlockDev createBlockDevice(const QString &devObjPath);
+QString resolveDeviceObject(const QString &devNode);
+QMap<QString, int> tpmBoundDevices();
+// the daemon keys detached headers by PARTUUID.
+QString partUUID(const QString &dev);
+bool hasPartUUID(const QString &dev);
+// a device encrypted with a detached header carries no LUKS signature,
+// udisks does not know it's encrypted.
+bool hasDetachedHeader(const QString &dev);
+bool isEncrypted(const BlockDev &blkDev);
+// the cleartext device mapped from dev, empty if it's not unlocked.
+QString clearDevice(const QString &dev);
+QString mountPoint(const QString &dev);
 }   // namespace device_utils
 
 namespace dialog_utils {
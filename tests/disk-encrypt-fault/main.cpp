@@ -0,0 +1,470 @@
+// SPDX-FileCopyrightText: 2023 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// power loss tests of the disk encryption, run as root:
+//   dfm-encrypt-fault-runner [--points p1,p2] [--delay ms] [--size MiB] [--csv file]
+// for each fault point a partition on a loop device is formatted and filled,
+// encrypted or decrypted by a child process that is killed at the point,
+// resumed the way the daemon does after a reboot, and checked against the
+// data written before. one csv row of the resume metrics recorded in the job
+// history is printed per point. the job state is kept in a temporary dir.
+
+#include "daemonplugin_file_encrypt_global.h"
+#include "encrypt/diskencrypt.h"
+#include "history/jobhistory.h"
+#include "fault/faultinjection.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QProcess>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QUuid>
+
+#include <libcryptsetup.h>
+
+#include <cstring>
+
+#include <unistd.h>
+
+FILE_ENCRYPT_USE_NS
+
+static constexpr char kFaultEnv[] { "DFM_DISK_ENCRYPT_FAULT" };
+static constexpr char kStateDirEnv[] { "DFM_DISK_ENCRYPT_STATE_DIR" };
+static constexpr char kFaultLog[] { "fault-injection.jsonl" };
+static constexpr char kPassphrase[] { "dfm-fault-injection" };
+static constexpr char kCipher[] { "aes" };
+static constexpr char kDataFile[] { "fault-data.bin" };
+static constexpr char kVerifyName[] { "dfm-fault-verify" };
+
+// the child job passing a point and the one resuming it. a device is
+// encrypted first for the decrypt points, the decryption is resumed by
+// running it again as the daemon does.
+struct PointJob
+{
+    QString type;   // of the job history
+    QString child;
+    QString resumeChild;
+};
+
+static const QMap<QString, PointJob> kPointJobs {
+    { "encrypt-hotzone", { "encrypt", "--encrypt", "--resume" } },
+    { "expand-fs", { "encrypt", "--encrypt", "--resume" } },
+    { "decrypt-hotzone", { "decrypt", "--decrypt-offline", "--resume-decrypt" } },
+    { "recover-superblock", { "decrypt", "--decrypt-offline", "--resume-decrypt" } },
+    { "decrypt-datashift", { "decrypt", "--decrypt", "--resume-decrypt" } },
+};
+
+struct PointResult
+{
+    QString point;
+    bool hit { false };   // the child was killed at the point
+    int resumeResult { 0 };
+    qint64 resumeWall { 0 };   // ms
+    qint64 timeToResume { 0 };   // ms, by job history
+    quint64 bytesReprocessed { 0 };
+    qint64 recoverHotzone { 0 };   // ms, by job history
+    int faultDelay { -1 };   // ms, by fault log
+    bool verified { false };
+};
+
+static int runCmd(const QString &cmd, const QStringList &args, QString *out = nullptr)
+{
+    QProcess proc;
+    proc.start(cmd, args);
+    if (!proc.waitForFinished(-1) || proc.exitStatus() != QProcess::NormalExit) {
+        qWarning() << "cannot run" << cmd << args << proc.errorString();
+        return -1;
+    }
+    if (out)
+        *out = proc.readAllStandardOutput().trimmed();
+    if (proc.exitCode() != 0)
+        qWarning() << cmd << args << "exit with" << proc.exitCode() << proc.readAllStandardError();
+    return proc.exitCode();
+}
+
+static QByteArray fileHash(const QString &path)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+        return {};
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(&f);
+    return hash.result().toHex();
+}
+
+static bool writeData(const QString &path, qint64 size)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    QByteArray chunk(1024 * 1024, Qt::Uninitialized);
+    for (qint64 written = 0; written < size; written += chunk.size()) {
+        QRandomGenerator::global()->fillRange(reinterpret_cast<quint32 *>(chunk.data()),
+                                              chunk.size() / sizeof(quint32));
+        if (f.write(chunk) != chunk.size())
+            return false;
+    }
+    f.flush();
+    return ::fsync(f.handle()) == 0;
+}
+
+static bool hasLuksHeader(const QString &device)
+{
+    struct crypt_device *cdev { nullptr };
+    if (crypt_init(&cdev, device.toStdString().c_str()) < 0)
+        return false;
+    bool ret = crypt_load(cdev, CRYPT_LUKS, nullptr) == 0;
+    crypt_free(cdev);
+    return ret;
+}
+
+static crypt_reencrypt_info reencryptStatus(const QString &device)
+{
+    struct crypt_device *cdev { nullptr };
+    if (crypt_init(&cdev, device.toStdString().c_str()) < 0)
+        return CRYPT_REENCRYPT_INVALID;
+    crypt_reencrypt_info info = CRYPT_REENCRYPT_NONE;
+    if (crypt_load(cdev, CRYPT_LUKS2, nullptr) == 0)
+        info = crypt_reencrypt_status(cdev, nullptr);
+    crypt_free(cdev);
+    return info;
+}
+
+static void deactivate(const QString &name)
+{
+    if (QFile::exists("/dev/mapper/" + name))
+        crypt_deactivate(nullptr, name.toStdString().c_str());
+}
+
+// the delay of the kill logged by the child, -1 if it was not killed.
+static int faultDelay(qint64 pid)
+{
+    QFile f(QString("%1/%2").arg(fault_injection::stateDir()).arg(kFaultLog));
+    if (!f.open(QIODevice::ReadOnly))
+        return -1;
+    int delay = -1;
+    while (!f.atEnd()) {
+        const QJsonObject &obj = QJsonDocument::fromJson(f.readLine()).object();
+        if (obj.value("pid").toVariant().toLongLong() == pid)
+            delay = obj.value("delay").toInt();
+    }
+    return delay;
+}
+
+// what the daemon does for an encryption: the prepare job sets up the header,
+// then the encrypt job moves the data. it's run in a child to be killed.
+static int childEncrypt(const QString &device)
+{
+    EncryptParams params;
+    params.device = device;
+    params.passphrase = kPassphrase;
+    params.cipher = kCipher;
+
+    int keyslotCipher = -1, keyslotRecKey = -1;
+    VolumeKeyPtr vk;
+    QString headerPath;
+    job_history::begin(QUuid::createUuid().toString(), "encrypt-prepare", device);
+    int ret = disk_encrypt_funcs::bcInitHeaderFile(params, headerPath, &keyslotCipher, &keyslotRecKey, &vk);
+    if (ret == kSuccess)
+        ret = disk_encrypt_funcs::bcInitHeaderDevice(device, params.passphrase, headerPath);
+    job_history::finish(ret);
+    if (ret != kSuccess)
+        return -ret;
+
+    job_history::begin(QUuid::createUuid().toString(), "encrypt", device);
+    ret = disk_encrypt_funcs::bcResumeReencrypt(device, params.passphrase, QString(), vk);
+    job_history::finish(ret);
+    return -ret;
+}
+
+// what the daemon does for an interrupted encryption after reboot.
+static int childResume(const QString &device)
+{
+    job_history::begin(QUuid::createUuid().toString(), "encrypt", device);
+    int ret = disk_encrypt_funcs::bcResumeReencrypt(device, kPassphrase);
+    job_history::finish(ret);
+    return -ret;
+}
+
+// what the daemon does for a decryption, online through the mapping of the
+// unlocked device or offline.
+static int childDecrypt(const QString &device, bool online)
+{
+    QString activeName;
+    if (online) {
+        activeName = QString("dm-%1").arg(device.mid(5));
+        struct crypt_device *cdev { nullptr };
+        int ret = crypt_init(&cdev, device.toStdString().c_str());
+        if (ret == 0)
+            ret = crypt_load(cdev, CRYPT_LUKS2, nullptr);
+        if (ret == 0)
+            ret = crypt_activate_by_passphrase(cdev, activeName.toStdString().c_str(), CRYPT_ANY_SLOT,
+                                               kPassphrase, strlen(kPassphrase), 0);
+        if (cdev)
+            crypt_free(cdev);
+        if (ret < 0) {
+            qWarning() << "cannot activate" << device << ret;
+            return -ret;
+        }
+    }
+
+    job_history::begin(QUuid::createUuid().toString(), "decrypt", device);
+    int ret = online
+            ? disk_encrypt_funcs::bcDecryptDeviceOnline(device, kPassphrase, activeName)
+            : disk_encrypt_funcs::bcDecryptDevice(device, kPassphrase);
+    job_history::finish(ret);
+    return -ret;
+}
+
+// what the daemon does for an interrupted decryption after reboot: the
+// online one goes on from the kept header, the offline one starts again.
+static int childResumeDecrypt(const QString &device)
+{
+    bool resume = !block_device_utils::bcInterruptedDecryptHeader(device).isEmpty();
+    job_history::begin(QUuid::createUuid().toString(), "decrypt", device);
+    int ret = resume
+            ? disk_encrypt_funcs::bcDecryptDeviceOnline(device, kPassphrase, QString())
+            : disk_encrypt_funcs::bcDecryptDevice(device, kPassphrase);
+    job_history::finish(ret);
+    return -ret;
+}
+
+static bool checkData(const QString &clearDev, const QByteArray &expected)
+{
+    bool ok = runCmd("e2fsck", { "-fn", clearDev }) == 0;
+    QTemporaryDir mnt;
+    if (ok && runCmd("mount", { "-o", "ro", clearDev, mnt.path() }) == 0) {
+        ok = fileHash(mnt.filePath(kDataFile)) == expected;
+        runCmd("umount", { mnt.path() });
+    } else {
+        ok = false;
+    }
+    return ok;
+}
+
+static bool verifyEncrypted(const QString &device, const QByteArray &expected)
+{
+    struct crypt_device *cdev { nullptr };
+    if (crypt_init(&cdev, device.toStdString().c_str()) < 0)
+        return false;
+    int ret = crypt_load(cdev, CRYPT_LUKS2, nullptr);
+    if (ret == 0)
+        ret = crypt_activate_by_passphrase(cdev, kVerifyName, CRYPT_ANY_SLOT,
+                                           kPassphrase, strlen(kPassphrase),
+                                           CRYPT_ACTIVATE_READONLY);
+    crypt_free(cdev);
+    if (ret < 0) {
+        qWarning() << "cannot activate" << device << ret;
+        return false;
+    }
+
+    bool ok = checkData(QString("/dev/mapper/%1").arg(kVerifyName), expected);
+    deactivate(kVerifyName);
+    return ok;
+}
+
+static bool verifyDecrypted(const QString &device, const QByteArray &expected)
+{
+    if (hasLuksHeader(device)) {
+        qWarning() << "device is still encrypted" << device;
+        return false;
+    }
+    return checkData(device, expected);
+}
+
+// runs this program as a child doing a job of the daemon, killed at the
+// point if one is given.
+static bool runChild(const QString &mode, const QString &device, const QString &fault,
+                     int *ret, qint64 *pid = nullptr)
+{
+    QProcess child;
+    if (!fault.isEmpty()) {
+        auto env = QProcessEnvironment::systemEnvironment();
+        env.insert(kFaultEnv, fault);
+        child.setProcessEnvironment(env);
+    }
+    child.setProcessChannelMode(QProcess::ForwardedChannels);
+    child.start(QCoreApplication::applicationFilePath(), { mode, device });
+    if (pid)
+        *pid = child.processId();
+    child.waitForFinished(-1);
+    bool crashed = child.exitStatus() == QProcess::CrashExit;
+    *ret = crashed ? -1 : -child.exitCode();
+    return !crashed;
+}
+
+static void fillHistory(const QString &device, const QString &type, PointResult *result)
+{
+    const QVariantList &records = job_history::query({ { "device", device },
+                                                       { "type", type },
+                                                       { "limit", 1 } });
+    if (records.isEmpty())
+        return;
+    const QVariantMap &record = records.first().toMap();
+    if (!record.value("resumed").toBool())
+        return;
+    result->timeToResume = record.value("timeToResume").toLongLong();
+    result->bytesReprocessed = record.value("bytesReprocessed").toULongLong();
+    result->recoverHotzone = record.value("phases").toMap().value("recover-hotzone", 0).toLongLong();
+}
+
+static PointResult drivePoint(const QString &point, int maxDelay, qint64 sizeMiB)
+{
+    PointResult result;
+    result.point = point;
+    const PointJob &job = kPointJobs.value(point);
+    if (job.child.isEmpty()) {
+        qWarning() << "unknown point" << point;
+        return result;
+    }
+
+    QTemporaryDir work;
+    const QString &image = work.filePath("disk.img");
+    QFile img(image);
+    if (!img.open(QIODevice::WriteOnly) || !img.resize(sizeMiB * 1024 * 1024)) {
+        qWarning() << "cannot create image" << image;
+        return result;
+    }
+    img.close();
+
+    // the kept headers and the checkpoints are named by the partuuid.
+    if (runCmd("parted", { "-s", image, "mklabel", "gpt", "mkpart", "data", "1MiB", "100%" }) != 0)
+        return result;
+    QString loop;
+    if (runCmd("losetup", { "--find", "--show", "--partscan", image }, &loop) != 0 || loop.isEmpty())
+        return result;
+    runCmd("udevadm", { "settle" });
+    const QString &part = loop + "p1";
+    const QString &activeName = QString("dm-%1").arg(part.mid(5));
+
+    QByteArray expected;
+    const QString &mnt = work.filePath("mnt");
+    QDir().mkpath(mnt);
+    if (runCmd("mkfs.ext4", { "-q", part }) == 0
+        && runCmd("mount", { part, mnt }) == 0) {
+        // half of the device, so the shrunk filesystem still holds it.
+        if (writeData(QDir(mnt).filePath(kDataFile), sizeMiB * 1024 * 1024 / 2))
+            expected = fileHash(QDir(mnt).filePath(kDataFile));
+        runCmd("umount", { mnt });
+    }
+
+    int ret = kSuccess;
+    if (!expected.isEmpty() && job.type == "decrypt"
+        && (!runChild("--encrypt", part, QString(), &ret) || ret != kSuccess)) {
+        qWarning() << "cannot encrypt" << part << "for" << point << ret;
+        expected.clear();
+    }
+
+    if (!expected.isEmpty()) {
+        qint64 pid = 0;
+        result.hit = !runChild(job.child, part, QString("%1:%2").arg(point).arg(maxDelay), &ret, &pid);
+        result.faultDelay = faultDelay(pid);
+        if (!result.hit)
+            qWarning() << point << "is not hit, the job exit with" << ret;
+
+        // the mappings are gone with the power. a kill after the data is
+        // moved leaves nothing to resume.
+        deactivate(activeName);
+        bool interrupted = (job.type == "encrypt")
+                ? reencryptStatus(part) != CRYPT_REENCRYPT_NONE
+                : hasLuksHeader(part) || !block_device_utils::bcInterruptedDecryptHeader(part).isEmpty();
+        if (interrupted) {
+            QElapsedTimer clock;
+            clock.start();
+            runChild(job.resumeChild, part, QString(), &result.resumeResult);
+            result.resumeWall = clock.elapsed();
+            fillHistory(part, job.type, &result);
+        }
+        deactivate(activeName);
+        result.verified = result.resumeResult == kSuccess
+                && (job.type == "encrypt" ? verifyEncrypted(part, expected)
+                                          : verifyDecrypted(part, expected));
+    }
+
+    deactivate(activeName);
+    const QString &keptHeader = block_device_utils::bcDecryptHeaderPath(part);
+    if (!keptHeader.isEmpty())
+        QFile::remove(keptHeader);
+    runCmd("losetup", { "-d", loop });
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const QStringList &args = app.arguments();
+
+    if (args.value(1) == "--encrypt")
+        return childEncrypt(args.value(2));
+    if (args.value(1) == "--resume")
+        return childResume(args.value(2));
+    if (args.value(1) == "--decrypt")
+        return childDecrypt(args.value(2), true);
+    if (args.value(1) == "--decrypt-offline")
+        return childDecrypt(args.value(2), false);
+    if (args.value(1) == "--resume-decrypt")
+        return childResumeDecrypt(args.value(2));
+
+    if (::geteuid() != 0) {
+        qCritical() << "loop devices and dm-crypt need root";
+        return 1;
+    }
+
+    // the children inherit it.
+    QTemporaryDir stateDir;
+    if (!stateDir.isValid()) {
+        qCritical() << "cannot create the state dir";
+        return 1;
+    }
+    qputenv(kStateDirEnv, stateDir.path().toLocal8Bit());
+
+    QStringList points = kPointJobs.keys();
+    int maxDelay = 2000;
+    qint64 sizeMiB = 256;
+    QString csvPath;
+    for (int i = 1; i < args.size() - 1; ++i) {
+        if (args.at(i) == "--points")
+            points = args.at(++i).split(',', QString::SkipEmptyParts);
+        else if (args.at(i) == "--delay")
+            maxDelay = args.at(++i).toInt();
+        else if (args.at(i) == "--size")
+            sizeMiB = args.at(++i).toLongLong();
+        else if (args.at(i) == "--csv")
+            csvPath = args.at(++i);
+    }
+
+    QFile csv;
+    if (csvPath.isEmpty()) {
+        csv.open(stdout, QIODevice::WriteOnly);
+    } else {
+        csv.setFileName(csvPath);
+        if (!csv.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qCritical() << "cannot write" << csvPath;
+            return 1;
+        }
+    }
+    QTextStream out(&csv);
+    out << "point,hit,faultDelayMs,resumeResult,resumeWallMs,timeToResumeMs,"
+           "bytesReprocessed,recoverHotzoneMs,verified\n";
+
+    int failed = 0;
+    for (const QString &point : points) {
+        const PointResult &r = drivePoint(point, maxDelay, sizeMiB);
+        out << r.point << ',' << r.hit << ',' << r.faultDelay << ','
+            << r.resumeResult << ',' << r.resumeWall << ',' << r.timeToResume << ','
+            << r.bytesReprocessed << ',' << r.recoverHotzone << ',' << r.verified << '\n';
+        out.flush();
+        if (!r.hit || !r.verified)
+            ++failed;
+    }
+    return failed;
+}